@@ -850,6 +850,42 @@ int  mdb_env_get_path(MDB_env *env, const char **path);
 	 */
 int  mdb_env_get_fd(MDB_env *env, mdb_filehandle_t *fd);
 
+	/** @brief Return the address and size of the environment's memory map.
+	 *
+	 * Unless the environment was opened with #MDB_WRITEMAP the map is
+	 * read-only. It is replaced whenever the map size changes, so the
+	 * address is only valid until the next #mdb_env_set_mapsize().
+	 *
+	 * @param[in] env An environment handle returned by #mdb_env_create()
+	 * @param[out] addr Address of a pointer to receive the map address.
+	 * @param[out] size Address of a #mdb_size_t to receive the map size.
+	 * @return A non-zero error value on failure and 0 on success. Some possible
+	 * errors are:
+	 * <ul>
+	 *	<li>EINVAL - an invalid parameter was specified, the environment
+	 *	is not open, or the map is not contiguous (MDB_VL32 builds).
+	 * </ul>
+	 */
+int  mdb_env_get_map(MDB_env *env, void **addr, mdb_size_t *size);
+
+	/** @brief Set the number of threads which write the pages of a large commit.
+	 *
+	 * By default the committing thread writes every dirty page itself. With
+	 * more than one thread, a commit which writes many pages splits them into
+	 * runs of contiguous pages, which are written concurrently by that many
+	 * threads (including the committing one). All of them are written before
+	 * the meta page, as usual. Ignored with #MDB_WRITEMAP, and on Windows.
+	 *
+	 * @param[in] env An environment handle returned by #mdb_env_create()
+	 * @param[in] threads The number of threads, from 1 to 64
+	 * @return A non-zero error value on failure and 0 on success. Some possible
+	 * errors are:
+	 * <ul>
+	 *	<li>EINVAL - an invalid parameter was specified.
+	 * </ul>
+	 */
+int  mdb_env_set_flush_threads(MDB_env *env, unsigned int threads);
+
 	/** @brief Set the size of the memory map to use for this environment.
 	 *
 	 * The size should be a multiple of the OS page size. The default is
@@ -1332,6 +1368,30 @@ int  mdb_set_relctx(MDB_txn *txn, MDB_dbi dbi, void *ctx);
 	 */
 int  mdb_get(MDB_txn *txn, MDB_dbi dbi, MDB_val *key, MDB_val *data);
 
+	/** @brief Get the items of many keys from a database.
+	 *
+	 * Looks up each of \b keys as #mdb_get() would, returning the results
+	 * in input order. The tree descents of several keys are interleaved,
+	 * with each next page prefetched while the other keys are searched, so
+	 * that their cache and TLB misses overlap instead of adding up.
+	 * @note As with #mdb_get(), the returned values are valid only until a
+	 * subsequent update operation, or the end of the transaction.
+	 * @param[in] txn A transaction handle returned by #mdb_txn_begin()
+	 * @param[in] dbi A database handle returned by #mdb_dbi_open()
+	 * @param[in] count The number of keys
+	 * @param[in] keys The keys to search for in the database
+	 * @param[out] data The data corresponding to each key
+	 * @param[out] rcs The result of each lookup, as #mdb_get() returns
+	 * it: 0, #MDB_NOTFOUND, or another error value.
+	 * @return A non-zero error value if no lookup could be made, and 0
+	 * otherwise. Some possible errors are:
+	 * <ul>
+	 *	<li>EINVAL - an invalid parameter was specified.
+	 * </ul>
+	 */
+int  mdb_get_multi(MDB_txn *txn, MDB_dbi dbi, unsigned int count,
+	MDB_val *keys, MDB_val *data, int *rcs);
+
 	/** @brief Store items into a database.
 	 *
 	 * This function stores key/data pairs in the database. The default behavior
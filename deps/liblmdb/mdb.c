@@ -130,6 +130,28 @@ extern int cacheflush(char *addr, int nbytes, int cache);
 #define	BROKEN_FDATASYNC
 #endif
 
+#if defined(MDB_USE_IO_URING) && !defined(__linux)
+#undef MDB_USE_IO_URING
+#endif
+#ifdef MDB_USE_IO_URING
+/** Submit the page writes of a commit through io_uring, as a few
+ *	batches of SQEs instead of one syscall per #MDB_COMMIT_PAGES pages,
+ *	with the commit's fdatasync in the last batch. Uses the raw syscalls,
+ *	so no liburing is needed. Falls back to pwritev() if the kernel has
+ *	no io_uring, or it is disallowed.
+ */
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(MDB_NO_SIMD)
+/** Compare keys longer than 16 bytes with SSE2, which every x86-64 CPU
+ *	has, or AVX2 if the CPU reports it at runtime.
+ */
+#define MDB_SIMD	1
+#include <immintrin.h>
+#endif
+
 #include <errno.h>
 #include <limits.h>
 #include <stddef.h>
@@ -1525,6 +1547,12 @@ struct MDB_env {
 	int		me_pidquery;		/**< Used in OpenProcess */
 	OVERLAPPED	*ov;			/**< Used for for overlapping I/O requests */
 	int		ovs;				/**< Count of OVERLAPPEDs */
+#endif
+	unsigned int	me_flush_threads;	/**< see #mdb_env_set_flush_threads() */
+#ifdef MDB_USE_IO_URING
+	struct MDB_uring	*me_uring;	/**< for #mdb_page_flush(), set up on first use */
+	int		me_uring_off;		/**< io_uring is unavailable, use pwritev() */
+	int		me_flush_synced;	/**< the last #mdb_page_flush() also synced */
 #endif
 #ifdef MDB_USE_POSIX_MUTEX	/* Posix mutexes reside in shared mem */
 #	define		me_rmutex	me_txns->mti_rmutex /**< Shared reader lock */
@@ -3654,6 +3682,260 @@ mdb_freelist_save(MDB_txn *txn)
 	return rc;
 }
 
+#ifdef MDB_USE_IO_URING
+	/** SQ entries of the ring; a bigger flush waits for each full batch */
+#define MDB_URING_ENTRIES	256
+	/** iovecs of the writes in one batch */
+#define MDB_URING_IOVS	4096
+
+typedef struct MDB_uring {
+	int		mu_fd;
+	unsigned	mu_entries;
+	unsigned	*mu_sq_tail, *mu_sq_mask, *mu_sq_array;
+	unsigned	*mu_cq_head, *mu_cq_tail, *mu_cq_mask;
+	struct io_uring_sqe	*mu_sqes;
+	struct io_uring_cqe	*mu_cqes;
+	void	*mu_sq_ring, *mu_cq_ring;
+	size_t	mu_sq_size, mu_cq_size;
+	/** iovecs of the queued writes, which must live until they complete */
+	struct iovec	mu_iov[MDB_URING_IOVS];
+} MDB_uring;
+
+static void ESECT
+mdb_uring_close(MDB_env *env)
+{
+	MDB_uring *ur = env->me_uring;
+	if (!ur)
+		return;
+	munmap(ur->mu_sqes, ur->mu_entries * sizeof(struct io_uring_sqe));
+	if (ur->mu_cq_ring != ur->mu_sq_ring)
+		munmap(ur->mu_cq_ring, ur->mu_cq_size);
+	munmap(ur->mu_sq_ring, ur->mu_sq_size);
+	close(ur->mu_fd);
+	free(ur);
+	env->me_uring = NULL;
+}
+
+/** Return the env's ring, setting it up on first use, or NULL to use
+ *	pwritev() instead.
+ */
+static MDB_uring *
+mdb_uring_get(MDB_env *env)
+{
+	struct io_uring_params p;
+	MDB_uring *ur;
+	char *sq, *cq;
+
+	if (env->me_uring || env->me_uring_off)
+		return env->me_uring;
+	env->me_uring_off = 1;
+	if ((ur = calloc(1, sizeof(MDB_uring))) == NULL)
+		return NULL;
+	memset(&p, 0, sizeof(p));
+	ur->mu_fd = syscall(__NR_io_uring_setup, MDB_URING_ENTRIES, &p);
+	if (ur->mu_fd < 0) {
+		DPRINTF(("io_uring_setup: %s", strerror(errno)));
+		free(ur);
+		return NULL;
+	}
+	ur->mu_entries = p.sq_entries;
+	ur->mu_sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ur->mu_cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ur->mu_cq_size > ur->mu_sq_size)
+			ur->mu_sq_size = ur->mu_cq_size;
+		ur->mu_cq_size = ur->mu_sq_size;
+	}
+	ur->mu_sq_ring = mmap(NULL, ur->mu_sq_size, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, ur->mu_fd, IORING_OFF_SQ_RING);
+	if (ur->mu_sq_ring == MAP_FAILED)
+		goto fail;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ur->mu_cq_ring = ur->mu_sq_ring;
+	} else {
+		ur->mu_cq_ring = mmap(NULL, ur->mu_cq_size, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_POPULATE, ur->mu_fd, IORING_OFF_CQ_RING);
+		if (ur->mu_cq_ring == MAP_FAILED) {
+			munmap(ur->mu_sq_ring, ur->mu_sq_size);
+			goto fail;
+		}
+	}
+	ur->mu_sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+		PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ur->mu_fd,
+		IORING_OFF_SQES);
+	if (ur->mu_sqes == MAP_FAILED) {
+		if (ur->mu_cq_ring != ur->mu_sq_ring)
+			munmap(ur->mu_cq_ring, ur->mu_cq_size);
+		munmap(ur->mu_sq_ring, ur->mu_sq_size);
+		goto fail;
+	}
+	sq = ur->mu_sq_ring;
+	cq = ur->mu_cq_ring;
+	ur->mu_sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	ur->mu_sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	ur->mu_sq_array = (unsigned *)(sq + p.sq_off.array);
+	ur->mu_cq_head = (unsigned *)(cq + p.cq_off.head);
+	ur->mu_cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	ur->mu_cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	ur->mu_cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	env->me_uring = ur;
+	env->me_uring_off = 0;
+	return ur;
+
+fail:
+	DPRINTF(("io_uring mmap: %s", strerror(errno)));
+	close(ur->mu_fd);
+	free(ur);
+	return NULL;
+}
+
+/** Queue an SQE, which is not submitted until #mdb_uring_wait().
+ *	@param[in] len the number of bytes it should report, checked by
+ *	#mdb_uring_wait()
+ */
+static struct io_uring_sqe *
+mdb_uring_push(MDB_uring *ur, size_t len)
+{
+	unsigned tail = *ur->mu_sq_tail, i = tail & *ur->mu_sq_mask;
+	struct io_uring_sqe *sqe = &ur->mu_sqes[i];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->user_data = len;
+	ur->mu_sq_array[i] = i;
+	__atomic_store_n(ur->mu_sq_tail, tail + 1, __ATOMIC_RELEASE);
+	return sqe;
+}
+
+/** Submit \b count queued SQEs and wait until all are complete.
+ *	On failure the ring is closed, and later flushes use pwritev().
+ */
+static int
+mdb_uring_wait(MDB_env *env, unsigned count)
+{
+	MDB_uring *ur = env->me_uring;
+	unsigned submitted = 0, done = 0, head;
+	int rc = 0, ret;
+
+	while (done < count) {
+		ret = syscall(__NR_io_uring_enter, ur->mu_fd, count - submitted,
+			count - done, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret < 0) {
+			rc = ErrCode();
+			if (rc == EINTR) {
+				rc = 0;
+				continue;
+			}
+			DPRINTF(("io_uring_enter: %s", strerror(rc)));
+			break;
+		}
+		submitted += ret;
+		head = *ur->mu_cq_head;
+		while (head != __atomic_load_n(ur->mu_cq_tail, __ATOMIC_ACQUIRE)) {
+			struct io_uring_cqe *cqe = &ur->mu_cqes[head & *ur->mu_cq_mask];
+			if (cqe->res < 0) {
+				if (!rc)
+					rc = -cqe->res;
+				DPRINTF(("io_uring write error: %s", strerror(-cqe->res)));
+			} else if ((__u64)cqe->res != cqe->user_data && !rc) {
+				rc = EIO;
+				DPUTS("short write, filesystem full?");
+			}
+			head++;
+			done++;
+		}
+		__atomic_store_n(ur->mu_cq_head, head, __ATOMIC_RELEASE);
+	}
+	if (done < count) {
+		/* SQEs may be left behind in the ring; never reuse it */
+		mdb_uring_close(env);
+		env->me_uring_off = 1;
+	}
+	return rc;
+}
+#endif /* MDB_USE_IO_URING */
+
+#ifndef _WIN32
+	/** fewest pages a flush must write to be split among threads */
+#define MDB_PARALLEL_MIN_PAGES	4096
+	/** most threads of #mdb_env_set_flush_threads() */
+#define MDB_FLUSH_THREADS_MAX	64
+
+	/** A run of contiguous pages, written with one pwritev() */
+typedef struct MDB_flush_run {
+	struct iovec	*fr_iov;
+	int		fr_n;
+	MDB_OFF_T	fr_pos;
+	ssize_t		fr_size;
+} MDB_flush_run;
+
+	/** The runs of one flush, shared by its threads */
+typedef struct MDB_flush_job {
+	HANDLE		fj_fd;
+	MDB_flush_run	*fj_runs;
+	unsigned	fj_nruns;
+	unsigned	fj_next;	/**< next run to claim, atomically */
+	int		fj_rc;		/**< first error, which stops the others */
+} MDB_flush_job;
+
+static void *
+mdb_flush_worker(void *arg)
+{
+	MDB_flush_job *job = arg;
+	MDB_flush_run *run;
+	ssize_t wres;
+	unsigned i;
+	int rc, none = 0;
+
+	while ((i = __atomic_fetch_add(&job->fj_next, 1, __ATOMIC_RELAXED)) <
+		job->fj_nruns && !__atomic_load_n(&job->fj_rc, __ATOMIC_RELAXED)) {
+		run = &job->fj_runs[i];
+		do {
+			wres = pwritev(job->fj_fd, run->fr_iov, run->fr_n, run->fr_pos);
+		} while (wres < 0 && ErrCode() == EINTR);
+		if (wres != run->fr_size) {
+			if (wres < 0) {
+				rc = ErrCode();
+				DPRINTF(("Write error: %s", strerror(rc)));
+			} else {
+				rc = EIO;
+				DPUTS("short write, filesystem full?");
+			}
+			__atomic_compare_exchange_n(&job->fj_rc, &none, rc, 0,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED);
+			break;
+		}
+	}
+	return NULL;
+}
+
+/** Write \b nruns runs with up to #me_flush_threads threads, and wait
+ *	for all of them. The calling thread is one of the writers.
+ */
+static int
+mdb_flush_parallel(MDB_env *env, HANDLE fd, MDB_flush_run *runs, unsigned nruns)
+{
+	pthread_t threads[MDB_FLUSH_THREADS_MAX];
+	MDB_flush_job job;
+	unsigned i, started = 0, nthreads = env->me_flush_threads;
+
+	job.fj_fd = fd;
+	job.fj_runs = runs;
+	job.fj_nruns = nruns;
+	job.fj_next = 0;
+	job.fj_rc = 0;
+	if (nthreads > nruns)
+		nthreads = nruns;
+	/* if a thread can't be started, the rest just do more of the work */
+	for (i = 1; i < nthreads; i++)
+		if (!pthread_create(&threads[started], NULL, mdb_flush_worker, &job))
+			started++;
+	mdb_flush_worker(&job);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	return job.fj_rc;
+}
+#endif /* !_WIN32 */
+
 /** Flush (some) dirty pages to the map, after clearing their dirty flag.
  * @param[in] txn the transaction that's being committed
  * @param[in] keep number of initial pages in dirty_list to keep dirty.
@@ -3676,12 +3958,22 @@ mdb_page_flush(MDB_txn *txn, int keep)
 	int async_i = 0;
 	HANDLE fd = (env->me_flags & MDB_NOSYNC) ? env->me_fd : env->me_ovfd;
 #else
-	struct iovec iov[MDB_COMMIT_PAGES];
+	struct iovec iov_buf[MDB_COMMIT_PAGES], *iov = iov_buf;
 	HANDLE fd = env->me_fd;
 #endif
 	ssize_t		wsize = 0, wres;
 	MDB_OFF_T	wpos = 0, next_pos = 1; /* impossible pos, so pos != next_pos */
 	int			n = 0;
+#ifndef _WIN32
+	MDB_flush_run	*runs = NULL;	/**< collected for #mdb_flush_parallel() */
+	unsigned	nruns = 0;
+#endif
+#ifdef MDB_USE_IO_URING
+	MDB_uring	*ur = NULL;
+	unsigned	ur_queued = 0, ur_iovs = 0;
+
+	env->me_flush_synced = 0;
+#endif
 
 	j = i = keep;
 	if (env->me_flags & MDB_WRITEMAP
@@ -3705,6 +3997,20 @@ mdb_page_flush(MDB_txn *txn, int keep)
 		goto done;
 	}
 
+#ifndef _WIN32
+	if (env->me_flush_threads > 1 &&
+		pagecount - keep >= MDB_PARALLEL_MIN_PAGES) {
+		/* at most one run and one iovec per page */
+		runs = malloc((pagecount - keep) *
+			(sizeof(MDB_flush_run) + sizeof(struct iovec)));
+		if (runs)
+			iov = (struct iovec *)(runs + (pagecount - keep));
+	}
+#endif
+#ifdef MDB_USE_IO_URING
+	if (!runs && (ur = mdb_uring_get(env)) != NULL)
+		iov = ur->mu_iov;
+#endif
 #ifdef _WIN32
 	if (pagecount - keep >= env->ovs) {
 		/* ran out of room in ov array, and re-malloc, copy handles and free previous */
@@ -3787,6 +4093,36 @@ retry_write:
 				}
 				async_i++;
 #else
+				if (runs) {
+					runs[nruns].fr_iov = iov;
+					runs[nruns].fr_n = n;
+					runs[nruns].fr_pos = wpos;
+					runs[nruns].fr_size = wsize;
+					nruns++;
+					iov += n;
+					goto written;
+				}
+#ifdef MDB_USE_IO_URING
+				if (ur) {
+					struct io_uring_sqe *sqe = mdb_uring_push(ur, wsize);
+					sqe->opcode = IORING_OP_WRITEV;
+					sqe->fd = fd;
+					sqe->off = wpos;
+					sqe->addr = (__u64)(uintptr_t)iov;
+					sqe->len = n;
+					ur_iovs += n;
+					/* keep an SQE spare for the sync */
+					if (++ur_queued == ur->mu_entries - 1 ||
+						ur_iovs + MDB_COMMIT_PAGES > MDB_URING_IOVS) {
+						rc = mdb_uring_wait(env, ur_queued);
+						if (rc)
+							return rc;
+						ur_queued = ur_iovs = 0;
+					}
+					iov = ur->mu_iov + ur_iovs;
+					goto written;
+				}
+#endif
 #ifdef MDB_USE_PWRITEV
 				wres = pwritev(fd, iov, n, wpos);
 #else
@@ -3816,6 +4152,7 @@ retry_seek:
 					}
 					return rc;
 				}
+written:
 #endif /* _WIN32 */
 				n = 0;
 			}
@@ -3836,6 +4173,34 @@ retry_seek:
 		wsize += size;
 		n++;
 	}
+#ifndef _WIN32
+	if (runs) {
+		rc = mdb_flush_parallel(env, fd, runs, nruns);
+		free(runs);
+		if (rc)
+			return rc;
+	}
+#endif
+#ifdef MDB_USE_IO_URING
+	if (ur) {
+		/* The commit's fdatasync, drained behind the writes, saves
+		 * #mdb_txn_commit() a syscall of its own.
+		 */
+		int sync = !keep && !(txn->mt_flags & MDB_TXN_NOSYNC) &&
+			!(env->me_flags & (MDB_NOSYNC|MDB_FSYNCONLY));
+		if (sync) {
+			struct io_uring_sqe *sqe = mdb_uring_push(ur, 0);
+			sqe->opcode = IORING_OP_FSYNC;
+			sqe->fd = fd;
+			sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+			sqe->flags = IOSQE_IO_DRAIN;
+			ur_queued++;
+		}
+		if (ur_queued && (rc = mdb_uring_wait(env, ur_queued)))
+			return rc;
+		env->me_flush_synced = sync;
+	}
+#endif
 #ifdef MDB_VL32
 	if (pgno > txn->mt_last_pgno)
 		txn->mt_last_pgno = pgno;
@@ -4107,6 +4472,9 @@ mdb_txn_commit(MDB_txn *txn)
 	if ((rc = mdb_page_flush(txn, 0)))
 		goto fail;
 	if (!F_ISSET(txn->mt_flags, MDB_TXN_NOSYNC) &&
+#ifdef MDB_USE_IO_URING
+		!env->me_flush_synced &&
+#endif
 		(rc = mdb_env_sync0(env, 0, txn->mt_next_pgno)))
 		goto fail;
 	if ((rc = mdb_env_write_meta(txn)))
@@ -5749,6 +6117,10 @@ mdb_env_close0(MDB_env *env, int excl)
 	}
 	if (env->me_ovfd != INVALID_HANDLE_VALUE)
 		(void) close(env->me_ovfd);
+#endif
+#ifdef MDB_USE_IO_URING
+	mdb_uring_close(env);
+	env->me_uring_off = 0;
 #endif
 	if (env->me_fd != INVALID_HANDLE_VALUE)
 		(void) close(env->me_fd);
@@ -5903,6 +6275,226 @@ mdb_cmp_cint(const MDB_val *a, const MDB_val *b)
 #endif
 }
 
+	/** Compare the \b len bytes ending at \b p1 and \b p2, last byte first */
+static int
+mdb_memrcmp_bytes(const unsigned char *p1, const unsigned char *p2, unsigned int len)
+{
+	for (; len; len--) {
+		int diff = *--p1 - *--p2;
+		if (diff)
+			return diff;
+	}
+	return 0;
+}
+
+#ifdef __GNUC__
+	/** Load 8 bytes of unknown alignment, so that comparing the results
+	 *	compares the bytes in memory order.
+	 */
+static uint64_t
+mdb_load_fwd8(const unsigned char *p)
+{
+	uint64_t x;
+	memcpy(&x, p, sizeof(x));
+#if BYTE_ORDER == LITTLE_ENDIAN
+	x = __builtin_bswap64(x);
+#endif
+	return x;
+}
+
+	/** Load 8 bytes of unknown alignment, so that comparing the results
+	 *	compares the bytes in reverse memory order.
+	 */
+static uint64_t
+mdb_load_rev8(const unsigned char *p)
+{
+	uint64_t x;
+	memcpy(&x, p, sizeof(x));
+#if BYTE_ORDER == BIG_ENDIAN
+	x = __builtin_bswap64(x);
+#endif
+	return x;
+}
+
+	/** 4-byte versions of #mdb_load_fwd8() and #mdb_load_rev8() */
+static uint32_t
+mdb_load_fwd4(const unsigned char *p)
+{
+	uint32_t x;
+	memcpy(&x, p, sizeof(x));
+#if BYTE_ORDER == LITTLE_ENDIAN
+	x = __builtin_bswap32(x);
+#endif
+	return x;
+}
+
+static uint32_t
+mdb_load_rev4(const unsigned char *p)
+{
+	uint32_t x;
+	memcpy(&x, p, sizeof(x));
+#if BYTE_ORDER == BIG_ENDIAN
+	x = __builtin_bswap32(x);
+#endif
+	return x;
+}
+
+	/** Compare words loaded by the mdb_load_* functions */
+#define MDB_WCMP(x, y)	((x) < (y) ? -1 : (x) > (y))
+
+	/** Compare the first \b len <= 16 bytes of \b p1 and \b p2.
+	 *	Overlapping word loads replace the call to memcmp(), whose
+	 *	overhead dominates for short keys.
+	 */
+static int
+mdb_memcmp16(const unsigned char *p1, const unsigned char *p2, unsigned int len)
+{
+	if (len >= 8) {
+		uint64_t x = mdb_load_fwd8(p1), y = mdb_load_fwd8(p2);
+		if (x != y)
+			return MDB_WCMP(x, y);
+		x = mdb_load_fwd8(p1 + len - 8);
+		y = mdb_load_fwd8(p2 + len - 8);
+		return MDB_WCMP(x, y);
+	}
+	if (len >= 4) {
+		uint32_t x = mdb_load_fwd4(p1), y = mdb_load_fwd4(p2);
+		if (x != y)
+			return MDB_WCMP(x, y);
+		x = mdb_load_fwd4(p1 + len - 4);
+		y = mdb_load_fwd4(p2 + len - 4);
+		return MDB_WCMP(x, y);
+	}
+	for (; len; len--) {
+		int diff = *p1++ - *p2++;
+		if (diff)
+			return diff;
+	}
+	return 0;
+}
+
+	/** Compare the \b len <= 16 bytes ending at \b p1 and \b p2,
+	 *	last byte first.
+	 */
+static int
+mdb_memrcmp16(const unsigned char *p1, const unsigned char *p2, unsigned int len)
+{
+	if (len >= 8) {
+		uint64_t x = mdb_load_rev8(p1 - 8), y = mdb_load_rev8(p2 - 8);
+		if (x != y)
+			return MDB_WCMP(x, y);
+		x = mdb_load_rev8(p1 - len);
+		y = mdb_load_rev8(p2 - len);
+		return MDB_WCMP(x, y);
+	}
+	if (len >= 4) {
+		uint32_t x = mdb_load_rev4(p1 - 4), y = mdb_load_rev4(p2 - 4);
+		if (x != y)
+			return MDB_WCMP(x, y);
+		x = mdb_load_rev4(p1 - len);
+		y = mdb_load_rev4(p2 - len);
+		return MDB_WCMP(x, y);
+	}
+	return mdb_memrcmp_bytes(p1, p2, len);
+}
+#else
+#define mdb_memcmp16(p1, p2, len)	memcmp(p1, p2, len)
+#define mdb_memrcmp16	mdb_memrcmp_bytes
+#endif
+
+#ifdef MDB_SIMD
+	/** Compare \b len > 16 bytes of \b p1 and \b p2 in 16-byte blocks.
+	 *	The last block overlaps the one before it.
+	 */
+static int
+mdb_memcmp_sse2(const unsigned char *p1, const unsigned char *p2, unsigned int len)
+{
+	unsigned int off = 0, mask;
+
+	for (;;) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(p1 + off));
+		__m128i y = _mm_loadu_si128((const __m128i *)(p2 + off));
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xffff;
+		if (mask) {
+			off += __builtin_ctz(mask);
+			return p1[off] - p2[off];
+		}
+		if (off + 16 == len)
+			return 0;
+		off = (off + 32 <= len) ? off + 16 : len - 16;
+	}
+}
+
+	/** Compare the \b len > 16 bytes ending at \b p1 and \b p2, last
+	 *	byte first, in 16-byte blocks.
+	 */
+static int
+mdb_memrcmp_sse2(const unsigned char *p1, const unsigned char *p2, unsigned int len)
+{
+	unsigned int off = 16, mask;
+
+	for (;;) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(p1 - off));
+		__m128i y = _mm_loadu_si128((const __m128i *)(p2 - off));
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xffff;
+		if (mask) {
+			off -= 31 - __builtin_clz(mask);
+			return *(p1 - off) - *(p2 - off);
+		}
+		if (off == len)
+			return 0;
+		off = (off + 16 <= len) ? off + 16 : len;
+	}
+}
+
+	/** 32-byte block version of #mdb_memcmp_sse2(), for \b len >= 32 */
+__attribute__((target("avx2")))
+static int
+mdb_memcmp_avx2(const unsigned char *p1, const unsigned char *p2, unsigned int len)
+{
+	unsigned int off = 0, mask;
+
+	for (;;) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(p1 + off));
+		__m256i y = _mm256_loadu_si256((const __m256i *)(p2 + off));
+		mask = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+		if (mask) {
+			off += __builtin_ctz(mask);
+			return p1[off] - p2[off];
+		}
+		if (off + 32 == len)
+			return 0;
+		off = (off + 64 <= len) ? off + 32 : len - 32;
+	}
+}
+
+	/** 32-byte block version of #mdb_memrcmp_sse2(), for \b len >= 32 */
+__attribute__((target("avx2")))
+static int
+mdb_memrcmp_avx2(const unsigned char *p1, const unsigned char *p2, unsigned int len)
+{
+	unsigned int off = 32, mask;
+
+	for (;;) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(p1 - off));
+		__m256i y = _mm256_loadu_si256((const __m256i *)(p2 - off));
+		mask = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+		if (mask) {
+			off -= 31 - __builtin_clz(mask);
+			return *(p1 - off) - *(p2 - off);
+		}
+		if (off == len)
+			return 0;
+		off = (off + 32 <= len) ? off + 32 : len;
+	}
+}
+
+	/** True if AVX2 may be used. Reads the CPU model that libgcc
+	 *	detected at startup.
+	 */
+#define MDB_HAVE_AVX2()	__builtin_cpu_supports("avx2")
+#endif /* MDB_SIMD */
+
 /** Compare two items lexically */
 static int
 mdb_cmp_memn(const MDB_val *a, const MDB_val *b)
@@ -5918,7 +6510,17 @@ mdb_cmp_memn(const MDB_val *a, const MDB_val *b)
 		len_diff = 1;
 	}
 
-	diff = memcmp(a->mv_data, b->mv_data, len);
+	if (len <= 16)
+		diff = mdb_memcmp16(a->mv_data, b->mv_data, len);
+#ifdef MDB_SIMD
+	else if (len >= 32 && MDB_HAVE_AVX2())
+		diff = mdb_memcmp_avx2(a->mv_data, b->mv_data, len);
+	else
+		diff = mdb_memcmp_sse2(a->mv_data, b->mv_data, len);
+#else
+	else
+		diff = memcmp(a->mv_data, b->mv_data, len);
+#endif
 	return diff ? diff : len_diff<0 ? -1 : len_diff;
 }
 
@@ -5926,27 +6528,211 @@ mdb_cmp_memn(const MDB_val *a, const MDB_val *b)
 static int
 mdb_cmp_memnr(const MDB_val *a, const MDB_val *b)
 {
-	const unsigned char	*p1, *p2, *p1_lim;
+	const unsigned char	*p1, *p2;
 	ssize_t len_diff;
+	unsigned int len;
 	int diff;
 
-	p1_lim = (const unsigned char *)a->mv_data;
 	p1 = (const unsigned char *)a->mv_data + a->mv_size;
 	p2 = (const unsigned char *)b->mv_data + b->mv_size;
 
+	len = a->mv_size;
 	len_diff = (ssize_t) a->mv_size - (ssize_t) b->mv_size;
 	if (len_diff > 0) {
-		p1_lim += len_diff;
+		len = b->mv_size;
 		len_diff = 1;
 	}
 
-	while (p1 > p1_lim) {
-		diff = *--p1 - *--p2;
-		if (diff)
-			return diff;
+	if (len <= 16)
+		diff = mdb_memrcmp16(p1, p2, len);
+#ifdef MDB_SIMD
+	else if (len >= 32 && MDB_HAVE_AVX2())
+		diff = mdb_memrcmp_avx2(p1, p2, len);
+	else
+		diff = mdb_memrcmp_sse2(p1, p2, len);
+#else
+	else
+		diff = mdb_memrcmp_bytes(p1, p2, len);
+#endif
+	return diff ? diff : len_diff<0 ? -1 : len_diff;
+}
+
+	/** Hint that \b addr will soon be read */
+#ifdef __GNUC__
+# define MDB_PREFETCH(addr)	__builtin_prefetch(addr)
+#else
+# define MDB_PREFETCH(addr)	((void)0)
+#endif
+
+#if !MDB_DEBUG
+/** Compare two items pointing at unsigned ints of unknown alignment,
+ *	as #mdb_cmp_cint() does for keys of that size.
+ */
+static int
+mdb_cmp_uint(const MDB_val *a, const MDB_val *b)
+{
+	unsigned int x, y;
+
+	memcpy(&x, a->mv_data, sizeof(x));
+	memcpy(&y, b->mv_data, sizeof(y));
+	return (x < y) ? -1 : x > y;
+}
+
+/** Compare two items pointing at #mdb_size_t's of unknown alignment,
+ *	as #mdb_cmp_cint() does for keys of that size.
+ */
+static int
+mdb_cmp_ulong(const MDB_val *a, const MDB_val *b)
+{
+	mdb_size_t x, y;
+
+	memcpy(&x, a->mv_data, sizeof(x));
+	memcpy(&y, b->mv_data, sizeof(y));
+	return (x < y) ? -1 : x > y;
+}
+
+/** Binary search loop of #mdb_node_search(), for one comparator.
+ *	Expanded with each built-in comparator named directly, so the
+ *	compiler can inline it instead of calling through \b md_cmp on
+ *	every probe.
+ *
+ *	Before comparing key \b i, the keys of both possible next probes
+ *	are prefetched, so the cache miss of the next step overlaps this
+ *	one instead of following it. On a cold page, each probe otherwise
+ *	waits for \b mp_ptrs[i] and then for the node it points to.
+ *	Both indices stay within the page, even when the search ends.
+ *	@param[in] getkey expression setting \b nodekey to key \b i.
+ *	@param[in] cmp the comparator.
+ *	@param[in] keyptr macro giving the address of key \b j.
+ */
+#define MDB_BISECT(getkey, cmp, keyptr)	\
+	while (low <= high) {	\
+		i = (low + high) >> 1;	\
+		MDB_PREFETCH(keyptr((low + (int)i - 1) >> 1));	\
+		MDB_PREFETCH(keyptr(((int)i + 1 + high) >> 1));	\
+		getkey;	\
+		rc = cmp(key, &nodekey);	\
+		if (rc == 0)	\
+			break;	\
+		if (rc > 0)	\
+			low = i + 1;	\
+		else	\
+			high = i - 1;	\
+	}
+
+	/** Point \b nodekey at the key of node \b i */
+#define MDB_NODE_KEY	(node = NODEPTR(mp, i), \
+	nodekey.mv_size = NODEKSZ(node), nodekey.mv_data = NODEKEY(node))
+	/** Point \b nodekey at key \b i of a #P_LEAF2 page */
+#define MDB_LEAF2_KEY	(nodekey.mv_data = LEAF2KEY(mp, i, nodekey.mv_size))
+	/** Address of node \b j, for #MDB_BISECT() */
+#define MDB_NODE_PTR(j)	NODEPTR(mp, j)
+	/** Address of key \b j of a #P_LEAF2 page, for #MDB_BISECT() */
+#define MDB_LEAF2_PTR(j)	LEAF2KEY(mp, j, nodekey.mv_size)
+
+	/** fewest keys a page search must span to interpolate */
+#define MDB_ISEARCH_MIN	8
+
+/** Read integer key \b j of a page, of size \b ks */
+static mdb_size_t
+mdb_page_ikey(MDB_page *mp, int j, unsigned int ks)
+{
+	const void *p;
+
+	p = IS_LEAF2(mp) ? LEAF2KEY(mp, j, ks) : NODEKEY(NODEPTR(mp, j));
+	if (ks == sizeof(unsigned int)) {
+		unsigned int x;
+		memcpy(&x, p, sizeof(x));
+		return x;
+	} else {
+		mdb_size_t x;
+		memcpy(&x, p, sizeof(x));
+		return x;
+	}
+}
+
+/** Find the smallest of the integer keys \b low..high of a page which is
+ *	larger or equal to \b k, by interpolation: the slot is guessed from
+ *	the first and last keys, assuming they are evenly spread, then
+ *	bracketed by steps of 1, 2, 4... from the guess and bisected.
+ *	Sequential IDs with gaps take a few probes instead of log2(keys).
+ *	@param[in] mp the page.
+ *	@param[in] low, high the index range to search, at least
+ *	#MDB_ISEARCH_MIN apart.
+ *	@param[in] ks the key size.
+ *	@param[in] k the key.
+ *	@param[out] exactp set to whether the key found equals \b k.
+ *	@return the index found, or high+1 if every key is smaller.
+ */
+static int
+mdb_page_isearch(MDB_page *mp, int low, int high, unsigned int ks,
+	mdb_size_t k, int *exactp)
+{
+	mdb_size_t lk, hk, v, bk;
+	int a, b, g, step;
+
+	*exactp = 0;
+	lk = mdb_page_ikey(mp, low, ks);
+	if (k <= lk) {
+		*exactp = (k == lk);
+		return low;
+	}
+	hk = mdb_page_ikey(mp, high, ks);
+	if (k >= hk) {
+		*exactp = (k == hk);
+		return k == hk ? high : high + 1;
+	}
+
+	/* lk < k < hk, so the answer is in low+1..high */
+	g = low + (int)((double)(k - lk) / (double)(hk - lk) * (high - low));
+	if (g <= low)
+		g = low + 1;
+	else if (g >= high)
+		g = high - 1;
+	v = mdb_page_ikey(mp, g, ks);
+	if (v < k) {
+		a = g;
+		for (step = 1;; step <<= 1) {
+			b = a + step;
+			if (b >= high) {
+				b = high;
+				bk = hk;
+				break;
+			}
+			if ((bk = mdb_page_ikey(mp, b, ks)) >= k)
+				break;
+			a = b;
+		}
+	} else {
+		b = g;
+		bk = v;
+		for (step = 1;; step <<= 1) {
+			a = b - step;
+			if (a <= low) {
+				a = low;
+				break;
+			}
+			if ((v = mdb_page_ikey(mp, a, ks)) < k)
+				break;
+			b = a;
+			bk = v;
+		}
+	}
+
+	/* key a < k <= key b */
+	while (b - a > 1) {
+		g = (a + b) >> 1;
+		if ((v = mdb_page_ikey(mp, g, ks)) < k) {
+			a = g;
+		} else {
+			b = g;
+			bk = v;
+		}
 	}
-	return len_diff<0 ? -1 : len_diff;
+	*exactp = (bk == k);
+	return b;
 }
+#endif
 
 /** Search for key within a page, using binary search.
  * Returns the smallest entry larger or equal to the key.
@@ -5987,9 +6773,53 @@ mdb_node_search(MDB_cursor *mc, MDB_val *key, int *exactp)
 			cmp = mdb_cmp_int;
 	}
 
+#if !MDB_DEBUG
+	/* Integer keys: interpolate instead of bisecting */
+	if (high - low >= MDB_ISEARCH_MIN &&
+		(cmp == mdb_cmp_int || cmp == mdb_cmp_long || cmp == mdb_cmp_cint) &&
+		(key->mv_size == sizeof(unsigned int) ||
+		 key->mv_size == sizeof(mdb_size_t)) &&
+		(!IS_LEAF2(mp) || key->mv_size == mc->mc_db->md_pad)) {
+		unsigned int ks = key->mv_size;
+		mdb_size_t k;
+		int exact;
+		if (ks == sizeof(unsigned int)) {
+			unsigned int x;
+			memcpy(&x, key->mv_data, sizeof(x));
+			k = x;
+		} else {
+			memcpy(&k, key->mv_data, sizeof(k));
+		}
+		i = mdb_page_isearch(mp, low, high, ks, k, &exact);
+		if ((int)i > high) {
+			/* every key is smaller; made one past the end below */
+			i = high;
+			rc = 1;
+		} else {
+			rc = exact ? 0 : -1;
+		}
+		node = NODEPTR(mp, IS_LEAF2(mp) ? 0 : i);
+		goto searched;
+	}
+#endif
+
 	if (IS_LEAF2(mp)) {
 		nodekey.mv_size = mc->mc_db->md_pad;
 		node = NODEPTR(mp, 0);	/* fake */
+#if !MDB_DEBUG
+		/* LEAF2 keys are aligned to their size */
+		if (cmp == mdb_cmp_cint && nodekey.mv_size == sizeof(mdb_size_t))
+			cmp = mdb_cmp_long;
+		else if (cmp == mdb_cmp_cint && nodekey.mv_size == sizeof(int))
+			cmp = mdb_cmp_int;
+		if (cmp == mdb_cmp_memn)
+			MDB_BISECT(MDB_LEAF2_KEY, mdb_cmp_memn, MDB_LEAF2_PTR)
+		else if (cmp == mdb_cmp_int)
+			MDB_BISECT(MDB_LEAF2_KEY, mdb_cmp_int, MDB_LEAF2_PTR)
+		else if (cmp == mdb_cmp_long)
+			MDB_BISECT(MDB_LEAF2_KEY, mdb_cmp_long, MDB_LEAF2_PTR)
+		else
+#endif
 		while (low <= high) {
 			i = (low + high) >> 1;
 			nodekey.mv_data = LEAF2KEY(mp, i, nodekey.mv_size);
@@ -6004,6 +6834,21 @@ mdb_node_search(MDB_cursor *mc, MDB_val *key, int *exactp)
 				high = i - 1;
 		}
 	} else {
+#if !MDB_DEBUG
+		if (cmp == mdb_cmp_memn)
+			MDB_BISECT(MDB_NODE_KEY, mdb_cmp_memn, MDB_NODE_PTR)
+		else if (cmp == mdb_cmp_int)
+			MDB_BISECT(MDB_NODE_KEY, mdb_cmp_int, MDB_NODE_PTR)
+		else if (cmp == mdb_cmp_long)
+			MDB_BISECT(MDB_NODE_KEY, mdb_cmp_long, MDB_NODE_PTR)
+		else if (cmp == mdb_cmp_cint && key->mv_size == sizeof(mdb_size_t))
+			MDB_BISECT(MDB_NODE_KEY, mdb_cmp_ulong, MDB_NODE_PTR)
+		else if (cmp == mdb_cmp_cint && key->mv_size == sizeof(int))
+			MDB_BISECT(MDB_NODE_KEY, mdb_cmp_uint, MDB_NODE_PTR)
+		else if (cmp == mdb_cmp_memnr)
+			MDB_BISECT(MDB_NODE_KEY, mdb_cmp_memnr, MDB_NODE_PTR)
+		else
+#endif
 		while (low <= high) {
 			i = (low + high) >> 1;
 
@@ -6029,6 +6874,9 @@ mdb_node_search(MDB_cursor *mc, MDB_val *key, int *exactp)
 		}
 	}
 
+#if !MDB_DEBUG
+searched:
+#endif
 	if (rc > 0) {	/* Found entry is less than the key. */
 		i++;	/* Skip to get the smallest entry larger than key. */
 		if (!IS_LEAF2(mp))
@@ -6806,6 +7654,102 @@ mdb_get(MDB_txn *txn, MDB_dbi dbi,
 	return rc;
 }
 
+	/** keys whose descents #mdb_get_multi() interleaves */
+#define MDB_GET_MULTI_GROUP	8
+
+/** Descend one level of the tree for a cursor set up by
+ *	#mdb_page_search(#MDB_PS_ROOTONLY), as #mdb_page_search_root() does,
+ *	and prefetch the child page so its miss overlaps the other cursors'.
+ */
+static int
+mdb_page_search_step(MDB_cursor *mc, MDB_val *key)
+{
+	MDB_page	*mp = mc->mc_pg[mc->mc_top];
+	MDB_node	*node;
+	indx_t		i;
+	int		 exact, rc;
+
+	node = mdb_node_search(mc, key, &exact);
+	if (node == NULL)
+		i = NUMKEYS(mp) - 1;
+	else {
+		i = mc->mc_ki[mc->mc_top];
+		if (!exact) {
+			mdb_cassert(mc, i > 0);
+			i--;
+		}
+	}
+	mdb_cassert(mc, i < NUMKEYS(mp));
+	node = NODEPTR(mp, i);
+	if ((rc = mdb_page_get(mc, NODEPGNO(node), &mp, NULL)) != 0)
+		return rc;
+	mc->mc_ki[mc->mc_top] = i;
+	if ((rc = mdb_cursor_push(mc, mp)))
+		return rc;
+	/* the header, and the mp_ptrs the search starts with */
+	MDB_PREFETCH(mp);
+	MDB_PREFETCH((char *)mp + 64);
+	return MDB_SUCCESS;
+}
+
+int
+mdb_get_multi(MDB_txn *txn, MDB_dbi dbi, unsigned int count,
+    MDB_val *keys, MDB_val *data, int *rcs)
+{
+	MDB_cursor	mc[MDB_GET_MULTI_GROUP];
+	MDB_xcursor	mx[MDB_GET_MULTI_GROUP];
+	unsigned int	 g, j, n, more;
+	int exact;
+
+	if (!keys || !data || !rcs || !TXN_DBI_EXIST(txn, dbi, DB_USRVALID))
+		return EINVAL;
+
+	if (txn->mt_flags & MDB_TXN_BLOCKED)
+		return MDB_BAD_TXN;
+
+	for (g = 0; g < count; g += n) {
+		n = count - g;
+		if (n > MDB_GET_MULTI_GROUP)
+			n = MDB_GET_MULTI_GROUP;
+		for (j = 0; j < n; j++) {
+			mdb_cursor_init(&mc[j], txn, dbi, &mx[j]);
+			if (keys[g+j].mv_size == 0)
+				rcs[g+j] = MDB_BAD_VALSIZE;
+			else
+				rcs[g+j] = mdb_page_search(&mc[j], &keys[g+j], MDB_PS_ROOTONLY);
+		}
+		/* Step every cursor down one level per pass, so each page
+		 * miss is in flight while the other keys are searched.
+		 */
+		do {
+			more = 0;
+			for (j = 0; j < n; j++) {
+				if (rcs[g+j] || !IS_BRANCH(mc[j].mc_pg[mc[j].mc_top]))
+					continue;
+				rcs[g+j] = mdb_page_search_step(&mc[j], &keys[g+j]);
+				more = 1;
+			}
+		} while (more);
+		for (j = 0; j < n; j++) {
+			if (!rcs[g+j]) {
+				if (!IS_LEAF(mc[j].mc_pg[mc[j].mc_top])) {
+					txn->mt_flags |= MDB_TXN_ERROR;
+					rcs[g+j] = MDB_CORRUPTED;
+				} else {
+					/* on the key's leaf page, as after mdb_page_search() */
+					mc[j].mc_flags |= C_INITIALIZED;
+					mc[j].mc_flags &= ~C_EOF;
+					exact = 0;
+					rcs[g+j] = mdb_cursor_set(&mc[j], &keys[g+j], &data[g+j],
+						MDB_SET, &exact);
+				}
+			}
+			MDB_CURSOR_UNREF(&mc[j], 1);
+		}
+	}
+	return MDB_SUCCESS;
+}
+
 /** Find a sibling for a page.
  * Replaces the page at the top of the cursor's stack with the
  * specified sibling, if one exists.
@@ -10690,6 +11634,37 @@ mdb_env_get_fd(MDB_env *env, mdb_filehandle_t *arg)
 	return MDB_SUCCESS;
 }
 
+int ESECT
+mdb_env_set_flush_threads(MDB_env *env, unsigned int threads)
+{
+	if (!env || !threads)
+		return EINVAL;
+#ifndef _WIN32
+	if (threads > MDB_FLUSH_THREADS_MAX)
+		return EINVAL;
+#endif
+	env->me_flush_threads = threads;
+	return MDB_SUCCESS;
+}
+
+int ESECT
+mdb_env_get_map(MDB_env *env, void **addr, mdb_size_t *size)
+{
+	if (!env || !addr || !size)
+		return EINVAL;
+#ifdef MDB_VL32
+	/* the map is a set of chunks, not one contiguous region */
+	return EINVAL;
+#else
+	if (!env->me_map)
+		return EINVAL;
+
+	*addr = env->me_map;
+	*size = env->me_mapsize;
+	return MDB_SUCCESS;
+#endif
+}
+
 /** Common code for #mdb_stat() and #mdb_env_stat().
  * @param[in] env the environment to operate in.
  * @param[in] db the #MDB_db record containing the stats to return.
@@ -8,8 +8,10 @@ import {
   NotFoundError,
   notImplemented,
 } from "./dberror.ts";
-import { DbData } from "./dbdata.ts";
+import { DbData, scratchKey, scratchValue } from "./dbdata.ts";
 import {
+  fast,
+  fastError,
   lmdb,
   CursorOp,
   MDB_NOTFOUND,
@@ -18,10 +20,23 @@ import {
   MDB_NOOVERWRITE,
   MDB_KEYEXIST,
   MDB_INTEGERKEY,
+  ENOMEM,
+  RANGE_REVERSE,
+  RANGE_EXCLUDE_START,
+  RANGE_EXCLUDE_END,
 } from "./lmdb_ffi.ts";
 import { Transaction } from "./transaction.ts";
 import { Environment } from "./environment.ts";
-import { decoder, encodeKey, encodeValue, Key, Value } from "./util.ts";
+import { ValueRef } from "./value_ref.ts";
+import { workerPool } from "./worker_pool.ts";
+import {
+  decoder,
+  encodeKey,
+  encodeValue,
+  Key,
+  littleEndian,
+  Value,
+} from "./util.ts";
 
 export interface CursorOptions<K extends Key = string> {
   start?: K;
@@ -30,6 +45,10 @@ export interface CursorOptions<K extends Key = string> {
   limit?: number;
   offset?: number;
   readOnly?: boolean;
+  /** do not return the start key itself */
+  excludeStart?: boolean;
+  /** do not return the end key itself */
+  excludeEnd?: boolean;
 }
 
 export class CursorItem {
@@ -68,6 +87,73 @@ export class CursorItem {
   }
 }
 
+/** zero-copy refs to the key and value at a cursor position */
+export interface CursorRef {
+  key: ValueRef;
+  value: ValueRef;
+}
+
+const SCAN_HEADER_LEN = 2;
+const SCAN_HEADER_SIZE = SCAN_HEADER_LEN * Uint32Array.BYTES_PER_ELEMENT;
+
+/** receives items from ffi_cursor_get_fast(); grown as needed */
+let fastItem = new Uint8Array(4096);
+const noKey = new Uint8Array(0);
+
+/**
+ * A reusable view of one item in a buffer filled by ffi_cursor_scan().
+ * Cursor.scan() yields the same instance for every item, so its contents
+ * are only valid until the next iteration.
+ */
+export class CursorBatchItem {
+  buffer: Uint8Array = new Uint8Array(0);
+  keyOffset = 0;
+  keySize = 0;
+  valueOffset = 0;
+  valueSize = 0;
+
+  keyView(): Uint8Array {
+    return this.buffer.subarray(this.keyOffset, this.keyOffset + this.keySize);
+  }
+  key(): ArrayBuffer {
+    return this.buffer.slice(this.keyOffset, this.keyOffset + this.keySize)
+      .buffer;
+  }
+  keyString(): string {
+    return decoder.decode(this.keyView());
+  }
+  keyNumber(): number {
+    return new DataView(this.buffer.buffer).getFloat64(
+      this.buffer.byteOffset + this.keyOffset,
+      littleEndian
+    );
+  }
+  valueView(): Uint8Array {
+    return this.buffer.subarray(
+      this.valueOffset,
+      this.valueOffset + this.valueSize
+    );
+  }
+  value(): ArrayBuffer {
+    return this.buffer.slice(
+      this.valueOffset,
+      this.valueOffset + this.valueSize
+    ).buffer;
+  }
+  valueString(): string {
+    return decoder.decode(this.valueView());
+  }
+  valueNumber(): number {
+    return new DataView(this.buffer.buffer).getFloat64(
+      this.buffer.byteOffset + this.valueOffset,
+      littleEndian
+    );
+  }
+  valueBoolean(): boolean {
+    return !!this.buffer[this.valueOffset];
+  }
+}
+
 export interface CursorPutFlags extends PutFlags {
   /**
    * replace the item at the current cursor position.
@@ -81,21 +167,26 @@ export interface CursorPutFlags extends PutFlags {
 
 const notOpen = () => new DbError("Cursor is already closed");
 
+/** receives new cursor and range handles from the FFI */
+const fhandle = new Uint32Array(1);
+
 /**
  * Allows traversal of keys and values in database.
  */
 export class Cursor<K extends Key = string> implements Iterable<CursorItem> {
-  fcursor = new BigUint64Array(1);
+  hcursor = 0;
   db: Database;
   txn: Transaction;
   ownsTxn: boolean;
   options: CursorOptions<K> | null;
   isOpen: boolean;
 
-  protected dbKey = new DbData();
-  protected dbValue = new DbData();
+  protected dbKey = scratchKey;
+  protected dbValue = scratchValue;
 
-  private id = ++curId;
+  /** native range cursor used by iterator() and scan() */
+  protected hrange = 0;
+  protected rangeOpen = false;
 
   constructor(
     db: Database,
@@ -111,26 +202,27 @@ export class Cursor<K extends Key = string> implements Iterable<CursorItem> {
       this.txn = new Transaction(db.env, options?.readOnly);
       this.ownsTxn = true;
     }
-    const rc = lmdb.ffi_cursor_open(this.txn.ftxn, db.dbi, this.fcursor);
+    const rc = lmdb.ffi_cursor_open(this.txn.htxn, db.dbi, fhandle);
     if (rc) throw DbError.from(rc);
+    this.hcursor = fhandle[0];
     this.isOpen = true;
-    records[this.id] = {
-      addr: this.fcursor[0],
-      isOpen: true,
-    };
-    registry.register(this, this.id);
   }
 
   close(): void {
     if (!this.isOpen) return;
-    lmdb.ffi_cursor_close(this.fcursor);
+    this.closeRange();
+    lmdb.ffi_cursor_close(this.hcursor);
     if (this.ownsTxn) this.txn.commit();
     this.isOpen = false;
-    records[this.id].isOpen = false;
   }
 
   renew(options: CursorOptions<K> | null, txn?: Transaction): void {
-    if (this.isOpen) this.close();
+    if (this.isOpen) {
+      // keep the native cursor, so that it can be renewed below
+      this.closeRange();
+      if (this.ownsTxn) this.txn.commit();
+      this.isOpen = false;
+    }
     if (options) this.options = options;
     if (txn) {
       this.txn = txn;
@@ -140,32 +232,124 @@ export class Cursor<K extends Key = string> implements Iterable<CursorItem> {
       this.ownsTxn = true;
     }
 
-    const rc = lmdb.ffi_cursor_renew(this.txn.ftxn, this.fcursor);
+    const rc = lmdb.ffi_cursor_renew(this.txn.htxn, this.hcursor);
     if (rc) {
       this.close();
       throw DbError.from(rc);
     }
     this.isOpen = true;
-    records[this.id].isOpen = true;
   }
 
-  protected encodeKey(key: K): void {
+  protected keyBuffer(key: K): ArrayBuffer {
     if (typeof key === "number" && !(this.db.flags & MDB_INTEGERKEY))
       throw new DbError("This database does not support integer keys");
-    this.dbKey.data = encodeKey(key);
+    return encodeKey(key);
+  }
+
+  protected encodeKey(key: K): void {
+    this.dbKey.data = this.keyBuffer(key);
+  }
+
+  /**
+   * Create a native range cursor from this.options, so that bounds, offset
+   * and limit are applied without returning to JS for every item.
+   */
+  protected openRange(): void {
+    this.closeRange();
+    const options = this.options;
+    let fstart: BigUint64Array | null = null;
+    let fend: BigUint64Array | null = null;
+    if (options?.start !== undefined) {
+      const start = new DbData();
+      start.data = this.keyBuffer(options.start);
+      fstart = start.fdata;
+    }
+    if (options?.end !== undefined) {
+      const end = new DbData();
+      end.data = this.keyBuffer(options.end);
+      fend = end.fdata;
+    }
+    const flags =
+      (options?.reverse ? RANGE_REVERSE : 0) |
+      (options?.excludeStart ? RANGE_EXCLUDE_START : 0) |
+      (options?.excludeEnd ? RANGE_EXCLUDE_END : 0);
+    const rc = lmdb.ffi_range_open(
+      this.hcursor,
+      fstart,
+      fend,
+      flags,
+      options?.offset || 0,
+      options?.limit || 0,
+      fhandle
+    );
+    if (rc) throw DbError.from(rc);
+    this.hrange = fhandle[0];
+    this.rangeOpen = true;
+  }
+
+  protected closeRange(): void {
+    if (!this.rangeOpen) return;
+    lmdb.ffi_range_close(this.hrange);
+    this.rangeOpen = false;
   }
 
   protected _get(op: CursorOp): number {
     if (!this.isOpen) throw notOpen();
     return lmdb.ffi_cursor_get(
-      this.fcursor,
+      this.hcursor,
       this.dbKey.fdata,
       this.dbValue.fdata,
       op
     );
   }
 
+  /**
+   * Like get(), using the fast-call symbols. The item is copied out of
+   * the database, so it remains valid after the transaction ends.
+   */
+  protected getFast(op: CursorOp, key?: K): CursorItem | null {
+    if (!this.isOpen) throw notOpen();
+    const keyU8 =
+      key === undefined ? noKey : new Uint8Array(this.keyBuffer(key));
+    let result = fast!.ffi_cursor_get_fast(
+      this.hcursor,
+      op,
+      keyU8,
+      keyU8.length,
+      fastItem,
+      fastItem.length
+    );
+    if (result > fastItem.length) {
+      fastItem = new Uint8Array(result);
+      result = fast!.ffi_cursor_get_fast(
+        this.hcursor,
+        CursorOp.GET_CURRENT,
+        noKey,
+        0,
+        fastItem,
+        fastItem.length
+      );
+    }
+    if (result < 0) {
+      const rc = fastError(result);
+      if (rc === MDB_NOTFOUND) return null;
+      throw DbError.from(rc);
+    }
+    const view = new DataView(fastItem.buffer);
+    const keySize = view.getUint32(0, littleEndian);
+    const valueSize = view.getUint32(
+      Uint32Array.BYTES_PER_ELEMENT,
+      littleEndian
+    );
+    const valueOffset = SCAN_HEADER_SIZE + keySize;
+    return new CursorItem(
+      fastItem.slice(SCAN_HEADER_SIZE, valueOffset).buffer,
+      fastItem.slice(valueOffset, valueOffset + valueSize).buffer
+    );
+  }
+
   protected get(op: CursorOp): CursorItem | null {
+    if (fast) return this.getFast(op);
     const rc = this._get(op);
     if (rc === MDB_NOTFOUND) {
       return null;
@@ -173,6 +357,49 @@ export class Cursor<K extends Key = string> implements Iterable<CursorItem> {
     else return new CursorItem(this.dbKey.data, this.dbValue.data);
   }
 
+  protected fref = new Float64Array(4);
+
+  /**
+   * Like get(), but returns zero-copy refs into the environment's memory
+   * map (see ValueRef), which are only valid until this.txn ends.
+   * @param op cursor operation
+   */
+  getRef(op: CursorOp): CursorRef | null {
+    if (!this.isOpen) throw notOpen();
+    const map = this.db.env.mapView();
+    const rc = lmdb.ffi_cursor_get_ref(
+      this.hcursor,
+      this.dbKey.fdata,
+      this.dbValue.fdata,
+      op,
+      this.db.env.fmap.fdata,
+      this.fref
+    );
+    if (rc === MDB_NOTFOUND) return null;
+    else if (rc) throw DbError.from(rc);
+    const [keyOffset, keyLength, valueOffset, valueLength] = this.fref;
+    return {
+      key:
+        keyOffset < 0
+          ? new ValueRef(
+              new Uint8Array(this.dbKey.data),
+              0,
+              keyLength,
+              this.txn
+            )
+          : new ValueRef(map, keyOffset, keyLength, this.txn),
+      value:
+        valueOffset < 0
+          ? new ValueRef(
+              new Uint8Array(this.dbValue.data),
+              0,
+              valueLength,
+              this.txn
+            )
+          : new ValueRef(map, valueOffset, valueLength, this.txn),
+    };
+  }
+
   first = () => this.get(CursorOp.FIRST);
   last = () => this.get(CursorOp.LAST);
   next = () => this.get(CursorOp.NEXT);
@@ -187,6 +414,7 @@ export class Cursor<K extends Key = string> implements Iterable<CursorItem> {
   }
 
   setKey(key: K): CursorItem | null {
+    if (fast) return this.getFast(CursorOp.SET_KEY, key);
     this.encodeKey(key);
     const rc = this._get(CursorOp.SET_KEY);
     if (rc === MDB_NOTFOUND) return null;
@@ -195,6 +423,7 @@ export class Cursor<K extends Key = string> implements Iterable<CursorItem> {
   }
 
   setRange(key: K): CursorItem | null {
+    if (fast) return this.getFast(CursorOp.SET_RANGE, key);
     this.encodeKey(key);
     const rc = this._get(CursorOp.SET_RANGE);
     if (rc === MDB_NOTFOUND) return null;
@@ -214,14 +443,17 @@ export class Cursor<K extends Key = string> implements Iterable<CursorItem> {
         (flags.append ? MDB_APPEND : 0);
     }
     const rc = lmdb.ffi_cursor_put(
-      this.fcursor,
+      this.hcursor,
       this.dbKey.fdata,
       this.dbValue.fdata,
       _flags
     );
     if (rc === MDB_KEYEXIST)
       throw new KeyExistsError(this.dbKey.data, this.dbValue.data);
-    else if (rc) throw DbError.from(rc);
+    else if (rc) {
+      this.txn.writeFailed(rc);
+      throw DbError.from(rc);
+    }
   }
 
   put(key: K, value: Value, flags?: CursorPutFlags): void {
@@ -242,76 +474,131 @@ export class Cursor<K extends Key = string> implements Iterable<CursorItem> {
 
   *iterator(): Generator<CursorItem, void, K | undefined> {
     if (!this.isOpen) throw notOpen();
-    const begin = this.options?.reverse
-      ? this.last.bind(this)
-      : this.first.bind(this);
-    const incr = this.options?.reverse
-      ? this.prev.bind(this)
-      : this.next.bind(this);
-    const comparison = this.options?.reverse ? -1 : 1;
-
-    let item: CursorItem | null | undefined;
-    if (this.options?.start) {
-      item = this.setKey(this.options.start);
-    } else {
-      item = begin();
+    this.openRange();
+    try {
+      while (true) {
+        const rc = lmdb.ffi_range_next(
+          this.hrange,
+          this.dbKey.fdata,
+          this.dbValue.fdata
+        );
+        if (rc === MDB_NOTFOUND) return;
+        else if (rc) throw DbError.from(rc);
+        const setK = yield new CursorItem(this.dbKey.data, this.dbValue.data);
+        if (setK) this.set(setK);
+      }
+    } finally {
+      this.close();
     }
-    let found = 0;
-    if (this.options?.offset) {
-      let offset = found;
-      while (offset < this.options.offset) {
-        item = incr();
-        if (item == null) {
-          this.close();
-          return;
+  }
+
+  /** Initial size of the buffer filled by ffi_cursor_scan() */
+  protected scanBufferSize = 65536;
+
+  /**
+   * Like iterator(), but reads up to batchSize items per FFI call, and
+   * yields the same CursorBatchItem for every item, whose contents are
+   * only valid until the next iteration.
+   * @param batchSize maximum number of items per FFI call
+   */
+  *scan(batchSize = 256): Generator<CursorBatchItem, void, undefined> {
+    if (!this.isOpen) throw notOpen();
+    this.openRange();
+    const item = new CursorBatchItem();
+    item.buffer = new Uint8Array(this.scanBufferSize);
+    let view = new DataView(item.buffer.buffer);
+    const fcount = new Uint32Array(1);
+    try {
+      while (true) {
+        const rc = lmdb.ffi_range_scan(
+          this.hrange,
+          batchSize,
+          item.buffer,
+          item.buffer.length,
+          fcount
+        );
+        if (rc && rc !== MDB_NOTFOUND && rc !== ENOMEM) throw DbError.from(rc);
+        if (rc === ENOMEM && !fcount[0]) {
+          // A single item is larger than the whole buffer.
+          this.scanBufferSize *= 2;
+          item.buffer = new Uint8Array(this.scanBufferSize);
+          view = new DataView(item.buffer.buffer);
+          continue;
         }
-        offset++;
+        yield* this.scanItems(item, view, fcount[0]);
+        if (rc === MDB_NOTFOUND) return;
       }
+    } finally {
+      this.close();
     }
-    const limit = this.options?.limit || Number.MAX_SAFE_INTEGER;
-    while (found < limit && item !== null) {
-      if (
-        this.options?.end &&
-        item &&
-        this.db.compare(item.keyUnsafe, encodeKey(this.options.end), this.txn) *
-          comparison >
-          0
-      ) {
-        this.close();
-        return;
-      }
-      if (item) {
-        found++;
-        const setK = yield item;
-        if (setK) this.set(setK);
+  }
+
+  /**
+   * Like scan(), but each batch is read on the native worker pool (see
+   * WorkerPool), so a cold page fault does not block the event loop.
+   * The cursor's transaction must not be used while a batch is pending.
+   * @param batchSize maximum number of items per batch
+   */
+  async *scanAsync(
+    batchSize = 256
+  ): AsyncGenerator<CursorBatchItem, void, undefined> {
+    if (!this.isOpen) throw notOpen();
+    this.openRange();
+    const item = new CursorBatchItem();
+    item.buffer = new Uint8Array(this.scanBufferSize);
+    let view = new DataView(item.buffer.buffer);
+    const fcount = new Uint32Array(1);
+    try {
+      while (true) {
+        const buffer = item.buffer;
+        const rc = await workerPool.submit((client, id) =>
+          lmdb.ffi_pool_scan(
+            client,
+            id,
+            this.hrange,
+            batchSize,
+            buffer,
+            buffer.length,
+            fcount
+          )
+        );
+        if (rc && rc !== MDB_NOTFOUND && rc !== ENOMEM) throw DbError.from(rc);
+        if (rc === ENOMEM && !fcount[0]) {
+          this.scanBufferSize *= 2;
+          item.buffer = new Uint8Array(this.scanBufferSize);
+          view = new DataView(item.buffer.buffer);
+          continue;
+        }
+        yield* this.scanItems(item, view, fcount[0]);
+        if (rc === MDB_NOTFOUND) return;
       }
-      item = incr();
+    } finally {
+      this.close();
     }
-    this.close();
   }
 
-  [Symbol.iterator] = this.iterator;
-}
+  /** Point item at each of the count records in its buffer, in turn */
+  protected *scanItems(
+    item: CursorBatchItem,
+    view: DataView,
+    count: number
+  ): Generator<CursorBatchItem, void, undefined> {
+    let pos = 0;
+    for (let i = 0; i < count; i++) {
+      item.keySize = view.getUint32(pos, littleEndian);
+      item.valueSize = view.getUint32(
+        pos + Uint32Array.BYTES_PER_ELEMENT,
+        littleEndian
+      );
+      item.keyOffset = pos + SCAN_HEADER_SIZE;
+      item.valueOffset = item.keyOffset + item.keySize;
+      pos = item.valueOffset + item.valueSize;
+      yield item;
+    }
+  }
 
-/////////////////////////////////
-// Finalization management begin
-let curId = 0;
-interface Finalizer {
-  addr: bigint;
-  isOpen: boolean;
+  [Symbol.iterator] = this.iterator;
 }
-const records: Record<number, Finalizer> = {};
-const registry = new FinalizationRegistry((id: number) => {
-  const record = records[id];
-  if (!record) return;
-  if (record.isOpen) {
-    const fcursor = new BigUint64Array([BigInt(record.addr)]);
-    lmdb.ffi_cursor_close(fcursor);
-  }
-  delete records[id];
-});
-// Finalization management end
-/////////////////////////////////
 
 async function main() {
   log.info("main(): start");
@@ -2,21 +2,35 @@ import { copy } from "https://deno.land/std@0.130.0/bytes/mod.ts";
 import * as log from "https://deno.land/std@0.130.0/log/mod.ts";
 
 import {
+  fast,
+  fastError,
   lmdb,
+  ENOMEM,
   MDB_APPEND,
   MDB_CREATE,
   MDB_INTEGERKEY,
   MDB_KEYEXIST,
+  MDB_NODUPDATA,
   MDB_NOOVERWRITE,
   MDB_NOTFOUND,
   MDB_REVERSEKEY,
 } from "./lmdb_ffi.ts";
 import { DbError, KeyExistsError, NotFoundError } from "./dberror.ts";
 import { Transaction } from "./transaction.ts";
-import { DbData } from "./dbdata.ts";
+import { DbData, scratchKey, scratchValue } from "./dbdata.ts";
 import { DbStat } from "./dbstat.ts";
 import { Environment } from "./environment.ts";
-import { Key, encodeKey, decoder, Value, encodeValue } from "./util.ts";
+import { ValueRef } from "./value_ref.ts";
+import { workerPool } from "./worker_pool.ts";
+import { WriteCondition } from "./write_queue.ts";
+import {
+  Key,
+  encodeKey,
+  decoder,
+  Value,
+  encodeValue,
+  littleEndian,
+} from "./util.ts";
 
 export interface DbFlags {
   create?: boolean;
@@ -32,6 +46,13 @@ export interface PutFlags {
 export const notOpen = () => new DbError("Database is already closed");
 const DROP_EMPTY = 0;
 const DROP_DELETE = 1;
+const GET_MANY_OFFSET = 0;
+const GET_MANY_LENGTH = 1;
+const GET_MANY_RC = 2;
+const GET_MANY_STRIDE = 3;
+
+/** receives values from ffi_get_fast(); grown as needed */
+let fastValue = new Uint8Array(4096);
 
 /**
  * A Key/Value store.
@@ -42,8 +63,8 @@ export class Database<K extends Key = string> {
   flags: number;
   dbi: number;
 
-  protected dbKey = new DbData();
-  protected dbValue = new DbData();
+  protected dbKey = scratchKey;
+  protected dbValue = scratchValue;
 
   constructor(
     name: string | null,
@@ -71,12 +92,12 @@ export class Database<K extends Key = string> {
     if (txnOrEnv instanceof Transaction) {
       txn = txnOrEnv;
       this.env = txn.env;
-      const rc = lmdb.ffi_dbi_open(txn.ftxn, fname, this.flags, fdbi);
+      const rc = lmdb.ffi_dbi_open(txn.htxn, fname, this.flags, fdbi);
       if (rc) throw DbError.from(rc);
     } else if (txnOrEnv instanceof Environment) {
       this.env = txnOrEnv;
       txn = new Transaction(txnOrEnv, false);
-      const rc = lmdb.ffi_dbi_open(txn.ftxn, fname, this.flags, fdbi);
+      const rc = lmdb.ffi_dbi_open(txn.htxn, fname, this.flags, fdbi);
       if (rc) {
         txn.abort();
         throw DbError.from(rc);
@@ -84,12 +105,19 @@ export class Database<K extends Key = string> {
     } else
       throw new TypeError("txnOrEnv must be either Transaction or Environment");
     this.dbi = fdbi[0];
+    // Pooled read txns which predate this dbi cannot use it.
+    this.env.clearReadTxns();
   }
 
-  protected encodeKey(key: K): void {
+  /** Encode key, checking that its type is supported by this database. */
+  keyBuffer(key: K): ArrayBuffer {
     if (typeof key === "number" && !(this.flags & MDB_INTEGERKEY))
       throw new DbError("This database does not support integer keys");
-    this.dbKey.data = encodeKey(key);
+    return encodeKey(key);
+  }
+
+  protected encodeKey(key: K): void {
+    this.dbKey.data = this.keyBuffer(key);
   }
 
   /**
@@ -104,7 +132,7 @@ export class Database<K extends Key = string> {
     this.encodeKey(key);
     const rc = this.useTransaction((useTxn) => {
       return lmdb.ffi_get(
-        useTxn.ftxn,
+        useTxn.htxn,
         this.dbi,
         this.dbKey.fdata,
         this.dbValue.fdata
@@ -115,9 +143,43 @@ export class Database<K extends Key = string> {
     return this.dbValue.data;
   }
 
+  /**
+   * Like getUnsafe(), but uses the fast-call symbols when available, in
+   * which case the result is a view of a shared buffer, which is only
+   * valid until the next call.
+   */
+  protected getView(key: K, txn?: Transaction): Uint8Array {
+    if (!fast) return new Uint8Array(this.getUnsafe(key, txn));
+    if (!this.dbi) throw notOpen();
+    const keyU8 = new Uint8Array(this.keyBuffer(key));
+    const result = this.useTransaction((useTxn) => {
+      const get = () =>
+        fast.ffi_get_fast(
+          useTxn.htxn,
+          this.dbi,
+          keyU8,
+          keyU8.length,
+          fastValue,
+          fastValue.length
+        );
+      let result = get();
+      if (result > fastValue.length) {
+        fastValue = new Uint8Array(result);
+        result = get();
+      }
+      return result;
+    }, txn);
+    if (result < 0) {
+      const rc = fastError(result);
+      if (rc === MDB_NOTFOUND) throw new NotFoundError(key);
+      throw DbError.from(rc);
+    }
+    return fastValue.subarray(0, result);
+  }
+
   get(key: K, txn?: Transaction): ArrayBuffer {
     try {
-      const valueU8 = new Uint8Array(this.getUnsafe(key, txn));
+      const valueU8 = this.getView(key, txn);
       const valueCopy = new Uint8Array(valueU8.length);
       copy(valueU8, valueCopy);
       return valueCopy;
@@ -132,31 +194,237 @@ export class Database<K extends Key = string> {
     }
   }
 
+  protected fref = new Float64Array(2);
+
+  /**
+   * Look up key without allocating a buffer or copying: the returned ref
+   * points into the environment's memory map (see ValueRef).
+   * @param key
+   * @param txn the ref is only valid until this transaction ends
+   * @returns a ValueRef, or null if key was not found
+   */
+  getRef(key: K, txn: Transaction): ValueRef | null {
+    if (!this.dbi) throw notOpen();
+    this.encodeKey(key);
+    const map = this.env.mapView();
+    const rc = lmdb.ffi_get_ref(
+      txn.htxn,
+      this.dbi,
+      this.dbKey.fdata,
+      this.dbValue.fdata,
+      this.env.fmap.fdata,
+      this.fref
+    );
+    if (rc === MDB_NOTFOUND) return null;
+    else if (rc) throw DbError.from(rc);
+    const [offset, length] = this.fref;
+    if (offset < 0) {
+      // Not in the map: a dirty page of a write transaction.
+      return new ValueRef(new Uint8Array(this.dbValue.data), 0, length, txn);
+    }
+    return new ValueRef(map, offset, length, txn);
+  }
+
   getString(key: K, txn?: Transaction): string {
-    return decoder.decode(this.getUnsafe(key, txn));
+    return decoder.decode(this.getView(key, txn));
   }
 
   getNumber(key: K, txn?: Transaction): number {
-    return new Float64Array(this.getUnsafe(key, txn))[0];
+    const view = this.getView(key, txn);
+    return new DataView(view.buffer, view.byteOffset).getFloat64(
+      0,
+      littleEndian
+    );
   }
 
   getBoolean(key: K, txn?: Transaction): boolean {
-    return !!new Uint8Array(this.getUnsafe(key, txn))[0];
+    return !!this.getView(key, txn)[0];
+  }
+
+  /** Initial size of the buffer which receives values from getMany() */
+  protected getManySize = 4096;
+
+  /** Pack keys into the [u32 size, key] records read by ffi_get_many */
+  protected packKeys(keys: K[]): Uint8Array {
+    const encoded = keys.map((key) => new Uint8Array(this.keyBuffer(key)));
+    let keysSize = 0;
+    for (const key of encoded)
+      keysSize += Uint32Array.BYTES_PER_ELEMENT + key.length;
+    const fkeys = new Uint8Array(keysSize);
+    const view = new DataView(fkeys.buffer);
+    let pos = 0;
+    for (const key of encoded) {
+      view.setUint32(pos, key.length, littleEndian);
+      pos += Uint32Array.BYTES_PER_ELEMENT;
+      fkeys.set(key, pos);
+      pos += key.length;
+    }
+    return fkeys;
+  }
+
+  /**
+   * After ffi_get_many fails with ENOMEM, every length was still reported,
+   * so the values buffer can be resized for a single retry.
+   */
+  protected growGetMany(fresults: Float64Array, count: number): Uint8Array {
+    let needed = 0;
+    for (let i = 0; i < count; i++) {
+      if (!fresults[i * GET_MANY_STRIDE + GET_MANY_RC]) {
+        needed += fresults[i * GET_MANY_STRIDE + GET_MANY_LENGTH];
+      }
+    }
+    this.getManySize = Math.max(this.getManySize, needed);
+    return new Uint8Array(needed);
+  }
+
+  protected unpackMany(
+    fresults: Float64Array,
+    values: Uint8Array,
+    count: number
+  ): (Uint8Array | null)[] {
+    const results: (Uint8Array | null)[] = [];
+    for (let i = 0; i < count; i++) {
+      const itemRc = fresults[i * GET_MANY_STRIDE + GET_MANY_RC];
+      if (itemRc === MDB_NOTFOUND) {
+        results.push(null);
+        continue;
+      } else if (itemRc) throw DbError.from(itemRc);
+      const offset = fresults[i * GET_MANY_STRIDE + GET_MANY_OFFSET];
+      const length = fresults[i * GET_MANY_STRIDE + GET_MANY_LENGTH];
+      results.push(values.subarray(offset, offset + length));
+    }
+    return results;
+  }
+
+  /**
+   * Look up many keys with a single FFI call, under a single transaction.
+   * @param keys
+   * @param txn
+   * @returns one entry per key, in the same order: a copy of the value,
+   *          or null if the key was not found.
+   */
+  getMany(keys: K[], txn?: Transaction): (Uint8Array | null)[] {
+    if (!this.dbi) throw notOpen();
+    const fkeys = this.packKeys(keys);
+    const fresults = new Float64Array(keys.length * GET_MANY_STRIDE);
+    let values = new Uint8Array(this.getManySize);
+    const rc = this.useTransaction((useTxn) => {
+      const getMany = () =>
+        lmdb.ffi_get_many(
+          useTxn.htxn,
+          this.dbi,
+          fkeys,
+          keys.length,
+          fresults,
+          values,
+          values.length
+        );
+      let rc = getMany();
+      if (rc === ENOMEM) {
+        values = this.growGetMany(fresults, keys.length);
+        rc = getMany();
+      }
+      return rc;
+    }, txn);
+    if (rc) throw DbError.from(rc);
+    return this.unpackMany(fresults, values, keys.length);
+  }
+
+  /**
+   * Like getMany(), but the lookups run on the native worker pool (see
+   * WorkerPool), so a cold page fault does not block the event loop.
+   * @param keys
+   * @param txn if given, it must not be used until the promise settles;
+   *        otherwise a read-only transaction is opened on the pool thread.
+   */
+  async getManyAsync(
+    keys: K[],
+    txn?: Transaction
+  ): Promise<(Uint8Array | null)[]> {
+    if (!this.dbi) throw notOpen();
+    const fkeys = this.packKeys(keys);
+    const fresults = new Float64Array(keys.length * GET_MANY_STRIDE);
+    let values = new Uint8Array(this.getManySize);
+    const getMany = () =>
+      workerPool.submit((client, id) =>
+        lmdb.ffi_pool_get_many(
+          client,
+          id,
+          this.env.fenv,
+          txn ? txn.htxn : 0,
+          this.dbi,
+          fkeys,
+          keys.length,
+          fresults,
+          values,
+          values.length
+        )
+      );
+    let rc = await getMany();
+    if (rc === ENOMEM) {
+      values = this.growGetMany(fresults, keys.length);
+      rc = await getMany();
+    }
+    if (rc) throw DbError.from(rc);
+    return this.unpackMany(fresults, values, keys.length);
+  }
+
+  /** Like get(), but the lookup runs on the native worker pool. */
+  async getAsync(key: K, txn?: Transaction): Promise<Uint8Array> {
+    const [value] = await this.getManyAsync([key], txn);
+    if (!value) throw new NotFoundError(key);
+    return value;
   }
 
   protected _put(key: K, value: Value, txn: Transaction, flags = 0) {
     if (!this.dbi) throw notOpen();
+    if (fast) {
+      const keyU8 = new Uint8Array(this.keyBuffer(key));
+      const valueU8 = new Uint8Array(encodeValue(value));
+      const rc = fast.ffi_put_fast(
+        txn.htxn,
+        this.dbi,
+        keyU8,
+        keyU8.length,
+        valueU8,
+        valueU8.length,
+        flags
+      );
+      if (rc === MDB_KEYEXIST) {
+        // Look up the value in the way, which mdb_put only returns through
+        // an MDB_val; with MDB_NODUPDATA alone, it is value itself.
+        this.encodeKey(key);
+        this.dbValue.data = valueU8.buffer;
+        if (!(flags & MDB_NODUPDATA) || flags & MDB_NOOVERWRITE) {
+          lmdb.ffi_get(
+            txn.htxn,
+            this.dbi,
+            this.dbKey.fdata,
+            this.dbValue.fdata
+          );
+        }
+        throw new KeyExistsError(key, this.dbValue.data);
+      }
+      if (rc) {
+        txn.writeFailed(rc);
+        throw DbError.from(rc);
+      }
+      return;
+    }
     this.encodeKey(key);
     this.dbValue.data = encodeValue(value);
     const rc = lmdb.ffi_put(
-      txn.ftxn,
+      txn.htxn,
       this.dbi,
       this.dbKey.fdata,
       this.dbValue.fdata,
       flags
     );
     if (rc === MDB_KEYEXIST) throw new KeyExistsError(key, this.dbValue.data);
-    else if (rc) throw DbError.from(rc);
+    else if (rc) {
+      txn.writeFailed(rc);
+      throw DbError.from(rc);
+    }
   }
 
   /**
@@ -196,39 +464,53 @@ export class Database<K extends Key = string> {
     }
   }
 
-  async putAsync(key: K, value: Value, flags?: PutFlags): Promise<void> {
-    const txn = new Transaction(this.env, false);
-    try {
-      this.put(key, value, txn, flags);
-      await txn.commit();
-    } catch (err) {
-      txn.abort();
-      throw err;
-    }
+  /**
+   * Put a single record, in a write transaction shared with any other
+   * writes queued at the same time (see WriteQueue).
+   * @param condition if given, the put is skipped, with a
+   *        ConditionFailedError, unless it holds.
+   */
+  putAsync(
+    key: K,
+    value: Value,
+    flags?: PutFlags,
+    condition?: WriteCondition
+  ): Promise<void> {
+    if (!this.dbi) return Promise.reject(notOpen());
+    return this.env.writeQueue.put(this, key, value, flags, condition);
   }
 
   del(key: K, txn: Transaction): void {
-    this.encodeKey(key);
-    const rc = lmdb.ffi_del(txn.ftxn, this.dbi, this.dbKey.fdata);
-    if (rc) throw DbError.from(rc);
+    let rc: number;
+    if (fast) {
+      const keyU8 = new Uint8Array(this.keyBuffer(key));
+      rc = fast.ffi_del_fast(txn.htxn, this.dbi, keyU8, keyU8.length);
+    } else {
+      this.encodeKey(key);
+      rc = lmdb.ffi_del(txn.htxn, this.dbi, this.dbKey.fdata);
+    }
+    if (rc) {
+      txn.writeFailed(rc);
+      throw DbError.from(rc);
+    }
   }
 
-  async delAsync(key: K): Promise<void> {
-    const txn = new Transaction(this.env, false);
-    try {
-      this.del(key, txn);
-      await txn.commit();
-    } catch (err) {
-      txn.abort();
-      throw err;
-    }
+  /**
+   * Delete a single record, in a write transaction shared with any other
+   * writes queued at the same time (see WriteQueue).
+   * @param condition if given, the delete is skipped, with a
+   *        ConditionFailedError, unless it holds.
+   */
+  delAsync(key: K, condition?: WriteCondition): Promise<void> {
+    if (!this.dbi) return Promise.reject(notOpen());
+    return this.env.writeQueue.del(this, key, condition);
   }
 
   stat(txn?: Transaction): DbStat {
     if (!this.dbi) throw notOpen();
     return this.useTransaction((useTxn) => {
       const fstat = new Float64Array(DbStat.LENGTH);
-      const rc = lmdb.ffi_stat(useTxn.ftxn, this.dbi, fstat);
+      const rc = lmdb.ffi_stat(useTxn.htxn, this.dbi, fstat);
       if (rc) throw DbError.from(rc);
       return new DbStat(fstat);
     }, txn);
@@ -236,7 +518,7 @@ export class Database<K extends Key = string> {
 
   drop(txn: Transaction, del = DROP_DELETE): void {
     if (!this.dbi) throw notOpen();
-    const rc = lmdb.ffi_drop(txn.ftxn, this.dbi, del);
+    const rc = lmdb.ffi_drop(txn.htxn, this.dbi, del);
     if (rc) throw DbError.from(rc);
     if (del === DROP_DELETE) this.dbi = 0;
   }
@@ -260,7 +542,7 @@ export class Database<K extends Key = string> {
   protected _getFlags(txn?: Transaction): number {
     return this.useTransaction((useTxn) => {
       if (!this.dbi) throw notOpen();
-      const rc = lmdb.ffi_dbi_flags(useTxn.ftxn, this.dbi, this.fflags);
+      const rc = lmdb.ffi_dbi_flags(useTxn.htxn, this.dbi, this.fflags);
       if (rc) throw DbError.from(rc);
       return this.fflags[0];
     }, txn);
@@ -284,7 +566,7 @@ export class Database<K extends Key = string> {
       this.dbValue.data = a;
       this.dbValueB.data = b;
       return lmdb.ffi_cmp(
-        useTxn.ftxn,
+        useTxn.htxn,
         this.dbi,
         this.dbValue.fdata,
         this.dbValueB.fdata
@@ -297,9 +579,9 @@ export class Database<K extends Key = string> {
    * transaction.
    *
    * If the user omits passing a transaction, then useTransaction
-   * will create a temporary read-only transaction, pass it into the callback,
-   * abort the temp transaction, and return the same value returned from the
-   * callback.
+   * will take a read-only transaction from the environment's pool (see
+   * Environment.acquireReadTxn()), pass it into the callback, return it to
+   * the pool, and return the same value returned from the callback.
    *
    * If the user supplies a transaction, then that transaction is
    * passed into the callback, and it is up to the user to commit or abort,
@@ -308,12 +590,12 @@ export class Database<K extends Key = string> {
    * @template T
    * @param callback performs business logic with the supplied txn or
    *                 creating a new one. Should return T
-   * @param txn if supplied, use this transaction, otherwise create a
-   *            temporary read-only transaction. Optional.
+   * @param txn if supplied, use this transaction, otherwise use a pooled
+   *            read-only transaction. Optional.
    * @returns {T}
    *
    * @example
-   * // Create a temporary read-only transaction and automatically abort
+   * // Use a pooled read-only transaction, returned to the pool afterwards
    * let db: Database;
    * // ...initialize db
    * const stat: Stat = db.useTransaction((useTxn) => {
@@ -336,13 +618,11 @@ export class Database<K extends Key = string> {
     callback: (useTxn: Transaction) => T,
     txn?: Transaction
   ): T {
-    let useTxn: Transaction;
-    if (txn) useTxn = txn;
-    else useTxn = new Transaction(this.env, true);
+    const useTxn = txn || this.env.acquireReadTxn();
     try {
       return callback(useTxn);
     } finally {
-      if (!txn && useTxn.isOpen) useTxn.abort();
+      if (!txn) this.env.releaseReadTxn(useTxn);
     }
   }
 }
@@ -1,4 +1,5 @@
 import { DbError } from "./dberror.ts";
+import { lmdb } from "./lmdb_ffi.ts";
 
 export class DbData {
   fdata: BigUint64Array;
@@ -25,6 +26,18 @@ export class DbData {
   }
 }
 
+const scratch = new BigUint64Array(
+  new Deno.UnsafePointerView(lmdb.ffi_scratch()).getArrayBuffer(
+    4 * BigUint64Array.BYTES_PER_ELEMENT
+  )
+);
+/**
+ * The calling thread's native key/value wrappers. Every Database and Cursor
+ * shares these, instead of allocating its own pair of BigUint64Arrays.
+ */
+export const scratchKey = new DbData(scratch.subarray(0, 2));
+export const scratchValue = new DbData(scratch.subarray(2, 4));
+
 export interface DbString {
   readonly size: number;
   data: string;
@@ -1,5 +1,5 @@
 import { Key } from "./util.ts";
-import { lmdb, MDB_KEYEXIST, MDB_NOTFOUND } from "./lmdb_ffi.ts";
+import { ECANCELED, lmdb, MDB_KEYEXIST, MDB_NOTFOUND } from "./lmdb_ffi.ts";
 
 export class DbError extends Error {
   code: number;
@@ -50,6 +50,19 @@ export class NotFoundError extends DbError {
   }
 }
 
+/**
+ * Thrown when a conditional write is skipped, because the key's current
+ * value did not match the condition.
+ */
+export class ConditionFailedError extends DbError {
+  key: Key;
+  constructor(key: Key, message?: string) {
+    if (!message) message = DbError.errorMessage(ECANCELED);
+    super(message, ECANCELED);
+    this.key = key;
+  }
+}
+
 export function notImplemented() {
   return new Error("Not implemented");
 }
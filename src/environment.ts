@@ -2,18 +2,32 @@ import * as log from "https://deno.land/std@0.130.0/log/mod.ts";
 import { ensureDir } from "https://deno.land/std@0.130.0/fs/mod.ts";
 import { dirname } from "https://deno.land/std@0.130.0/path/mod.ts";
 import {
+  ALLOC_ALLOCATED,
+  ALLOC_FILE_SIZE,
+  ALLOC_LEN,
+  ALLOC_USED,
   lmdb,
   MDB_CP_COMPACT,
+  MDB_MAP_FULL,
+  MDB_MAP_RESIZED,
+  MDB_MAPASYNC,
   MDB_NOMETASYNC,
   MDB_NOSUBDIR,
   MDB_NOSYNC,
+  MDB_NOTLS,
   MDB_PREVSNAPSHOT,
   MDB_RDONLY,
+  MDB_WRITEMAP,
+  SWEEP_ALL,
+  SWEEP_READ_ONLY,
   SYNC_FORCE,
 } from "./lmdb_ffi.ts";
 import { DbData } from "./dbdata.ts";
 import { DbError } from "./dberror.ts";
 import { DbStat } from "./dbstat.ts";
+import { Transaction } from "./transaction.ts";
+import { workerPool } from "./worker_pool.ts";
+import { WriteQueue } from "./write_queue.ts";
 
 export interface Version {
   major: number;
@@ -26,10 +40,93 @@ export interface EnvOptions {
   path: string;
   maxReaders?: number;
   maxDbs?: number;
+  /**
+   * Initial size of the memory map. Writes which fill it grow it
+   * (doubling it each time) and are retried, up to maxMapSize.
+   */
   mapSize?: number;
+  /** The map never grows beyond this size. Defaults to unlimited. */
+  maxMapSize?: number;
   noSubdir?: boolean;
   readOnly?: boolean;
   prevSnapshot?: boolean;
+  /**
+   * When true (the default), reading a ValueRef after its transaction has
+   * ended throws. Set to false to skip the check on hot read paths.
+   */
+  safeRefs?: boolean;
+  /**
+   * Number of native threads which serve getAsync(), getManyAsync() and
+   * Cursor.scanAsync(). The pool is shared by every environment in the
+   * process, and only ever grows. Defaults to DEFAULT_POOL_THREADS.
+   */
+  poolThreads?: number;
+  /**
+   * Reads without a caller-supplied transaction reuse a pooled read-only
+   * transaction, which is renewed once more than this many write
+   * transactions have been committed since its snapshot. Defaults to 0,
+   * so that every such read sees the latest commit.
+   */
+  readTxnMaxLag?: number;
+  /**
+   * If set, a background thread syncs the environment to disk at this
+   * interval, advancing durableTxnId, so that commits need not wait for
+   * an fsync (see Transaction.commit()).
+   */
+  syncIntervalMs?: number;
+  /**
+   * If set, the background thread also syncs once the map has grown by
+   * this many bytes since the last sync.
+   */
+  syncBytes?: number;
+  /**
+   * How long putAsync() and delAsync() wait for other writes to combine
+   * into the same transaction (see WriteQueue). Defaults to 0: only
+   * writes issued in the same tick are combined.
+   */
+  writeWindowMs?: number;
+  /**
+   * Number of queued writes which are written at once, without waiting
+   * for writeWindowMs. Defaults to DEFAULT_WRITE_BATCH_SIZE.
+   */
+  writeBatchSize?: number;
+  /**
+   * If true, WriteBatch.write() and the write queue hand their batches to
+   * a native writer thread, which commits them back-to-back, so that no
+   * JS thread (including workers) blocks on the write lock. With
+   * bulkIngest, it commits each batch in a transaction of its own, since
+   * LMDB has no nested transactions under MDB_WRITEMAP.
+   */
+  writerThread?: boolean;
+  /**
+   * Open for an initial load, with MDB_WRITEMAP | MDB_MAPASYNC, so that
+   * commits write straight into the map and dirty pages never need to be
+   * spilled. Nothing is crash-safe until finishIngest(). Use BulkLoader
+   * to load each database.
+   */
+  bulkIngest?: boolean;
+  /**
+   * If set, the data file is allocated on disk in steps of this many
+   * bytes, ahead of the pages in use, so that it stays contiguous and
+   * commits need not extend it. Allocation happens after group-commit
+   * syncs and in the background syncer.
+   */
+  preallocStep?: number;
+  /**
+   * Number of threads which write the pages of a large commit (thousands
+   * of pages) concurrently, before its meta page. Defaults to 1.
+   */
+  flushThreads?: number;
+}
+
+export interface AllocInfo {
+  /** bytes of the data file in use */
+  used: number;
+  /** bytes of the data file allocated on disk */
+  allocated: number;
+  fileSize: number;
+  /** allocated / used */
+  ratio: number;
 }
 
 export interface EnvInfo {
@@ -41,6 +138,14 @@ export interface EnvInfo {
 }
 
 const notOpen = () => new DbError("DB environment is already closed");
+/** Most idle read-only txns each Environment keeps for reuse */
+const MAX_POOLED_READ_TXNS = 8;
+/** A full map is grown to this many times its size */
+const MAP_GROWTH_FACTOR = 2;
+/** How long growing the map waits for every other txn to end */
+const MAP_GROW_WAIT_MS = 1000;
+/** receives the new map size from ffi_env_grow() */
+const fmapSize = new Float64Array(1);
 const encoder = new TextEncoder();
 const decoder = new TextDecoder();
 
@@ -79,10 +184,20 @@ export class Environment {
 
   options: EnvOptions;
   fenv: BigUint64Array = new BigUint64Array(1);
+  /** fenv as bytes, for the fast-call symbols */
+  fenvBytes: Uint8Array;
   dbKey: DbData = new DbData();
   dbData: DbData = new DbData();
   isOpen = false;
   isFromMessage = false;
+  /** the map generation (see ffi_env_map_generation()) of mapView() */
+  mapGeneration = 0;
+  /** MDB_val wrapper for the memory map, filled in by mapView() */
+  fmap: DbData = new DbData();
+  protected map?: Uint8Array;
+  /** idle read-only txns, kept open for acquireReadTxn() */
+  protected readTxns: Transaction[] = [];
+  protected _writeQueue?: WriteQueue;
 
   constructor(options: EnvOptions);
   constructor(message: EnvMessage);
@@ -110,8 +225,16 @@ export class Environment {
       if (options?.mapSize) {
         this.setMapSize(options.mapSize);
       }
+      if (options?.flushThreads) {
+        rc = lmdb.ffi_env_set_flush_threads(
+          this.fenv,
+          options.flushThreads
+        );
+        if (rc) throw DbError.from(rc);
+      }
       this.options = options;
     }
+    this.fenvBytes = new Uint8Array(this.fenv.buffer);
   }
 
   asMessage(): EnvMessage {
@@ -125,6 +248,78 @@ export class Environment {
   setMapSize(bytes: number): void {
     const rc = lmdb.ffi_env_set_mapsize(this.fenv, bytes);
     if (rc) throw DbError.from(rc);
+    this.map = undefined;
+  }
+
+  /** The size to grow the map to after rc, or undefined if it cannot. */
+  protected growSize(rc: number): number | undefined {
+    // Only adopts the size which another process has grown the map to.
+    if (rc === MDB_MAP_RESIZED) return 0;
+    if (rc !== MDB_MAP_FULL) return undefined;
+    const mapSize = this.info().mapSize;
+    const maxMapSize = this.options.maxMapSize || Infinity;
+    if (mapSize >= maxMapSize) return undefined;
+    return Math.min(mapSize * MAP_GROWTH_FACTOR, maxMapSize);
+  }
+
+  /**
+   * Recover from a write which failed with MDB_MAP_FULL, by growing the
+   * map, or with MDB_MAP_RESIZED, by adopting the size another process
+   * grew it to. The map can only change once no txn of this env is active
+   * in this process; new ones wait meanwhile. Pooled read txns, in any
+   * thread, are parked, and reset rather than waited for.
+   * @returns true if the write should be retried
+   */
+  async growMap(rc: number): Promise<boolean> {
+    const minSize = this.growSize(rc);
+    if (minSize === undefined) return false;
+    const fsize = new Float64Array(1);
+    const growRc = await lmdb.ffi_env_grow_async(
+      this.fenv,
+      minSize,
+      MAP_GROW_WAIT_MS,
+      fsize
+    );
+    if (growRc) return false;
+    this.mapGrown();
+    return true;
+  }
+
+  /** Like growMap(), but blocks the calling thread. */
+  growMapSync(rc: number): boolean {
+    const minSize = this.growSize(rc);
+    if (minSize === undefined) return false;
+    const growRc = lmdb.ffi_env_grow(
+      this.fenv,
+      minSize,
+      MAP_GROW_WAIT_MS,
+      fmapSize
+    );
+    if (growRc) return false;
+    this.mapGrown();
+    return true;
+  }
+
+  /** Drop the view of the old map */
+  protected mapGrown(): void {
+    this.map = undefined;
+  }
+
+  /**
+   * A single read-only view of the whole memory map, which ValueRefs
+   * point into. It is replaced whenever the map size changes, which may
+   * happen through another Environment of the same env, e.g. in a worker.
+   */
+  mapView(): Uint8Array {
+    if (!this.isOpen) throw notOpen();
+    const generation = lmdb.ffi_env_map_generation(this.fenv);
+    if (!this.map || generation !== this.mapGeneration) {
+      const rc = lmdb.ffi_env_map(this.fenv, this.fmap.fdata);
+      if (rc) throw DbError.from(rc);
+      this.map = new Uint8Array(this.fmap.data);
+      this.mapGeneration = generation;
+    }
+    return this.map;
   }
 
   getMaxReaders(): number {
@@ -144,12 +339,16 @@ export class Environment {
   async open(): Promise<Environment> {
     // MDB_NOMETASYNC and MDB_NOSYNC are set to true so that disk flush can
     // be handled as an asynchronous non-blocking operation.
+    // MDB_NOTLS is set so that read transactions can be handed to the
+    // native worker pool, which runs them on its own threads.
     const flagsVal =
       MDB_NOMETASYNC |
       MDB_NOSYNC |
+      MDB_NOTLS |
       (this.options.noSubdir ? MDB_NOSUBDIR : 0) |
       (this.options.readOnly ? MDB_RDONLY : 0) |
-      (this.options.prevSnapshot ? MDB_PREVSNAPSHOT : 0);
+      (this.options.prevSnapshot ? MDB_PREVSNAPSHOT : 0) |
+      (this.options.bulkIngest ? MDB_WRITEMAP | MDB_MAPASYNC : 0);
     // Create dir if needed.
     if (this.options.noSubdir) {
       await ensureDir(dirname(this.options.path));
@@ -160,13 +359,102 @@ export class Environment {
     const rc = lmdb.ffi_env_open(this.fenv, this.dbData.fdata, flagsVal, 0o664);
     if (rc) throw DbError.from(rc);
     this.isOpen = true;
+    if (this.options.poolThreads) workerPool.start(this.options.poolThreads);
+    if (this.options.writerThread) {
+      const rc = lmdb.ffi_writer_start(this.fenv);
+      if (rc) throw DbError.from(rc);
+    }
+    if (this.options.preallocStep) {
+      const rc = await lmdb.ffi_env_preallocate(
+        this.fenv,
+        this.options.preallocStep
+      );
+      if (rc) throw DbError.from(rc);
+    }
+    if (this.options.syncIntervalMs || this.options.syncBytes) {
+      const rc = lmdb.ffi_env_syncer_start(
+        this.fenv,
+        this.options.syncIntervalMs || 0,
+        this.options.syncBytes || 0
+      );
+      if (rc) throw DbError.from(rc);
+    }
     return this;
   }
 
+  /**
+   * A read-only transaction from this environment's pool, refreshed if it
+   * is more than readTxnMaxLag commits behind, or a new one if the pool is
+   * empty. Hand it back with releaseReadTxn().
+   */
+  acquireReadTxn(): Transaction {
+    if (!this.isOpen) throw notOpen();
+    const txn = this.readTxns.pop();
+    if (!txn) return new Transaction(this, true);
+    try {
+      txn.unpark(this.options.readTxnMaxLag || 0);
+    } catch (err) {
+      txn.abort();
+      throw err;
+    }
+    return txn;
+  }
+
+  /**
+   * Return a transaction from acquireReadTxn() to the pool, still open,
+   * but parked, so that growing the map does not wait for it.
+   */
+  releaseReadTxn(txn: Transaction): void {
+    if (txn.isOpen && this.readTxns.length < MAX_POOLED_READ_TXNS) {
+      txn.park();
+      this.readTxns.push(txn);
+    } else txn.abort();
+  }
+
+  /**
+   * Abort every pooled read-only transaction, e.g. so that the next one
+   * sees a newly opened database.
+   */
+  clearReadTxns(): void {
+    for (const txn of this.readTxns) txn.abort();
+    this.readTxns = [];
+  }
+
+  /**
+   * Release every txn and cursor of this environment which this thread
+   * began or opened, and never committed, aborted or closed. They are
+   * tracked natively, so that JS needs no finalizers; ones which were
+   * leaked would otherwise only be released by close(). Any Transaction or
+   * Cursor which is still in use will fail with EINVAL afterwards; ones
+   * with a getManyAsync() or scanAsync() still running on the worker pool
+   * are left alone.
+   * @param readOnly if true (the default), only release read-only txns
+   *                 and their cursors, which would otherwise stop old
+   *                 pages from being reused; pass false to abort any
+   *                 write txn of this thread as well
+   * @returns the number of handles released
+   */
+  sweep(readOnly = true): number {
+    if (!this.isOpen) throw notOpen();
+    this.clearReadTxns();
+    return lmdb.ffi_env_sweep(
+      this.fenv,
+      readOnly ? SWEEP_READ_ONLY : SWEEP_ALL
+    );
+  }
+
+  /** Combines putAsync() and delAsync() calls into shared transactions. */
+  get writeQueue(): WriteQueue {
+    if (!this._writeQueue) this._writeQueue = new WriteQueue(this);
+    return this._writeQueue;
+  }
+
   async close(): Promise<void> {
     if (!this.isOpen) throw notOpen();
     if (this.isFromMessage)
       throw new DbError("Cannot close environment from a worker thread");
+    await this._writeQueue?.flush();
+    this.clearReadTxns();
     await this.flush();
     lmdb.ffi_env_close(this.fenv);
     this.isOpen = false;
@@ -212,18 +500,72 @@ export class Environment {
     };
   }
 
+  /**
+   * End a bulk ingest (see EnvOptions.bulkIngest) with a single sync of
+   * everything loaded, once every BulkLoader has finished.
+   * @param copyPath if given, also write a compacted copy there
+   */
+  async finishIngest(copyPath?: string): Promise<void> {
+    if (!this.isOpen) throw notOpen();
+    // off the JS thread: a forced msync of a large map can take minutes
+    const rc = await lmdb.ffi_env_sync_force(this.fenv);
+    if (rc) throw DbError.from(rc);
+    if (copyPath) await this.copy(copyPath, true);
+  }
+
+  /** How much of the data file is allocated, compared with its use. */
+  allocInfo(): AllocInfo {
+    if (!this.isOpen) throw notOpen();
+    const falloc = new Float64Array(ALLOC_LEN);
+    const rc = lmdb.ffi_env_alloc_info(this.fenv, falloc);
+    if (rc) throw DbError.from(rc);
+    return {
+      used: falloc[ALLOC_USED],
+      allocated: falloc[ALLOC_ALLOCATED],
+      fileSize: falloc[ALLOC_FILE_SIZE],
+      ratio: falloc[ALLOC_ALLOCATED] / falloc[ALLOC_USED],
+    };
+  }
+
   flushSync(): void {
     if (!this.isOpen) throw notOpen();
     const rc = lmdb.ffi_env_sync(this.fenv, SYNC_FORCE);
     if (rc) throw DbError.from(rc);
   }
 
+  /**
+   * Wait until every transaction committed so far is on disk. Concurrent
+   * flushes, from this or any other thread, share a single fsync.
+   */
   async flush(): Promise<void> {
     if (!this.isOpen) throw notOpen();
-    const rc = await lmdb.ffi_env_sync_force(this.fenv);
+    const rc = await lmdb.ffi_env_sync_committed(this.fenv);
+    if (rc) throw DbError.from(rc);
+  }
+
+  /** Every transaction up to this id is known to be on disk. */
+  get durableTxnId(): number {
+    if (!this.isOpen) throw notOpen();
+    return lmdb.ffi_env_durable_txnid(this.fenv);
+  }
+
+  /**
+   * Wait until the transaction with the given id, as returned by
+   * Transaction.commit(), is on disk, syncing now if it is not already.
+   */
+  async durable(txnid: number): Promise<void> {
+    if (!this.isOpen) throw notOpen();
+    if (txnid <= lmdb.ffi_env_durable_txnid(this.fenv)) return;
+    const rc = await lmdb.ffi_env_wait_durable(this.fenv, txnid);
     if (rc) throw DbError.from(rc);
   }
 
+  /** Ask the background syncer to sync soon, without waiting for it. */
+  requestSync(): void {
+    if (!this.isOpen) throw notOpen();
+    lmdb.ffi_env_sync_request(this.fenv);
+  }
+
   getPath(): string {
     if (!this.isOpen) throw notOpen();
     const rc = lmdb.ffi_env_get_path(this.fenv, this.dbData.fdata);
@@ -0,0 +1,145 @@
+import { ensureDir } from "https://deno.land/std@0.130.0/fs/mod.ts";
+import { CursorOp, fast, lmdb, MDB_RDONLY } from "./lmdb_ffi.ts";
+
+// Compares each hot-path symbol against its fast-call variant, in ns/op:
+//   deno bench --unstable --allow-ffi --allow-read --allow-write \
+//     src/lmdb_ffi.bench.ts
+
+const encoder = new TextEncoder();
+const ENTRIES = 1000;
+
+function wrapValue(buf: Uint8Array): BigUint64Array {
+  return new BigUint64Array([
+    BigInt(buf.byteLength),
+    Deno.UnsafePointer.of(buf).value,
+  ]);
+}
+
+function unwrapValue(wrapper: BigUint64Array): ArrayBuffer {
+  const length = Number(wrapper[0]);
+  return new Deno.UnsafePointerView(
+    new Deno.UnsafePointer(wrapper[1])
+  ).getArrayBuffer(length);
+}
+
+function check(rc: number) {
+  if (rc) throw new Error(`rc = ${rc}`);
+}
+
+const path = ".benchdb";
+await ensureDir(path);
+const fenv = new BigUint64Array(1);
+const fenvBytes = new Uint8Array(fenv.buffer);
+check(lmdb.ffi_env_create(fenv));
+check(lmdb.ffi_env_open(fenv, wrapValue(encoder.encode(path)), 0, 0o664));
+
+if (!fast) throw new Error("this version of Deno has no fast-call support");
+
+const fhandle = new Uint32Array(1);
+check(lmdb.ffi_txn_begin(fenv, 0, 0, fhandle));
+const writeTxn = fhandle[0];
+const fdbi = new Uint32Array(1);
+check(lmdb.ffi_dbi_open(writeTxn, null, 0, fdbi));
+const dbi = fdbi[0];
+const keys = [...Array(ENTRIES).keys()].map((i) =>
+  encoder.encode(`key${String(i).padStart(6, "0")}`)
+);
+const value = encoder.encode("x".repeat(100));
+for (const key of keys) {
+  check(lmdb.ffi_put(writeTxn, dbi, wrapValue(key), wrapValue(value), 0));
+}
+check(lmdb.ffi_txn_commit(writeTxn));
+
+check(lmdb.ffi_txn_begin(fenv, 0, MDB_RDONLY, fhandle));
+const readTxn = fhandle[0];
+check(lmdb.ffi_cursor_open(readTxn, dbi, fhandle));
+const readCursor = fhandle[0];
+const fkey = new BigUint64Array(2);
+const fdata = new BigUint64Array(2);
+const buf = new Uint8Array(4096);
+let i = 0;
+
+Deno.bench({
+  name: "ffi_txn_begin",
+  group: "txn_begin",
+  baseline: true,
+  fn() {
+    check(lmdb.ffi_txn_begin(fenv, 0, MDB_RDONLY, fhandle));
+    lmdb.ffi_txn_abort(fhandle[0]);
+  },
+});
+
+Deno.bench({
+  name: "ffi_txn_begin_fast",
+  group: "txn_begin",
+  fn() {
+    lmdb.ffi_txn_abort(fast!.ffi_txn_begin_fast(fenvBytes, 0, MDB_RDONLY));
+  },
+});
+
+Deno.bench({
+  name: "ffi_get",
+  group: "get",
+  baseline: true,
+  fn() {
+    const key = keys[i++ % ENTRIES];
+    check(lmdb.ffi_get(readTxn, dbi, wrapValue(key), fdata));
+    unwrapValue(fdata);
+  },
+});
+
+Deno.bench({
+  name: "ffi_get_fast",
+  group: "get",
+  fn() {
+    const key = keys[i++ % ENTRIES];
+    fast!.ffi_get_fast(readTxn, dbi, key, key.length, buf, buf.length);
+  },
+});
+
+Deno.bench({
+  name: "ffi_cursor_get",
+  group: "cursor_get",
+  baseline: true,
+  fn() {
+    if (lmdb.ffi_cursor_get(readCursor, fkey, fdata, CursorOp.NEXT)) {
+      check(lmdb.ffi_cursor_get(readCursor, fkey, fdata, CursorOp.FIRST));
+    }
+    unwrapValue(fkey);
+    unwrapValue(fdata);
+  },
+});
+
+Deno.bench({
+  name: "ffi_cursor_get_fast",
+  group: "cursor_get",
+  fn() {
+    const get = (op: CursorOp) =>
+      fast!.ffi_cursor_get_fast(readCursor, op, buf, 0, buf, buf.length);
+    if (get(CursorOp.NEXT) < 0) get(CursorOp.FIRST);
+  },
+});
+
+check(lmdb.ffi_txn_begin(fenv, 0, 0, fhandle));
+const putTxn = fhandle[0];
+
+Deno.bench({
+  name: "ffi_put",
+  group: "put",
+  baseline: true,
+  fn() {
+    const key = keys[i++ % ENTRIES];
+    check(lmdb.ffi_put(putTxn, dbi, wrapValue(key), wrapValue(value), 0));
+  },
+});
+
+Deno.bench({
+  name: "ffi_put_fast",
+  group: "put",
+  fn() {
+    const key = keys[i++ % ENTRIES];
+    check(
+      fast!.ffi_put_fast(putTxn, dbi, key, key.length, value, value.length, 0)
+    );
+  },
+});
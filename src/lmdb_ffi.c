@@ -1,7 +1,17 @@
+/* for fallocate */
+#define _GNU_SOURCE
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <time.h>
+#include <sys/stat.h>
 #include "lmdb.h"
 
 #define CSTR_FROM_VAL(var, from)           \
@@ -46,6 +56,469 @@ extern "C"
 
   size_t sizedbl = sizeof(double);
 
+  ///////////////////////////////////////////////
+  // handle table
+  ///////////////////////////////////////////////
+
+  /*
+   * Transactions, cursors and range cursors are passed to JS as u32 handles
+   * rather than pointers: the low HANDLE_INDEX_BITS select a slot, and the
+   * rest must match the slot's generation, which changes whenever the slot
+   * is freed. A stale handle therefore resolves to NULL instead of freed
+   * memory. Freed slots wait in a FIFO queue, and are only reused once at
+   * least HANDLE_MIN_FREE others have been freed, so a generation lasts for
+   * that many releases, rather than wrapping after a few thousand reuses of
+   * the same slot. Slots live in fixed-size chunks which are never moved or
+   * freed, so lookups need no lock; only allocation and release take the
+   * mutex.
+   *
+   * Every slot also records the env it belongs to, so that the slots of one
+   * env form an arena which ffi_env_sweep can release all at once, without
+   * JS having to track and finalize each txn and cursor itself. Each live
+   * handle is linked into the list of the handle which owns it, so that
+   * the child txns and write cursors which LMDB frees together with their
+   * txn are released together with its handle.
+   */
+#define HANDLE_INDEX_BITS 20
+#define HANDLE_INDEX_MASK ((1u << HANDLE_INDEX_BITS) - 1)
+#define HANDLE_GEN_MASK ((1u << (32 - HANDLE_INDEX_BITS)) - 1)
+#define HANDLE_CHUNK_BITS 10
+#define HANDLE_CHUNK_SIZE (1u << HANDLE_CHUNK_BITS)
+#define HANDLE_MAX_CHUNKS (1u << (HANDLE_INDEX_BITS - HANDLE_CHUNK_BITS))
+/** freed slots are not reused while fewer than this are queued */
+#define HANDLE_MIN_FREE 4096
+
+#define HANDLE_FREE 0
+#define HANDLE_TXN 1
+#define HANDLE_CURSOR 2
+#define HANDLE_RANGE 3
+
+/** slot flag of a top-level txn which is reset, and so not active */
+#define TXN_RESET 0x1
+/** slot flag of an idle read txn, which a resize may reset */
+#define TXN_PARKED 0x2
+
+  typedef struct FFI_slot
+  {
+    void *ptr;
+    MDB_env *env;
+    uint32_t type;
+    /** read and written atomically, since lookups take no lock */
+    uint32_t generation;
+    /** handle of the owning txn (or cursor, for a range), or 0 */
+    uint32_t owner;
+    /** MDB_RDONLY if ptr, or the owning txn, is read-only; TXN_RESET and
+     *  TXN_PARKED */
+    uint32_t flags;
+    /** next free slot index, while type == HANDLE_FREE */
+    uint32_t next_free;
+    /** slot indexes of the first live handle owned by this one, and of
+     *  the previous and next live handles with the same owner */
+    uint32_t first_child;
+    uint32_t prev_sibling;
+    uint32_t next_sibling;
+    /** thread_id() of the thread which created the handle */
+    uint32_t thread;
+    /** pool requests in flight on this handle or any it owns, counted on
+     *  the handle with no owner (see handle_pin) */
+    uint32_t busy;
+  } FFI_slot;
+
+  static FFI_slot *handle_chunks[HANDLE_MAX_CHUNKS];
+  /** slot index 0 is never used, so that handle 0 can mean "none" */
+  static uint32_t handle_used = 1;
+  /** FIFO queue of freed slot indexes, linked through next_free */
+  static uint32_t handle_free_head, handle_free_tail, handle_free_count;
+  static pthread_mutex_t handle_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+  static uint32_t threads_seen;
+  static __thread uint32_t this_thread;
+
+  /** @returns a non-zero id of the calling thread, unique in the process */
+  static uint32_t thread_id(void)
+  {
+    if (!this_thread)
+      this_thread = __atomic_add_fetch(&threads_seen, 1, __ATOMIC_RELAXED);
+    return this_thread;
+  }
+
+  static FFI_slot *handle_slot(uint32_t handle)
+  {
+    uint32_t index = handle & HANDLE_INDEX_MASK;
+    FFI_slot *chunk = __atomic_load_n(&handle_chunks[index >> HANDLE_CHUNK_BITS],
+                                      __ATOMIC_ACQUIRE);
+    if (!chunk)
+      return NULL;
+    return &chunk[index & (HANDLE_CHUNK_SIZE - 1)];
+  }
+
+  /** @returns the current handle of the slot at index */
+  static uint32_t handle_of(uint32_t index, FFI_slot *slot)
+  {
+    uint32_t generation = __atomic_load_n(&slot->generation, __ATOMIC_ACQUIRE);
+    return ((generation & HANDLE_GEN_MASK) << HANDLE_INDEX_BITS) | index;
+  }
+
+  /** @returns the slot of handle if it is live, of any type, or NULL */
+  static FFI_slot *handle_live(uint32_t handle)
+  {
+    if (!handle)
+      return NULL;
+    FFI_slot *slot = handle_slot(handle);
+    if (!slot || __atomic_load_n(&slot->type, __ATOMIC_ACQUIRE) == HANDLE_FREE)
+      return NULL;
+    if (handle_of(handle & HANDLE_INDEX_MASK, slot) != handle)
+      return NULL;
+    return slot;
+  }
+
+  /** @brief link the slot at index into the list of owner, if it is live,
+   *  with handle_mutex held */
+  static void handle_link(uint32_t index, uint32_t owner)
+  {
+    FFI_slot *slot = handle_slot(index);
+    FFI_slot *parent = handle_live(owner);
+    slot->owner = parent ? owner : 0;
+    slot->prev_sibling = 0;
+    slot->next_sibling = parent ? parent->first_child : 0;
+    if (!parent)
+      return;
+    if (parent->first_child)
+      handle_slot(parent->first_child)->prev_sibling = index;
+    parent->first_child = index;
+  }
+
+  /** @brief take the slot at index out of the list of its owner, with
+   *  handle_mutex held */
+  static void handle_unlink(uint32_t index)
+  {
+    FFI_slot *slot = handle_slot(index);
+    if (!slot->owner)
+      return;
+    if (slot->prev_sibling)
+      handle_slot(slot->prev_sibling)->next_sibling = slot->next_sibling;
+    else
+      handle_slot(slot->owner)->first_child = slot->next_sibling;
+    if (slot->next_sibling)
+      handle_slot(slot->next_sibling)->prev_sibling = slot->prev_sibling;
+    slot->owner = 0;
+  }
+
+  /**
+   * @brief allocate a handle for ptr
+   * @returns the new handle, or 0 if the table is full
+   */
+  uint32_t handle_new(void *ptr, MDB_env *env, uint32_t type, uint32_t owner,
+                      uint32_t flags)
+  {
+    uint32_t index;
+    FFI_slot *slot;
+    pthread_mutex_lock(&handle_mutex);
+    if (handle_free_count >= HANDLE_MIN_FREE ||
+        (handle_free_count && handle_used > HANDLE_INDEX_MASK))
+    {
+      index = handle_free_head;
+      slot = handle_slot(index);
+      handle_free_head = slot->next_free;
+      handle_free_count--;
+    }
+    else
+    {
+      index = handle_used;
+      if (index > HANDLE_INDEX_MASK)
+      {
+        pthread_mutex_unlock(&handle_mutex);
+        return 0;
+      }
+      uint32_t chunk = index >> HANDLE_CHUNK_BITS;
+      if (!handle_chunks[chunk])
+      {
+        FFI_slot *slots = calloc(HANDLE_CHUNK_SIZE, sizeof(FFI_slot));
+        if (!slots)
+        {
+          pthread_mutex_unlock(&handle_mutex);
+          return 0;
+        }
+        __atomic_store_n(&handle_chunks[chunk], slots, __ATOMIC_RELEASE);
+      }
+      handle_used++;
+      slot = handle_slot(index);
+    }
+    slot->ptr = ptr;
+    slot->env = env;
+    slot->flags = flags;
+    slot->first_child = 0;
+    slot->thread = thread_id();
+    slot->busy = 0;
+    handle_link(index, owner);
+    __atomic_store_n(&slot->type, type, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&handle_mutex);
+    return handle_of(index, slot);
+  }
+
+  /**
+   * @brief find the live slot for handle
+   * @returns NULL if handle is 0, stale, or not of the given type
+   */
+  FFI_slot *handle_get(uint32_t handle, uint32_t type)
+  {
+    FFI_slot *slot = handle_live(handle);
+    if (!slot || __atomic_load_n(&slot->type, __ATOMIC_ACQUIRE) != type)
+      return NULL;
+    return slot;
+  }
+
+  /**
+   * @brief release the slot at index, with handle_mutex held. The child
+   * txns and write cursors it owns are released as well, since LMDB frees
+   * them when their txn ends; read-only cursors and range cursors are left
+   * with no owner, until they are closed.
+   */
+  static void handle_release(uint32_t index)
+  {
+    FFI_slot *slot = handle_slot(index);
+    while (slot->first_child)
+    {
+      uint32_t child_index = slot->first_child;
+      FFI_slot *child = handle_slot(child_index);
+      if (child->type == HANDLE_TXN ||
+          (child->type == HANDLE_CURSOR && !(child->flags & MDB_RDONLY)))
+        handle_release(child_index);
+      else
+        handle_unlink(child_index);
+    }
+    handle_unlink(index);
+    __atomic_store_n(&slot->type, HANDLE_FREE, __ATOMIC_RELEASE);
+    __atomic_store_n(&slot->generation, slot->generation + 1,
+                     __ATOMIC_RELEASE);
+    slot->ptr = NULL;
+    slot->env = NULL;
+    slot->next_free = 0;
+    if (handle_free_count)
+      handle_slot(handle_free_tail)->next_free = index;
+    else
+      handle_free_head = index;
+    handle_free_tail = index;
+    handle_free_count++;
+  }
+
+  /** @brief release handle, making it (and any copies of it) stale */
+  void handle_free(uint32_t handle)
+  {
+    pthread_mutex_lock(&handle_mutex);
+    if (handle_live(handle))
+      handle_release(handle & HANDLE_INDEX_MASK);
+    pthread_mutex_unlock(&handle_mutex);
+  }
+
+  /** @brief move a read-only cursor handle to the txn it was renewed in */
+  void handle_set_owner(uint32_t handle, uint32_t owner)
+  {
+    pthread_mutex_lock(&handle_mutex);
+    if (handle_live(handle))
+    {
+      handle_unlink(handle & HANDLE_INDEX_MASK);
+      handle_link(handle & HANDLE_INDEX_MASK, owner);
+    }
+    pthread_mutex_unlock(&handle_mutex);
+  }
+
+  /** @returns the slot index of the handle with no owner which (perhaps
+   *  indirectly) owns the slot at index, with handle_mutex held */
+  static uint32_t handle_root(uint32_t index)
+  {
+    FFI_slot *slot;
+    while ((slot = handle_slot(index))->owner)
+      index = slot->owner & HANDLE_INDEX_MASK;
+    return index;
+  }
+
+  /**
+   * @brief mark handle, and every handle it belongs to, as in use by a pool
+   * request, so that ffi_env_sweep leaves them alone until handle_unpin
+   * @param[out] env the env of handle
+   * @returns the handle to pass to handle_unpin, or 0 if handle is stale
+   */
+  uint32_t handle_pin(uint32_t handle, MDB_env **env)
+  {
+    uint32_t root = 0;
+    pthread_mutex_lock(&handle_mutex);
+    if (handle_live(handle))
+    {
+      uint32_t index = handle_root(handle & HANDLE_INDEX_MASK);
+      FFI_slot *slot = handle_slot(index);
+      slot->busy++;
+      root = handle_of(index, slot);
+      *env = slot->env;
+    }
+    pthread_mutex_unlock(&handle_mutex);
+    return root;
+  }
+
+  void handle_unpin(uint32_t root)
+  {
+    pthread_mutex_lock(&handle_mutex);
+    FFI_slot *slot = handle_live(root);
+    if (slot && slot->busy)
+      slot->busy--;
+    pthread_mutex_unlock(&handle_mutex);
+  }
+
+  /**
+   * @brief resolve a txn handle
+   * @returns NULL if htxn is not a live txn
+   */
+  MDB_txn *unwrap_txn(uint32_t htxn)
+  {
+    FFI_slot *slot = handle_get(htxn, HANDLE_TXN);
+    return slot ? (MDB_txn *)slot->ptr : NULL;
+  }
+
+  /**
+   * @brief resolve a cursor handle
+   *
+   * The cursors of a write txn are released together with its handle (see
+   * handle_release). Cursors of read-only txns survive, and must still be
+   * closed or renewed.
+   * @returns NULL if hcursor is not a live cursor
+   */
+  MDB_cursor *unwrap_cursor(uint32_t hcursor)
+  {
+    FFI_slot *slot = handle_get(hcursor, HANDLE_CURSOR);
+    return slot ? (MDB_cursor *)slot->ptr : NULL;
+  }
+
+#define SWEEP_ALL 0
+#define SWEEP_READ_ONLY 1
+/** for ffi_env_close: also drop the handles of other threads (see
+ *  env_sweep_pick) */
+#define SWEEP_CLOSE 2
+
+  /* defined with the env state, below */
+  void write_gate_leave(MDB_env *env);
+  void txn_deactivate(MDB_env *env);
+  MDB_env *txn_retire(uint32_t htxn);
+
+  /**
+   * @brief pick the live handle at index if env_sweep should release it in
+   * the given pass, with handle_mutex held
+   *
+   * Only the calling thread's own handles are picked, so that no other
+   * thread's txn is aborted under it, and none of them can be released
+   * by another thread before the caller gets to it. Handles with a pool
+   * request in flight are left alone. With SWEEP_CLOSE, the handles of
+   * other threads are dropped here instead: made stale, and range cursors
+   * freed, without calling into LMDB, since mdb_env_close is about to
+   * free what they refer to.
+   * @returns the handle, or 0
+   */
+  static uint32_t env_sweep_pick(MDB_env *env, uint32_t flags, int pass,
+                                 uint32_t index, int32_t *dropped)
+  {
+    FFI_slot *slot = handle_slot(index);
+    uint32_t type = slot->type;
+    if (type == HANDLE_FREE || slot->env != env)
+      return 0;
+    if ((flags & SWEEP_READ_ONLY) && !(slot->flags & MDB_RDONLY))
+      return 0;
+    if (handle_slot(handle_root(index))->busy)
+      return 0;
+    if (slot->thread != thread_id())
+    {
+      if (!(flags & SWEEP_CLOSE))
+        return 0;
+      if (type == HANDLE_RANGE)
+        free(slot->ptr);
+      handle_release(index);
+      (*dropped)++;
+      return 0;
+    }
+    if (pass == 0 && (type == HANDLE_RANGE || type == HANDLE_CURSOR))
+      return handle_of(index, slot);
+    if (pass == 1 && type == HANDLE_TXN && !slot->owner)
+      return handle_of(index, slot);
+    return 0;
+  }
+
+  int32_t env_sweep(MDB_env *env, uint32_t flags)
+  {
+    int32_t swept = 0;
+    uint32_t used = __atomic_load_n(&handle_used, __ATOMIC_ACQUIRE);
+    /* txns last, after every cursor that might refer to them; child txns
+     * are released together with their parents */
+    for (int pass = 0; pass < 2; pass++)
+    {
+      for (uint32_t index = 1; index < used; index++)
+      {
+        pthread_mutex_lock(&handle_mutex);
+        uint32_t handle = env_sweep_pick(env, flags, pass, index, &swept);
+        pthread_mutex_unlock(&handle_mutex);
+        FFI_slot *slot = handle_live(handle);
+        if (!slot)
+          continue;
+        if (slot->type == HANDLE_RANGE)
+        {
+          free(slot->ptr);
+          handle_free(handle);
+        }
+        else if (slot->type == HANDLE_CURSOR)
+        {
+          mdb_cursor_close((MDB_cursor *)slot->ptr);
+          handle_free(handle);
+        }
+        else
+        {
+          int write = !(slot->flags & MDB_RDONLY);
+          MDB_env *active_env = txn_retire(handle);
+          mdb_txn_abort((MDB_txn *)slot->ptr);
+          handle_free(handle);
+          if (write)
+            write_gate_leave(env);
+          if (active_env)
+            txn_deactivate(active_env);
+        }
+        swept++;
+      }
+    }
+    DEBUG_PRINT(("env_sweep(%p, %d): %d\n", env, flags, swept));
+    return swept;
+  }
+
+  /**
+   * @brief release every live handle in env's arena which was created by
+   * the calling thread, and has no pool request in flight
+   *
+   * Range cursors are freed, cursors closed, and txns aborted, children
+   * together with their parents. Any JS object still holding one of these
+   * handles will find it stale.
+   *
+   * @param[in] fenv MDB_env wrapper
+   * @param[in] flags SWEEP_READ_ONLY to release only read-only txns and
+   *                  their cursors, which would otherwise pin old pages
+   * @return int32_t number of handles released
+   */
+  int32_t ffi_env_sweep(uint8_t *fenv, uint32_t flags)
+  {
+    uint64_t addr;
+    memcpy(&addr, fenv, sizeof(addr));
+    return env_sweep((MDB_env *)addr, flags & SWEEP_READ_ONLY);
+  }
+
+  /**
+   * per-thread MDB_val pair for key and data, so that JS needs only one
+   * set of wrappers per thread instead of one per object.
+   */
+  static __thread uint64_t scratch_vals[4];
+
+  /**
+   * @brief get the calling thread's scratch MDB_val wrappers
+   * @returns address of two consecutive MDB_val wrappers (key, data)
+   */
+  uint8_t *ffi_scratch()
+  {
+    return (uint8_t *)scratch_vals;
+  }
+
   ///////////////////////////////////////////////
   // global functions
   ///////////////////////////////////////////////
@@ -100,711 +573,2207 @@ extern "C"
     return (MDB_env *)addr;
   }
 
-  /**
-   * @brief mdb_env_create wrapper
-   * @param[out] fenv FFI wrapper containing pointer to new MDB_env
-   * @return 0 on success, non-zero otherwise
+  /*
+   * Shim-side state for each open env, shared by every thread which uses
+   * it. It is kept in a list of its own rather than in the env's userctx,
+   * which belongs to the caller (see ffi_env_set_userctx). States are
+   * never unlinked or freed, only recycled for the next env once theirs
+   * is closed, so that the list can be searched without a lock on every
+   * txn begin.
    */
-  int32_t ffi_env_create(uint8_t *fenv)
+  typedef struct FFI_writer FFI_writer;
+
+  typedef struct FFI_env_state
   {
     MDB_env *env;
-    int rc = mdb_env_create(&env);
-    DEBUG_PRINT(("mdb_env_create(%p): %d\n", env, rc));
-    wrap_env(env, fenv);
-    return rc;
-  }
+    struct FFI_env_state *next;
+    pthread_mutex_t mutex;
+    /** broadcast whenever a sync of the env finishes */
+    pthread_cond_t synced;
+    /** every txn up to this id is known to be on disk; read atomically */
+    size_t durable_txnid;
+    /** me_last_pgno as of the last sync, for the sync_bytes policy */
+    size_t synced_pgno;
+    /** true while some thread is running mdb_env_sync for the group */
+    int syncing;
+    /** background syncer (see ffi_env_syncer_start) */
+    pthread_t syncer;
+    int syncer_running;
+    int syncer_stop;
+    int sync_requested;
+    /** wakes the syncer early, to stop or to sync on demand */
+    pthread_cond_t wake;
+    uint32_t sync_interval_ms;
+    size_t sync_bytes;
+    /** native writer thread (see ffi_writer_start), or NULL; set with
+     *  mutex held, read atomically */
+    FFI_writer *writer;
+    /** ffi_writer_submit calls which may be using writer; ffi_writer_stop
+     *  waits for them before freeing it */
+    uint32_t writer_users;
+    /** true while the write gate is entered (see write_gate_enter) */
+    int write_gated;
+    pthread_cond_t write_gate_free;
+    /** preallocation (see env_preallocate); 0 if off */
+    size_t prealloc_step;
+    /** the data file is allocated up to here */
+    size_t prealloc_end;
+    /** true while some thread is running fallocate */
+    int preallocating;
+    /** incremented whenever the memory map may have been replaced; read
+     *  atomically (see ffi_env_map_generation) */
+    uint32_t map_generation;
+    /** top-level txns of the env which are active (see txn_activate) */
+    int txns_active;
+    /** true while the map is being resized (see ffi_env_grow) */
+    int map_resizing;
+    pthread_mutex_t map_mutex;
+    /** signalled when txns_active drops to 0 during a resize */
+    pthread_cond_t map_idle;
+    /** signalled when a resize ends */
+    pthread_cond_t map_resized;
+    /** set by ffi_env_close, which fails new uses of the env */
+    int closing;
+    /** pool requests and nonblocking calls using the env (see env_enter) */
+    uint32_t users;
+    /** signalled when users drops to 0 while closing */
+    pthread_cond_t unused;
+  } FFI_env_state;
+
+  static FFI_env_state *env_states;
+  static pthread_mutex_t env_states_mutex = PTHREAD_MUTEX_INITIALIZER;
 
   /**
-   * @brief mdb_env_open wrapper
-   *
-   * @param fenv MDB_env wrapper
-   * @param fpath MDB_val wrapper
-   * @param flags
-   * @param mode
-   * @return int32_t 0 on success, non-zero otherwise
+   * @brief find the state of env, creating it on first use
+   * @returns NULL if it could not be allocated
    */
-  int32_t ffi_env_open(uint8_t *fenv, uint8_t *fpath, uint32_t flags, uint32_t mode)
+  FFI_env_state *env_state(MDB_env *env)
   {
-    MDB_env *env = unwrap_env(fenv);
-    MDB_val path = unwrap_val(fpath);
-    CSTR_FROM_VAL(cpath, path);
-    int rc = mdb_env_open(env, cpath, (unsigned int)flags, (mdb_mode_t)mode);
-    DEBUG_PRINT(("mdb_env_open(%p, '%s', %d, 0%03o): %d\n", env, cpath, flags, mode, rc));
-    return (int32_t)rc;
+    FFI_env_state *state = __atomic_load_n(&env_states, __ATOMIC_ACQUIRE);
+    for (; state; state = state->next)
+    {
+      if (__atomic_load_n(&state->env, __ATOMIC_ACQUIRE) == env)
+        return state;
+    }
+    pthread_mutex_lock(&env_states_mutex);
+    FFI_env_state *unused = NULL;
+    for (state = env_states; state && state->env != env; state = state->next)
+    {
+      if (!state->env)
+        unused = state;
+    }
+    if (!state && !(state = unused) &&
+        (state = calloc(1, sizeof(FFI_env_state))))
+    {
+      state->next = env_states;
+      __atomic_store_n(&env_states, state, __ATOMIC_RELEASE);
+    }
+    if (state && state->env != env)
+    {
+      /* everything after env and next, which lookups may be reading */
+      memset(&state->mutex, 0,
+             sizeof(FFI_env_state) - offsetof(FFI_env_state, mutex));
+      pthread_mutex_init(&state->mutex, NULL);
+      pthread_cond_init(&state->synced, NULL);
+      pthread_cond_init(&state->wake, NULL);
+      pthread_cond_init(&state->write_gate_free, NULL);
+      pthread_mutex_init(&state->map_mutex, NULL);
+      pthread_cond_init(&state->map_idle, NULL);
+      pthread_cond_init(&state->map_resized, NULL);
+      pthread_cond_init(&state->unused, NULL);
+      __atomic_store_n(&state->env, env, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&env_states_mutex);
+    return state;
   }
 
-  /**
-   * @brief mdb_env_copy wrapper */
-  int32_t ffi_env_copy(uint8_t *fenv, uint8_t *fpath)
+  /** @brief release the state of env, if any, when it is closed */
+  void env_state_free(MDB_env *env)
   {
-    MDB_env *env = unwrap_env(fenv);
-    MDB_val path = unwrap_val(fpath);
-    CSTR_FROM_VAL(cpath, path);
-    int rc = mdb_env_copy(env, cpath);
-    DEBUG_PRINT(("mdb_env_copy(%p, '%s'): %d\n", env, cpath, rc));
-    return (int32_t)rc;
+    pthread_mutex_lock(&env_states_mutex);
+    FFI_env_state *state = env_states;
+    while (state && state->env != env)
+      state = state->next;
+    if (state)
+    {
+      __atomic_store_n(&state->env, NULL, __ATOMIC_RELEASE);
+      pthread_mutex_destroy(&state->mutex);
+      pthread_cond_destroy(&state->synced);
+      pthread_cond_destroy(&state->wake);
+      pthread_cond_destroy(&state->write_gate_free);
+      pthread_mutex_destroy(&state->map_mutex);
+      pthread_cond_destroy(&state->map_idle);
+      pthread_cond_destroy(&state->map_resized);
+      pthread_cond_destroy(&state->unused);
+    }
+    pthread_mutex_unlock(&env_states_mutex);
   }
 
   /**
-   * @brief mdb_env_copyfd wrapper */
-  int32_t ffi_env_copyfd(uint8_t *fenv, int32_t fd)
+   * @brief count a use of env which may still be running on another
+   * thread when env is closed: a pool request, or a call bound with
+   * "nonblocking: true". ffi_env_close fails those which wait on env
+   * with ECANCELED, then waits for every use to leave (see env_drain).
+   * @returns 0, or ECANCELED if env is closing
+   */
+  int env_enter(MDB_env *env, FFI_env_state **entered)
   {
-    MDB_env *env = unwrap_env(fenv);
-    int rc = mdb_env_copyfd(env, (mdb_filehandle_t)fd);
-    DEBUG_PRINT(("mdb_env_copyfd(%p, %d): %d\n", env, fd, rc));
-    return (int32_t)rc;
+    FFI_env_state *state = env_state(env);
+    if (!state)
+      return ENOMEM;
+    int rc = MDB_SUCCESS;
+    pthread_mutex_lock(&state->mutex);
+    if (state->closing)
+      rc = ECANCELED;
+    else
+      state->users++;
+    pthread_mutex_unlock(&state->mutex);
+    *entered = state;
+    return rc;
   }
 
-  /**
-   * @brief mdb_env_copy2 wrapper */
-  int32_t ffi_env_copy2(uint8_t *fenv, uint8_t *fpath, uint32_t flags)
+  void env_leave(FFI_env_state *state)
   {
-    MDB_env *env = unwrap_env(fenv);
-    MDB_val path = unwrap_val(fpath);
-    CSTR_FROM_VAL(cpath, path);
-    int rc = mdb_env_copy2(env, cpath, (unsigned int)flags);
-    DEBUG_PRINT(("mdb_env_copy2(%p, '%s', %d)\n", env, cpath, flags));
-    return (int32_t)rc;
+    pthread_mutex_lock(&state->mutex);
+    if (!--state->users && state->closing)
+      pthread_cond_broadcast(&state->unused);
+    pthread_mutex_unlock(&state->mutex);
   }
 
   /**
-   * @brief mdb_env_copyfd2 wrapper */
-  int32_t ffi_env_copyfd2(uint8_t *fenv, int32_t fd, uint32_t flags)
+   * @brief mark env as closing, and wake every thread which waits for its
+   * write gate or a sync, which then fails with ECANCELED. This includes
+   * the native writer, which would otherwise wait forever on a gate held
+   * by a leaked write txn, which only the close-time sweep ends.
+   */
+  void env_closing(MDB_env *env)
   {
-    MDB_env *env = unwrap_env(fenv);
-    int rc = mdb_env_copyfd2(env, (mdb_filehandle_t)fd, (unsigned int)flags);
-    DEBUG_PRINT(("mdb_env_copyfd2(%p, %d, %d): %d", env, fd, flags, rc));
-    return (int32_t)rc;
+    FFI_env_state *state = env_state(env);
+    if (!state)
+      return;
+    pthread_mutex_lock(&state->mutex);
+    state->closing = 1;
+    pthread_cond_broadcast(&state->write_gate_free);
+    pthread_cond_broadcast(&state->synced);
+    pthread_mutex_unlock(&state->mutex);
   }
 
-#define STAT_PSIZE 0
-#define STAT_DEPTH 1
-#define STAT_BRANCH_PAGES 2
-#define STAT_LEAF_PAGES 3
-#define STAT_OVERFLOW_PAGES 4
-#define STAT_ENTRIES 5
-
-  /** Serialize MDB_stat object src into dest */
-  void copy_stat(uint8_t *dest, MDB_stat *src)
+  /** @brief wait until every use of a closing env has left */
+  void env_drain(MDB_env *env)
   {
-    double psize = (double)src->ms_psize;
-    double depth = (double)src->ms_depth;
-    double branch_pages = (double)src->ms_branch_pages;
-    double leaf_pages = (double)src->ms_leaf_pages;
-    double overflow_pages = (double)src->ms_overflow_pages;
-    double entries = (double)src->ms_overflow_pages;
-    memcpy(dest + (STAT_PSIZE * sizedbl), &psize, sizedbl);
-    memcpy(dest + (STAT_DEPTH * sizedbl), &depth, sizedbl);
-    memcpy(dest + (STAT_BRANCH_PAGES * sizedbl), &branch_pages, sizedbl);
-    memcpy(dest + (STAT_LEAF_PAGES * sizedbl), &leaf_pages, sizedbl);
-    memcpy(dest + (STAT_OVERFLOW_PAGES * sizedbl), &overflow_pages, sizedbl);
-    memcpy(dest + (STAT_ENTRIES * sizedbl), &entries, sizedbl);
+    FFI_env_state *state = env_state(env);
+    if (!state)
+      return;
+    pthread_mutex_lock(&state->mutex);
+    while (state->users)
+      pthread_cond_wait(&state->unused, &state->mutex);
+    pthread_mutex_unlock(&state->mutex);
   }
 
-  /**
-   * @brief mdb_env_stat wrapper
-   * @param[in] fenv MDB_env wrapper
-   * @param[out] fstat_dbl array of doubles containing MDB_stat data
+  /*
+   * The write gate is entered before every top-level write txn which the
+   * shim begins, and left when that txn ends, so that within this process
+   * only one thread at a time ever waits on LMDB's write mutex, and never
+   * for long. Unlike that mutex, the gate has no owning thread: it can be
+   * entered on one thread and then used on another, and tested without
+   * blocking. Writers in other processes still contend on the mutex.
    */
-  int32_t ffi_env_stat(uint8_t *fenv, u_int8_t *fstat_dbl)
+#define GATE_WAIT 0
+#define GATE_TRY 1
+/** the caller has already entered the gate */
+#define GATE_ENTERED 2
+
+  /** @returns 0 once entered, EBUSY if mode is GATE_TRY and it is taken,
+   *  ECANCELED if it is taken and env is closing */
+  int write_gate_enter(MDB_env *env, int mode)
   {
-    MDB_env *env = unwrap_env(fenv);
-    MDB_stat stat;
-    int rc = mdb_env_stat(env, &stat);
-    DEBUG_PRINT(("mdb_env_stat(%p, %p): %d\n", env, &stat, rc));
-    copy_stat(fstat_dbl, &stat);
-    return (int32_t)rc;
+    if (mode == GATE_ENTERED)
+      return MDB_SUCCESS;
+    FFI_env_state *state = env_state(env);
+    if (!state)
+      return ENOMEM;
+    int rc = MDB_SUCCESS;
+    pthread_mutex_lock(&state->mutex);
+    if (mode == GATE_TRY && state->write_gated)
+      rc = EBUSY;
+    else
+    {
+      while (state->write_gated && !state->closing)
+        pthread_cond_wait(&state->write_gate_free, &state->mutex);
+      if (state->write_gated)
+        rc = ECANCELED;
+      else
+        state->write_gated = 1;
+    }
+    pthread_mutex_unlock(&state->mutex);
+    return rc;
   }
 
-#define INFO_MAPSIZE 0
-#define INFO_LAST_PGNO 1
-#define INFO_LAST_TXNID 2
-#define INFO_MAXREADERS 3
-#define INFO_NUMREADERS 4
+  void write_gate_leave(MDB_env *env)
+  {
+    FFI_env_state *state = env_state(env);
+    if (!state)
+      return;
+    pthread_mutex_lock(&state->mutex);
+    state->write_gated = 0;
+    pthread_cond_signal(&state->write_gate_free);
+    pthread_mutex_unlock(&state->mutex);
+  }
 
   /**
-   * @brief mdb_env_info wrapper
+   * @brief wait for the write gate of env, and enter it. Intended to be
+   * bound with "nonblocking: true", and followed by
+   * ffi_txn_begin_entered, which takes it over.
+   *
    * @param[in] fenv MDB_env wrapper
-   * @param[out] finfo_dbl array of doubles containing MDB_envinfo data
+   * @return int32_t 0 on success, non-zero otherwise
    */
-  int32_t ffi_env_info(uint8_t *fenv, u_int8_t *finfo_dbl)
+  int32_t ffi_write_gate_wait(uint8_t *fenv)
   {
     MDB_env *env = unwrap_env(fenv);
-    MDB_envinfo info;
-    int rc = mdb_env_info(env, &info);
-    DEBUG_PRINT(("mdb_env_info(%p, %p): %d\n", env, &info, rc));
-    // Serialize info
-    double mapsize = (double)info.me_mapsize;
-    double last_pgno = (double)info.me_last_pgno;
-    double last_txnid = (double)info.me_last_txnid;
-    double maxreaders = (double)info.me_maxreaders;
-    double numreaders = (double)info.me_numreaders;
-    memcpy(finfo_dbl + (INFO_MAPSIZE * sizedbl), &mapsize, sizedbl);
-    memcpy(finfo_dbl + (INFO_LAST_PGNO * sizedbl), &last_pgno, sizedbl);
-    memcpy(finfo_dbl + (INFO_LAST_TXNID * sizedbl), &last_txnid, sizedbl);
-    memcpy(finfo_dbl + (INFO_MAXREADERS * sizedbl), &maxreaders, sizedbl);
-    memcpy(finfo_dbl + (INFO_NUMREADERS * sizedbl), &numreaders, sizedbl);
+    FFI_env_state *state;
+    int rc = env_enter(env, &state);
+    if (rc)
+      return (int32_t)rc;
+    rc = write_gate_enter(env, GATE_WAIT);
+    env_leave(state);
     return (int32_t)rc;
   }
 
-#define SYNC_FORCE 1
-#define SYNC_DONT_FORCE 0
+  /*
+   * mdb_env_set_mapsize may only grow the map while no txn of the env is
+   * active in the process, since it moves the map under them. Every
+   * top-level txn the shim begins is counted in the txns_active of its
+   * env from mdb_txn_begin (or renew) until it ends (or is reset). A
+   * resize first sets map_resizing, which holds back new txns of the env,
+   * then waits for the count to drain. Idle read txns which JS keeps for
+   * reuse are parked (see ffi_txn_park), so that a resize can reset them
+   * rather than wait for them.
+   */
 
-  /**
-   * @brief mdb_env_sync wrapper */
-  int32_t ffi_env_sync(uint8_t *fenv, int32_t force)
+  void state_txn_deactivate(FFI_env_state *state)
   {
-    MDB_env *env = unwrap_env(fenv);
-    int rc = mdb_env_sync(env, (int)force);
-    DEBUG_PRINT(("mdb_env_sync(%p, %d)\n", env, force));
-    return (int32_t)rc;
+    if (!__atomic_sub_fetch(&state->txns_active, 1, __ATOMIC_SEQ_CST) &&
+        __atomic_load_n(&state->map_resizing, __ATOMIC_SEQ_CST))
+    {
+      pthread_mutex_lock(&state->map_mutex);
+      pthread_cond_broadcast(&state->map_idle);
+      pthread_mutex_unlock(&state->map_mutex);
+    }
   }
 
   /**
-   * @brief this method is intended to be bound with "nonblocking: true",
-   * so that disk sync can be offloaded to an asynchronous worker thread
-   * and resolve a promise when complete.
-   *
-   * @param fenv
-   * @return int32_t
+   * @brief count a txn of env which is about to begin, once no resize is due
+   * @returns 0, or ENOMEM if the state of env could not be allocated
    */
-  int32_t ffi_env_sync_force(uint8_t *fenv)
+  int txn_activate(MDB_env *env)
   {
-    return ffi_env_sync(fenv, SYNC_FORCE);
+    FFI_env_state *state = env_state(env);
+    if (!state)
+      return ENOMEM;
+    for (;;)
+    {
+      __atomic_add_fetch(&state->txns_active, 1, __ATOMIC_SEQ_CST);
+      if (!__atomic_load_n(&state->map_resizing, __ATOMIC_SEQ_CST))
+        return MDB_SUCCESS;
+      state_txn_deactivate(state);
+      pthread_mutex_lock(&state->map_mutex);
+      while (state->map_resizing)
+        pthread_cond_wait(&state->map_resized, &state->map_mutex);
+      pthread_mutex_unlock(&state->map_mutex);
+    }
   }
 
-  /**
-   * @brief mdb_env_close wrapper */
-  void ffi_env_close(uint8_t *fenv)
+  void txn_deactivate(MDB_env *env)
   {
-    MDB_env *env = unwrap_env(fenv);
-    mdb_env_close(env);
-    DEBUG_PRINT(("mdb_env_close(%p)\n", env));
+    FFI_env_state *state = env_state(env);
+    if (state)
+      state_txn_deactivate(state);
   }
 
   /**
-   * @brief mdb_env_set_flags wrapper */
-  int32_t ffi_env_set_flags(uint8_t *fenv, uint32_t flags, int32_t onoff)
+   * @brief mark htxn as no longer counted in txns_active, before it is
+   * ended or reset, so that a resize does not reset it as well
+   * @returns its env if it was counted, and must be deactivated, or NULL
+   */
+  MDB_env *txn_retire(uint32_t htxn)
   {
-    MDB_env *env = unwrap_env(fenv);
-    int rc = mdb_env_set_flags(env, (unsigned int)flags, (int)onoff);
-    DEBUG_PRINT(("mdb_env_set_flags(%p, 0x%x, %d): %d\n", env, flags, onoff, rc));
-    return (int32_t)rc;
+    MDB_env *env = NULL;
+    pthread_mutex_lock(&handle_mutex);
+    FFI_slot *slot = handle_live(htxn);
+    if (slot && slot->type == HANDLE_TXN && !slot->owner &&
+        !(slot->flags & TXN_RESET))
+    {
+      slot->flags |= TXN_RESET;
+      env = slot->env;
+    }
+    pthread_mutex_unlock(&handle_mutex);
+    return env;
   }
 
   /**
-   * @brief mdb_env_get_flags wrapper
-   * @param[in] fenv MDB_env wrapper
-   * @param[out] flags
+   * @brief reset every parked, active txn of env, for a resize
+   * @returns the number of txns reset, which are no longer active
    */
-  int32_t ffi_env_get_flags(uint8_t *fenv, uint32_t *flags)
+  int env_reset_parked(MDB_env *env)
   {
-    MDB_env *env = unwrap_env(fenv);
-    unsigned int _flags;
-    int rc = mdb_env_get_flags(env, &_flags);
-    DEBUG_PRINT(("mdb_env_get_flags(%p, 0x%x): %d\n", env, _flags, rc));
-    *flags = (uint32_t)_flags;
-    return (int32_t)rc;
+    int reset = 0;
+    pthread_mutex_lock(&handle_mutex);
+    for (uint32_t index = 1; index < handle_used; index++)
+    {
+      FFI_slot *slot = handle_slot(index);
+      if (slot->type != HANDLE_TXN || slot->env != env ||
+          (slot->flags & (TXN_PARKED | TXN_RESET)) != TXN_PARKED)
+        continue;
+      mdb_txn_reset((MDB_txn *)slot->ptr);
+      slot->flags |= TXN_RESET;
+      reset++;
+    }
+    pthread_mutex_unlock(&handle_mutex);
+    return reset;
+  }
+
+  /** @brief enter the write gate and begin a top-level write txn, for
+   *  batches applied natively; end it with write_txn_end */
+  int write_txn_begin(MDB_env *env, MDB_txn **txn)
+  {
+    int rc = write_gate_enter(env, GATE_WAIT);
+    if (rc)
+      return rc;
+    rc = txn_activate(env);
+    if (rc)
+    {
+      write_gate_leave(env);
+      return rc;
+    }
+    rc = mdb_txn_begin(env, NULL, MDB_NOMETASYNC | MDB_NOSYNC, txn);
+    if (rc)
+    {
+      txn_deactivate(env);
+      write_gate_leave(env);
+    }
+    return rc;
+  }
+
+  /** @brief release what write_txn_begin took, once its txn has ended */
+  void write_txn_end(MDB_env *env)
+  {
+    txn_deactivate(env);
+    write_gate_leave(env);
+  }
+
+  /** @brief note that the memory map of env may have moved, so that every
+   *  view of it is dropped (see ffi_env_map_generation) */
+  void map_replaced(MDB_env *env)
+  {
+    FFI_env_state *state = env_state(env);
+    if (state)
+      __atomic_add_fetch(&state->map_generation, 1, __ATOMIC_RELEASE);
   }
 
   /**
-   * @brief mdb_env_get_path wrapper
+   * @brief the generation of env's memory map, which changes whenever it
+   * may have been replaced, through any thread or wrapper of env. A view
+   * taken by ffi_env_map is only valid while this stays the same.
+   *
    * @param[in] fenv MDB_env wrapper
-   * @param[out] fpath MDB_val wrapper
+   * @return uint32_t
    */
-  int32_t ffi_env_get_path(uint8_t *fenv, uint8_t *fpath)
+  uint32_t ffi_env_map_generation(uint8_t *fenv)
   {
-    MDB_env *env = unwrap_env(fenv);
-    char *cpath;
-    int rc = mdb_env_get_path(env, (const char **)&cpath);
-    DEBUG_PRINT(("mdb_env_get_path(%p, '%s'): %d\n", env, cpath, rc));
-    MDB_val path;
-    path.mv_size = strlen(cpath);
-    path.mv_data = cpath;
-    wrap_val(path, fpath);
-    return (int32_t)rc;
+    FFI_env_state *state = env_state(unwrap_env(fenv));
+    return state ? __atomic_load_n(&state->map_generation, __ATOMIC_ACQUIRE)
+                 : 0;
   }
 
   /**
-   * @brief mdb_env_get_fd wrapper
+   * @brief grow the map of env, once no txn of env is active in this
+   * process. Parked read txns are reset rather than waited for.
+   *
+   * First adopts any larger size set by another process (which makes
+   * txns fail with MDB_MAP_RESIZED until then), then grows the map to
+   * min_size, if it is still smaller. New txns wait until it is done.
+   *
    * @param[in] fenv MDB_env wrapper
-   * @param[out] fd file descriptor
+   * @param[in] min_size size in bytes, or 0 only to adopt a new size
+   * @param[in] wait_ms how long to wait for active txns to end
+   * @param[out] fsize the resulting map size
+   * @return int32_t 0 on success, EBUSY if txns were still active after
+   *                 wait_ms, non-zero otherwise
    */
-  int32_t ffi_env_get_fd(uint8_t *fenv, int32_t *fd)
+  int32_t ffi_env_grow(uint8_t *fenv, double min_size, uint32_t wait_ms,
+                       double *fsize)
   {
     MDB_env *env = unwrap_env(fenv);
-    int rc = mdb_env_get_fd(env, fd);
-    DEBUG_PRINT(("mdb_env_get_fd(%p, %d): %d\n", env, *fd, rc));
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += wait_ms / 1000;
+    deadline.tv_nsec += (long)(wait_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    FFI_env_state *state = env_state(env);
+    if (!state)
+      return ENOMEM;
+    int rc = MDB_SUCCESS;
+    pthread_mutex_lock(&state->map_mutex);
+    while (state->map_resizing)
+      pthread_cond_wait(&state->map_resized, &state->map_mutex);
+    __atomic_store_n(&state->map_resizing, 1, __ATOMIC_SEQ_CST);
+    __atomic_sub_fetch(&state->txns_active, env_reset_parked(env),
+                       __ATOMIC_SEQ_CST);
+    while (!rc && __atomic_load_n(&state->txns_active, __ATOMIC_SEQ_CST))
+    {
+      if (pthread_cond_timedwait(&state->map_idle, &state->map_mutex,
+                                 &deadline) == ETIMEDOUT)
+        rc = EBUSY;
+    }
+    if (!rc)
+      rc = mdb_env_set_mapsize(env, 0);
+    MDB_envinfo info;
+    if (!rc)
+      rc = mdb_env_info(env, &info);
+    if (!rc && (double)info.me_mapsize < min_size)
+    {
+      rc = mdb_env_set_mapsize(env, (mdb_size_t)min_size);
+      if (!rc)
+        rc = mdb_env_info(env, &info);
+    }
+    if (!rc)
+    {
+      *fsize = (double)info.me_mapsize;
+      map_replaced(env);
+    }
+    __atomic_store_n(&state->map_resizing, 0, __ATOMIC_SEQ_CST);
+    pthread_cond_broadcast(&state->map_resized);
+    pthread_mutex_unlock(&state->map_mutex);
+    DEBUG_PRINT(("ffi_env_grow(%p, %.0f): %d\n", env, min_size, rc));
     return (int32_t)rc;
   }
 
   /**
-   * @brief mdb_env_set_mapsize wrapper */
-  int32_t ffi_env_set_mapsize(uint8_t *fenv, uint64_t size)
+   * @brief ffi_env_grow, intended to be bound with "nonblocking: true"
+   */
+  int32_t ffi_env_grow_async(uint8_t *fenv, double min_size,
+                             uint32_t wait_ms, double *fsize)
   {
-    MDB_env *env = unwrap_env(fenv);
-    int rc = mdb_env_set_mapsize(env, (mdb_size_t)size);
-    DEBUG_PRINT(("mdb_env_set_mapsize(%p, %ld): %d\n", env, size, rc));
+    FFI_env_state *state;
+    int rc = env_enter(unwrap_env(fenv), &state);
+    if (rc)
+      return (int32_t)rc;
+    rc = ffi_env_grow(fenv, min_size, wait_ms, fsize);
+    env_leave(state);
     return (int32_t)rc;
   }
 
   /**
-   * @brief mdb_env_set_maxreaders wrapper
-   * NOTE: Must be called before ffi_env_open().
-   * */
-  int32_t ffi_env_set_maxreaders(uint8_t *fenv, uint32_t readers)
+   * @brief mdb_env_create wrapper
+   * @param[out] fenv FFI wrapper containing pointer to new MDB_env
+   * @return 0 on success, non-zero otherwise
+   */
+  int32_t ffi_env_create(uint8_t *fenv)
   {
-    MDB_env *env = unwrap_env(fenv);
-    int rc = mdb_env_set_maxreaders(env, (unsigned int)readers);
-    DEBUG_PRINT(("mdb_env_set_maxreaders(%p, %d): %d\n", env, readers, rc));
-    return (int32_t)rc;
+    MDB_env *env;
+    int rc = mdb_env_create(&env);
+    DEBUG_PRINT(("mdb_env_create(%p): %d\n", env, rc));
+    wrap_env(env, fenv);
+    return rc;
   }
 
   /**
-   * @brief mdb_env_get_maxreaders wrapper
-   * @param[in] fenv MDB_env wrapper
-   * @param[out] readers
+   * @brief mdb_env_open wrapper
+   *
+   * @param fenv MDB_env wrapper
+   * @param fpath MDB_val wrapper
+   * @param flags
+   * @param mode
+   * @return int32_t 0 on success, non-zero otherwise
    */
-  int32_t ffi_env_get_maxreaders(uint8_t *fenv, uint32_t *readers)
+  int32_t ffi_env_open(uint8_t *fenv, uint8_t *fpath, uint32_t flags, uint32_t mode)
   {
     MDB_env *env = unwrap_env(fenv);
-    unsigned int _readers;
-    int rc = mdb_env_get_maxreaders(env, &_readers);
-    DEBUG_PRINT(("mdb_env_get_maxreaders(%p, %d): %d\n", env, _readers, rc));
-    *readers = (uint32_t)_readers;
+    MDB_val path = unwrap_val(fpath);
+    CSTR_FROM_VAL(cpath, path);
+    int rc = mdb_env_open(env, cpath, (unsigned int)flags, (mdb_mode_t)mode);
+    DEBUG_PRINT(("mdb_env_open(%p, '%s', %d, 0%03o): %d\n", env, cpath, flags, mode, rc));
     return (int32_t)rc;
   }
 
   /**
-   * @brief mdb_env_set_maxdbs wrapper
-   * NOTE: Must be called before ffi_env_open()
-   */
-  int32_t ffi_env_set_maxdbs(uint8_t *fenv, uint32_t dbs)
+   * @brief mdb_env_copy wrapper */
+  int32_t ffi_env_copy(uint8_t *fenv, uint8_t *fpath)
   {
     MDB_env *env = unwrap_env(fenv);
-    int rc = mdb_env_set_maxdbs(env, (MDB_dbi)dbs);
-    DEBUG_PRINT(("mdb_env_set_maxdbs(%p, %d): %d\n", env, dbs, rc));
+    MDB_val path = unwrap_val(fpath);
+    CSTR_FROM_VAL(cpath, path);
+    FFI_env_state *state;
+    int rc = env_enter(env, &state);
+    if (rc)
+      return (int32_t)rc;
+    rc = mdb_env_copy(env, cpath);
+    env_leave(state);
+    DEBUG_PRINT(("mdb_env_copy(%p, '%s'): %d\n", env, cpath, rc));
     return (int32_t)rc;
   }
 
   /**
-   * @brief mdb_env_get_maxkeysize wrapper
-   * @param[in] fenv MDB_env wrapper
-   * @returns max keysize, in bytes
-   */
-  int32_t ffi_env_get_maxkeysize(uint8_t *fenv)
+   * @brief mdb_env_copyfd wrapper */
+  int32_t ffi_env_copyfd(uint8_t *fenv, int32_t fd)
   {
     MDB_env *env = unwrap_env(fenv);
-    int keysize = mdb_env_get_maxkeysize(env);
-    DEBUG_PRINT(("mdb_env_get_maxkeysize(%p): %d\n", env, keysize));
-    return (int32_t)keysize;
+    FFI_env_state *state;
+    int rc = env_enter(env, &state);
+    if (rc)
+      return (int32_t)rc;
+    rc = mdb_env_copyfd(env, (mdb_filehandle_t)fd);
+    env_leave(state);
+    DEBUG_PRINT(("mdb_env_copyfd(%p, %d): %d\n", env, fd, rc));
+    return (int32_t)rc;
   }
 
   /**
-   * @brief mdb_env_set_userctx wrapper
-   * @param[in] fenv MDB_env wrapper
-   * @param[in] ctx a user-defined object
-   */
-  int32_t ffi_env_set_userctx(uint8_t *fenv, void *ctx)
+   * @brief mdb_env_copy2 wrapper */
+  int32_t ffi_env_copy2(uint8_t *fenv, uint8_t *fpath, uint32_t flags)
   {
     MDB_env *env = unwrap_env(fenv);
-    int rc = mdb_env_set_userctx(env, ctx);
-    DEBUG_PRINT(("mdb_env_set_userctx(%p, %p): %d\n", env, ctx, rc));
+    MDB_val path = unwrap_val(fpath);
+    CSTR_FROM_VAL(cpath, path);
+    FFI_env_state *state;
+    int rc = env_enter(env, &state);
+    if (rc)
+      return (int32_t)rc;
+    rc = mdb_env_copy2(env, cpath, (unsigned int)flags);
+    env_leave(state);
+    DEBUG_PRINT(("mdb_env_copy2(%p, '%s', %d)\n", env, cpath, flags));
     return (int32_t)rc;
   }
 
   /**
-   * @brief mdb_env_get_userctx wrapper
-   * @param[in] fenv MDB_env wrapper
-   * @returns the ctx object passed into ffi_env_set_userctx()
-   */
-  void *ffi_env_get_userctx(uint8_t *fenv)
+   * @brief mdb_env_copyfd2 wrapper */
+  int32_t ffi_env_copyfd2(uint8_t *fenv, int32_t fd, uint32_t flags)
   {
     MDB_env *env = unwrap_env(fenv);
-    DEBUG_PRINT(("mdb_env_get_userctx(%p)\n", env));
-    return mdb_env_get_userctx(env);
+    FFI_env_state *state;
+    int rc = env_enter(env, &state);
+    if (rc)
+      return (int32_t)rc;
+    rc = mdb_env_copyfd2(env, (mdb_filehandle_t)fd, (unsigned int)flags);
+    env_leave(state);
+    DEBUG_PRINT(("mdb_env_copyfd2(%p, %d, %d): %d", env, fd, flags, rc));
+    return (int32_t)rc;
   }
 
-  ///////////////////////////////////////////////
-  // MDB_txn functions
-  ///////////////////////////////////////////////
+#define STAT_PSIZE 0
+#define STAT_DEPTH 1
+#define STAT_BRANCH_PAGES 2
+#define STAT_LEAF_PAGES 3
+#define STAT_OVERFLOW_PAGES 4
+#define STAT_ENTRIES 5
 
-  void wrap_txn(MDB_txn *txn, uint8_t *wrapper)
+  /** Serialize MDB_stat object src into dest */
+  void copy_stat(uint8_t *dest, MDB_stat *src)
   {
-    uint64_t addr = (uint64_t)txn;
-    memcpy(wrapper, &addr, sizeof(addr));
+    double psize = (double)src->ms_psize;
+    double depth = (double)src->ms_depth;
+    double branch_pages = (double)src->ms_branch_pages;
+    double leaf_pages = (double)src->ms_leaf_pages;
+    double overflow_pages = (double)src->ms_overflow_pages;
+    double entries = (double)src->ms_overflow_pages;
+    memcpy(dest + (STAT_PSIZE * sizedbl), &psize, sizedbl);
+    memcpy(dest + (STAT_DEPTH * sizedbl), &depth, sizedbl);
+    memcpy(dest + (STAT_BRANCH_PAGES * sizedbl), &branch_pages, sizedbl);
+    memcpy(dest + (STAT_LEAF_PAGES * sizedbl), &leaf_pages, sizedbl);
+    memcpy(dest + (STAT_OVERFLOW_PAGES * sizedbl), &overflow_pages, sizedbl);
+    memcpy(dest + (STAT_ENTRIES * sizedbl), &entries, sizedbl);
   }
 
-  MDB_txn *unwrap_txn(uint8_t *wrapper)
+  /**
+   * @brief mdb_env_stat wrapper
+   * @param[in] fenv MDB_env wrapper
+   * @param[out] fstat_dbl array of doubles containing MDB_stat data
+   */
+  int32_t ffi_env_stat(uint8_t *fenv, u_int8_t *fstat_dbl)
   {
-    uint64_t addr;
-    memcpy(&addr, wrapper, sizeof(addr));
-    return (MDB_txn *)addr;
+    MDB_env *env = unwrap_env(fenv);
+    MDB_stat stat;
+    int rc = mdb_env_stat(env, &stat);
+    DEBUG_PRINT(("mdb_env_stat(%p, %p): %d\n", env, &stat, rc));
+    copy_stat(fstat_dbl, &stat);
+    return (int32_t)rc;
   }
 
+#define INFO_MAPSIZE 0
+#define INFO_LAST_PGNO 1
+#define INFO_LAST_TXNID 2
+#define INFO_MAXREADERS 3
+#define INFO_NUMREADERS 4
+
   /**
-   * @brief mdb_txn_begin wrapper
+   * @brief mdb_env_info wrapper
    * @param[in] fenv MDB_env wrapper
-   * @param[in] fparent MDB_txn wrapper or NULL
-   * @param[in] flags
-   * @param[out] ftxn FFI wrapper containing pointer to new MDB_txn
-   * @returns 0 on success, non-zero otherwise
+   * @param[out] finfo_dbl array of doubles containing MDB_envinfo data
    */
-  int32_t ffi_txn_begin(uint8_t *fenv, uint8_t *fparent, uint32_t flags, uint8_t *ftxn)
+  int32_t ffi_env_info(uint8_t *fenv, u_int8_t *finfo_dbl)
   {
     MDB_env *env = unwrap_env(fenv);
-    MDB_txn *parent;
-    if (fparent)
-      parent = unwrap_txn(fparent);
-    else
-      parent = NULL;
-    MDB_txn *txn;
-    int rc = mdb_txn_begin(env, parent, (unsigned int)flags, &txn);
-    DEBUG_PRINT(("mdb_txn_begin(%p, %p, %d, %p): %d\n", env, parent, flags, txn, rc));
-    uint64_t txn_addr = (uint64_t)txn;
-    memcpy(ftxn, &txn_addr, sizeof(txn_addr));
+    MDB_envinfo info;
+    int rc = mdb_env_info(env, &info);
+    DEBUG_PRINT(("mdb_env_info(%p, %p): %d\n", env, &info, rc));
+    // Serialize info
+    double mapsize = (double)info.me_mapsize;
+    double last_pgno = (double)info.me_last_pgno;
+    double last_txnid = (double)info.me_last_txnid;
+    double maxreaders = (double)info.me_maxreaders;
+    double numreaders = (double)info.me_numreaders;
+    memcpy(finfo_dbl + (INFO_MAPSIZE * sizedbl), &mapsize, sizedbl);
+    memcpy(finfo_dbl + (INFO_LAST_PGNO * sizedbl), &last_pgno, sizedbl);
+    memcpy(finfo_dbl + (INFO_LAST_TXNID * sizedbl), &last_txnid, sizedbl);
+    memcpy(finfo_dbl + (INFO_MAXREADERS * sizedbl), &maxreaders, sizedbl);
+    memcpy(finfo_dbl + (INFO_NUMREADERS * sizedbl), &numreaders, sizedbl);
     return (int32_t)rc;
   }
 
+#define SYNC_FORCE 1
+#define SYNC_DONT_FORCE 0
+
   /**
-   * @brief mdb_txn_env wrapper
-   * @param[in] ftxn MDB_txn wrapper
-   * @returns address of MDB_env object, which must be wrapped.
-   */
-  uint64_t ffi_txn_env(uint8_t *ftxn)
+   * @brief mdb_env_sync wrapper */
+  int32_t ffi_env_sync(uint8_t *fenv, int32_t force)
   {
-    MDB_txn *txn = unwrap_txn(ftxn);
-    MDB_env *env = mdb_txn_env(txn);
-    DEBUG_PRINT(("mdb_txn_env(%p): %p\n", txn, env));
-    return (uint64_t)env;
+    MDB_env *env = unwrap_env(fenv);
+    int rc = mdb_env_sync(env, (int)force);
+    DEBUG_PRINT(("mdb_env_sync(%p, %d)\n", env, force));
+    return (int32_t)rc;
   }
 
   /**
-   * @brief mdb_txn_id wrapper
-   * @param[in] ftxn
-   * @returns id of wrapped MDB_txn
+   * @brief this method is intended to be bound with "nonblocking: true",
+   * so that disk sync can be offloaded to an asynchronous worker thread
+   * and resolve a promise when complete.
+   *
+   * @param fenv
+   * @return int32_t
    */
-  size_t ffi_txn_id(uint8_t *ftxn)
-  {
-    MDB_txn *txn = unwrap_txn(ftxn);
-    DEBUG_PRINT(("mdb_txn_id(%p)\n", txn));
-    return (size_t)mdb_txn_id(txn);
-  }
-
-  /**
-   * @brief mdb_txn_commit wrapper */
-  int32_t ffi_txn_commit(uint8_t *ftxn)
+  int32_t ffi_env_sync_force(uint8_t *fenv)
   {
-    MDB_txn *txn = unwrap_txn(ftxn);
-    int rc = mdb_txn_commit(txn);
-    DEBUG_PRINT(("mdb_txn_commit(%p): %d\n", txn, rc));
+    FFI_env_state *state;
+    int rc = env_enter(unwrap_env(fenv), &state);
+    if (rc)
+      return (int32_t)rc;
+    rc = ffi_env_sync(fenv, SYNC_FORCE);
+    env_leave(state);
     return (int32_t)rc;
   }
 
   /**
-   * @brief mdb_txn_abort wrapper */
-  void ffi_txn_abort(uint8_t *ftxn)
+   * @brief keep the data file allocated at least half a step ahead of
+   * the last used page, with state->mutex held.
+   *
+   * LMDB grows the file a page at a time as commits write past its end,
+   * which fragments it. Instead, whole steps are allocated ahead with
+   * fallocate, off the commit path (by the syncer and group commit).
+   * FALLOC_FL_KEEP_SIZE leaves the file size alone, so LMDB sees no
+   * difference.
+   */
+  int env_preallocate(FFI_env_state *state)
   {
-    MDB_txn *txn = unwrap_txn(ftxn);
-    mdb_txn_abort(txn);
-    DEBUG_PRINT(("mdb_txn_abort(%p)\n", txn));
+    size_t step = state->prealloc_step;
+    if (!step || state->preallocating)
+      return MDB_SUCCESS;
+    MDB_envinfo info;
+    MDB_stat stat;
+    int rc = mdb_env_info(state->env, &info);
+    if (!rc)
+      rc = mdb_env_stat(state->env, &stat);
+    if (rc)
+      return rc;
+    size_t used = (info.me_last_pgno + 1) * stat.ms_psize;
+    if (used + step / 2 <= state->prealloc_end)
+      return MDB_SUCCESS;
+    size_t end = (used / step + 2) * step;
+    if (end > info.me_mapsize)
+      end = info.me_mapsize;
+    if (end <= state->prealloc_end)
+      return MDB_SUCCESS;
+#ifdef FALLOC_FL_KEEP_SIZE
+    mdb_filehandle_t fd;
+    rc = mdb_env_get_fd(state->env, &fd);
+    if (rc)
+      return rc;
+    size_t start = state->prealloc_end;
+    state->preallocating = 1;
+    pthread_mutex_unlock(&state->mutex);
+    if (fallocate(fd, FALLOC_FL_KEEP_SIZE, (off_t)start, (off_t)(end - start)))
+      rc = errno;
+    pthread_mutex_lock(&state->mutex);
+    state->preallocating = 0;
+#else
+    rc = EOPNOTSUPP;
+#endif
+    if (!rc)
+      state->prealloc_end = end;
+    else if (rc == EOPNOTSUPP)
+      /* e.g. tmpfs: there is nothing to gain by trying again */
+      state->prealloc_step = 0;
+    DEBUG_PRINT(("env_preallocate(%p, %zu): %d\n", state->env, end, rc));
+    return rc;
   }
 
   /**
-   * @brief mdb_txn_reset wrapper */
-  void ffi_txn_reset(uint8_t *ftxn)
+   * @brief preallocate the data file of env in steps of step bytes, ahead
+   * of the last used page, from now on. Intended to be bound with
+   * "nonblocking: true", as it allocates the first step at once.
+   *
+   * @param fenv MDB_env wrapper
+   * @param step bytes per fallocate; 0 to stop preallocating
+   * @return int32_t 0 on success, EOPNOTSUPP if the filesystem does not
+   *         support it, non-zero otherwise
+   */
+  int32_t ffi_env_preallocate(uint8_t *fenv, double step)
   {
-    MDB_txn *txn = unwrap_txn(ftxn);
-    mdb_txn_reset(txn);
-    DEBUG_PRINT(("mdb_txn_reset(%p)\n", txn));
+    FFI_env_state *state;
+    int rc = env_enter(unwrap_env(fenv), &state);
+    if (rc)
+      return (int32_t)rc;
+    pthread_mutex_lock(&state->mutex);
+    state->prealloc_step = (size_t)step;
+    rc = env_preallocate(state);
+    pthread_mutex_unlock(&state->mutex);
+    env_leave(state);
+    return (int32_t)rc;
   }
 
+#define ALLOC_USED 0
+#define ALLOC_ALLOCATED 1
+#define ALLOC_FILE_SIZE 2
+
   /**
-   * @brief mdb_txn_renew wrapper */
-  uint32_t ffi_txn_renew(uint8_t *ftxn)
+   * @brief how much of the data file is used, allocated on disk, and
+   * reported as its size (which is sparse with MDB_WRITEMAP)
+   *
+   * @param fenv MDB_env wrapper
+   * @param[out] falloc bytes, indexed by ALLOC_USED, ALLOC_ALLOCATED and
+   *             ALLOC_FILE_SIZE
+   * @return int32_t 0 on success, non-zero otherwise
+   */
+  int32_t ffi_env_alloc_info(uint8_t *fenv, double *falloc)
   {
-    MDB_txn *txn = unwrap_txn(ftxn);
-    int rc = mdb_txn_renew(txn);
-    DEBUG_PRINT(("mdb_txn_renew(%p): %d\n", txn, rc));
-    return (uint32_t)rc;
+    MDB_env *env = unwrap_env(fenv);
+    MDB_envinfo info;
+    MDB_stat stat;
+    mdb_filehandle_t fd;
+    struct stat st;
+    int rc = mdb_env_info(env, &info);
+    if (!rc)
+      rc = mdb_env_stat(env, &stat);
+    if (!rc)
+      rc = mdb_env_get_fd(env, &fd);
+    if (!rc && fstat(fd, &st))
+      rc = errno;
+    if (rc)
+      return (int32_t)rc;
+    size_t used = (info.me_last_pgno + 1) * stat.ms_psize;
+    size_t allocated = (size_t)st.st_blocks * 512;
+    falloc[ALLOC_USED] = (double)used;
+    falloc[ALLOC_ALLOCATED] = (double)allocated;
+    falloc[ALLOC_FILE_SIZE] = (double)st.st_size;
+    return MDB_SUCCESS;
   }
 
-  ///////////////////////////////////////////////
-  // MDB_dbi functions
-  ///////////////////////////////////////////////
-
   /**
-   * @brief mdb_dbi_open wrapper
-   * @param[in] ftxn MDB_txn wrapper
-   * @param[in] fname MDB_val wrapper or null
-   * @param[in] flags
-   * @param[out] MDB_dbi handle
-   * @returns 0 on success, non-zero otherwise
+   * @brief sync env until every txn up to target is on disk, with
+   * state->mutex held.
+   *
+   * Concurrent callers share syncs: if a sync is already running, the
+   * caller waits for it, and only starts another if target was committed
+   * after that sync began. A single mdb_env_sync thus covers every txn
+   * committed, by any thread, before it started.
    */
-  int32_t ffi_dbi_open(uint8_t *ftxn,
-                       uint8_t *fname,
-                       uint32_t flags,
-                       uint32_t *dbi)
+  int env_sync_to(FFI_env_state *state, size_t target)
   {
-    MDB_txn *txn = unwrap_txn(ftxn);
-    const char *name;
-    if (fname)
+    int rc = MDB_SUCCESS;
+    while (__atomic_load_n(&state->durable_txnid, __ATOMIC_ACQUIRE) < target)
     {
-      MDB_val nameval = unwrap_val(fname);
-      CSTR_FROM_VAL(cname, nameval);
-      name = cname;
+      if (state->syncing)
+      {
+        if (state->closing)
+        {
+          rc = ECANCELED;
+          break;
+        }
+        pthread_cond_wait(&state->synced, &state->mutex);
+        continue;
+      }
+      state->syncing = 1;
+      pthread_mutex_unlock(&state->mutex);
+      /* everything committed so far is covered by this sync */
+      MDB_envinfo info;
+      rc = mdb_env_info(state->env, &info);
+      if (!rc)
+        rc = mdb_env_sync(state->env, SYNC_FORCE);
+      pthread_mutex_lock(&state->mutex);
+      state->syncing = 0;
+      if (!rc && info.me_last_txnid > state->durable_txnid)
+      {
+        __atomic_store_n(&state->durable_txnid, info.me_last_txnid,
+                         __ATOMIC_RELEASE);
+        state->synced_pgno = info.me_last_pgno;
+      }
+      pthread_cond_broadcast(&state->synced);
+      if (rc)
+        break;
     }
-    else
-      name = NULL;
-    MDB_dbi _dbi;
-    // DEBUG_PRINT comes before mdb_dbi_open() because name ptr gets redirected.
-    DEBUG_PRINT(("mdb_dbi_open(%p, '%s', 0x%x, %d):\n", txn, name, flags, _dbi));
-    int rc = mdb_dbi_open(txn, name, (unsigned int)flags, &_dbi);
-    *dbi = _dbi;
-    return (int32_t)rc;
+    return rc;
   }
 
   /**
-   * @brief mdb_stat wrapper
-   * @param[in] ftxn MDB_txn wrapper
-   * @param[in] dbi MDB_dbi handle
-   * @param[out] fstat_dbl array of doubles containing MDB_stat data
-   * @returns 0 on success, non-zero otherwise
+   * @brief group commit: wait until every txn committed before this call
+   * is on disk, sharing the sync with any concurrent callers.
+   * Intended to be bound with "nonblocking: true", and called right after
+   * a commit.
+   *
+   * @param fenv MDB_env wrapper
+   * @return int32_t 0 on success, non-zero otherwise
    */
-  int32_t ffi_stat(uint8_t *ftxn, uint32_t dbi, uint8_t *fstat_dbl)
+  int32_t ffi_env_sync_committed(uint8_t *fenv)
   {
-    MDB_txn *txn = unwrap_txn(ftxn);
-    MDB_stat stat;
-    int rc = mdb_stat(txn, (MDB_dbi)dbi, &stat);
-    DEBUG_PRINT(("mdb_stat(%p, %d, %p): %d\n", txn, dbi, &stat, rc));
-    copy_stat(fstat_dbl, &stat);
+    MDB_env *env = unwrap_env(fenv);
+    FFI_env_state *state;
+    int rc = env_enter(env, &state);
+    if (rc)
+      return (int32_t)rc;
+    MDB_envinfo info;
+    rc = mdb_env_info(env, &info);
+    pthread_mutex_lock(&state->mutex);
+    if (!rc)
+      rc = env_sync_to(state, info.me_last_txnid);
+    if (!rc)
+      /* only speeds up later commits, so it cannot fail this one */
+      env_preallocate(state);
+    pthread_mutex_unlock(&state->mutex);
+    env_leave(state);
+    DEBUG_PRINT(("ffi_env_sync_committed(%p, %zu): %d\n", env,
+                 info.me_last_txnid, rc));
     return (int32_t)rc;
   }
 
   /**
-   * @brief mdb_dbi_flags wrapper
-   * @param[in] ftxn MDB_txn wrapper
-   * @param[in] dbi MDB_dbi handle
-   * @param[out] flags
-   * @returns 0 on success, non-zero otherwise
+   * @brief wait until the txn with the given id is on disk, syncing if
+   * needed. Intended to be bound with "nonblocking: true".
+   *
+   * @param fenv MDB_env wrapper
+   * @param txnid id of a committed txn, from ffi_txn_id
+   * @return int32_t 0 on success, non-zero otherwise
    */
-  int32_t ffi_dbi_flags(uint8_t *ftxn, uint32_t dbi, uint32_t *flags)
+  int32_t ffi_env_wait_durable(uint8_t *fenv, double txnid)
   {
-    MDB_txn *txn = unwrap_txn(ftxn);
-    unsigned int _flags;
-    int rc = mdb_dbi_flags(txn, (MDB_dbi)dbi, &_flags);
-    DEBUG_PRINT(("mdb_dbi_flags(%p, %d, 0x%x): %d\n", txn, dbi, _flags, rc));
-    *flags = (uint32_t)_flags;
+    FFI_env_state *state;
+    int rc = env_enter(unwrap_env(fenv), &state);
+    if (rc)
+      return (int32_t)rc;
+    pthread_mutex_lock(&state->mutex);
+    rc = env_sync_to(state, (size_t)txnid);
+    pthread_mutex_unlock(&state->mutex);
+    env_leave(state);
     return (int32_t)rc;
   }
 
   /**
-   * @brief mdb_dbi_close wrapper */
-  void ffi_dbi_close(uint8_t *fenv, uint32_t dbi)
+   * @brief the durable txnid watermark: every txn up to it is on disk.
+   * @param fenv MDB_env wrapper
+   * @return double txnid, or 0 if nothing has been synced yet
+   */
+  double ffi_env_durable_txnid(uint8_t *fenv)
   {
-    MDB_env *env = unwrap_env(fenv);
-    mdb_dbi_close(env, (MDB_dbi)dbi);
-    DEBUG_PRINT(("mdb_dbi_close(%p, %d)\n", env, dbi));
+    FFI_env_state *state = env_state(unwrap_env(fenv));
+    if (!state)
+      return 0;
+    size_t durable = __atomic_load_n(&state->durable_txnid, __ATOMIC_ACQUIRE);
+    return (double)durable;
   }
 
-#define DROP_EMPTY 0
-#define DROP_DELETE 1
-  /**
-   * @brief mdb_drop wrapper */
-  int32_t ffi_drop(uint8_t *ftxn, uint32_t dbi, uint32_t del)
-  {
-    MDB_txn *txn = unwrap_txn(ftxn);
-    int rc = mdb_drop(txn, (MDB_dbi)dbi, (int)del);
-    DEBUG_PRINT(("mdb_drop(%p, %d): %d\n", txn, dbi, del));
-    return (int32_t)rc;
-  }
+  /** shortest sleep of the syncer, when polling the sync_bytes policy */
+#define SYNCER_POLL_MS 10
 
-  /**
-   * @brief mdb_get wrapper
-   * @param[in] ftxn MDB_txn wrapper
-   * @param[in] dbi MDB_dbi handle
-   * @param[in] fkey MDB_val wrapper
-   * @param[out] fdata MDB_val wrapper
-   * @returns 0 on success, non-zero otherwise
-   */
-  int32_t ffi_get(uint8_t *ftxn,
-                  uint32_t dbi,
-                  uint8_t *fkey,
-                  uint8_t *fdata)
+  static uint64_t now_ms()
   {
-    MDB_txn *txn = unwrap_txn(ftxn);
-    MDB_val key = unwrap_val(fkey);
-    MDB_val data = unwrap_val(fdata);
-    int rc = mdb_get(txn, (MDB_dbi)dbi, &key, &data);
-    DEBUG_PRINT(("mdb_get(%p, %d, %p, %p): %d\n",
-                 txn, dbi, key.mv_data, data.mv_data, rc));
-    wrap_val(data, fdata);
-    return (int32_t)rc;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
   }
 
-  /**
-   * @brief mdb_put wrapper
-   * @param[in] ftxn MDB_txn wrapper
-   * @param[in] dbi MDB_dbi handle
-   * @param[in] fkey MDB_val wrapper
-   * @param[in,out] fdata MDV_val wrapper
-   * @param[in] flags
-   * @returns 0 on success, non-zero otherwise
-   */
-  int32_t ffi_put(uint8_t *ftxn,
-                  uint32_t dbi,
-                  uint8_t *fkey,
-                  uint8_t *fdata,
-                  uint32_t flags)
+  void *env_syncer(void *arg)
   {
-    MDB_txn *txn = unwrap_txn(ftxn);
-    MDB_val key = unwrap_val(fkey);
-    MDB_val data = unwrap_val(fdata);
-#if DEBUG
-    CSTR_FROM_VAL(ckey, key);
-    CSTR_FROM_VAL(cdata, data);
-    DEBUG_PRINT(("ffi_put: key='%s', data='%s'\n", ckey, cdata));
-#endif
-    int rc = mdb_put(txn, (MDB_dbi)dbi, &key, &data, (unsigned int)flags);
-    DEBUG_PRINT(("mdb_put(%p, %d, %p, %p): %d\n",
-                 txn, dbi, key.mv_data, data.mv_data, rc));
-    wrap_val(key, fkey);
-    wrap_val(data, fdata);
-    return (int32_t)rc;
+    FFI_env_state *state = (FFI_env_state *)arg;
+    MDB_stat stat;
+    size_t psize = mdb_env_stat(state->env, &stat) ? 4096 : stat.ms_psize;
+    uint64_t last_sync = now_ms();
+    pthread_mutex_lock(&state->mutex);
+    while (!state->syncer_stop)
+    {
+      uint32_t tick = state->sync_interval_ms;
+      if (!tick || (state->sync_bytes && tick > SYNCER_POLL_MS))
+        tick = SYNCER_POLL_MS;
+      if (!state->sync_requested)
+      {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += tick / 1000;
+        deadline.tv_nsec += (long)(tick % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+          deadline.tv_sec++;
+          deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&state->wake, &state->mutex, &deadline);
+      }
+      if (state->syncer_stop)
+        break;
+      /* failures are retried on the next tick */
+      env_preallocate(state);
+      MDB_envinfo info;
+      if (mdb_env_info(state->env, &info))
+        continue;
+      uint64_t now = now_ms();
+      int due = state->sync_requested ||
+                (state->sync_interval_ms &&
+                 now - last_sync >= state->sync_interval_ms) ||
+                (state->sync_bytes &&
+                 (info.me_last_pgno - state->synced_pgno) * psize >=
+                     state->sync_bytes);
+      state->sync_requested = 0;
+      if (!due)
+        continue;
+      last_sync = now;
+      /* a failed sync is retried on the next tick, and reported to
+       * anyone waiting on the txn by their own attempt */
+      env_sync_to(state, info.me_last_txnid);
+      DEBUG_PRINT(("env_syncer(%p): %zu\n", state->env, info.me_last_txnid));
+    }
+    pthread_mutex_unlock(&state->mutex);
+    return NULL;
   }
 
   /**
-   * @brief mdb_del wrapper */
-  int32_t ffi_del(uint8_t *ftxn,
-                  uint32_t dbi,
-                  uint8_t *fkey,
-                  uint8_t *fdata)
+   * @brief start a background thread which syncs env to disk, so that
+   * commits need not wait for an fsync of their own.
+   *
+   * It syncs every interval_ms, whenever at least sync_bytes have been
+   * added to the map since the last sync, and on ffi_env_sync_request.
+   * LMDB does not expose the number of dirty pages, so the byte policy
+   * tracks growth of the last used page, which misses pages reused from
+   * the freelist; pair it with an interval for a firm bound.
+   *
+   * @param fenv MDB_env wrapper
+   * @param interval_ms 0 for no periodic sync
+   * @param sync_bytes 0 for no size-based sync
+   * @return int32_t 0 on success, non-zero otherwise
+   */
+  int32_t ffi_env_syncer_start(uint8_t *fenv,
+                               uint32_t interval_ms,
+                               size_t sync_bytes)
   {
-    MDB_txn *txn = unwrap_txn(ftxn);
-    MDB_val key = unwrap_val(fkey);
-    int rc;
-    if (fdata)
+    FFI_env_state *state = env_state(unwrap_env(fenv));
+    if (!state)
+      return ENOMEM;
+    int rc = MDB_SUCCESS;
+    pthread_mutex_lock(&state->mutex);
+    state->sync_interval_ms = interval_ms;
+    state->sync_bytes = sync_bytes;
+    if (!state->syncer_running)
     {
-      MDB_val data = unwrap_val(fdata);
-      rc = mdb_del(txn, (MDB_dbi)dbi, &key, &data);
-      DEBUG_PRINT(("mdb_del(%p, %d, %p, %p): %d\n",
-                   txn, dbi, key.mv_data, data.mv_data, rc));
+      state->syncer_stop = 0;
+      rc = pthread_create(&state->syncer, NULL, env_syncer, state);
+      state->syncer_running = !rc;
     }
     else
-    {
-      rc = mdb_del(txn, (MDB_dbi)dbi, &key, NULL);
-      DEBUG_PRINT(("mdb_del(%p, %d, %p, %p): %d\n",
-                   txn, dbi, key.mv_data, NULL, rc));
-    }
+      pthread_cond_signal(&state->wake);
+    pthread_mutex_unlock(&state->mutex);
+    DEBUG_PRINT(("ffi_env_syncer_start(%p, %u, %zu): %d\n", state->env,
+                 interval_ms, sync_bytes, rc));
     return (int32_t)rc;
   }
 
-  ///////////////////////////////////////////////
-  // MDB_cursor functions
-  ///////////////////////////////////////////////
+  /**
+   * @brief ask the background syncer to sync as soon as possible,
+   * without waiting for it.
+   */
+  void ffi_env_sync_request(uint8_t *fenv)
+  {
+    FFI_env_state *state = env_state(unwrap_env(fenv));
+    if (!state)
+      return;
+    pthread_mutex_lock(&state->mutex);
+    state->sync_requested = 1;
+    pthread_cond_signal(&state->wake);
+    pthread_mutex_unlock(&state->mutex);
+  }
 
-  void wrap_cursor(MDB_cursor *cursor, uint8_t *wrapper)
+  /** @brief stop the background syncer, if running, and wait for it */
+  void ffi_env_syncer_stop(uint8_t *fenv)
   {
-    uint64_t addr = (uint64_t)cursor;
-    memcpy(wrapper, &addr, sizeof(addr));
+    FFI_env_state *state = env_state(unwrap_env(fenv));
+    if (!state)
+      return;
+    pthread_mutex_lock(&state->mutex);
+    int running = state->syncer_running;
+    state->syncer_stop = 1;
+    state->syncer_running = 0;
+    pthread_cond_signal(&state->wake);
+    pthread_mutex_unlock(&state->mutex);
+    if (running)
+      pthread_join(state->syncer, NULL);
   }
 
-  MDB_cursor *unwrap_cursor(uint8_t *wrapper)
+  /* defined with the native writer, below */
+  void ffi_writer_stop(uint8_t *fenv);
+
+  /**
+   * @brief mdb_env_close wrapper. First fails whatever waits on the
+   * write gate or a sync of env with ECANCELED, the native writer
+   * included, stops the writer and syncer, and waits for pool requests
+   * and nonblocking calls on env to finish. */
+  void ffi_env_close(uint8_t *fenv)
   {
-    uint64_t addr;
-    memcpy(&addr, wrapper, sizeof(addr));
-    return (MDB_cursor *)addr;
+    MDB_env *env = unwrap_env(fenv);
+    env_closing(env);
+    ffi_writer_stop(fenv);
+    ffi_env_syncer_stop(fenv);
+    env_drain(env);
+    env_sweep(env, SWEEP_ALL | SWEEP_CLOSE);
+    mdb_env_close(env);
+    env_state_free(env);
+    DEBUG_PRINT(("mdb_env_close(%p)\n", env));
   }
 
   /**
-   * @brief mdb_cursor_open wrapper
-   *
-   * @param[in] ftxn MDB_txn wrapper
-   * @param[in] dbi MDB_dbi handle
-   * @param[out] fcursor FFI wrapper for new MDB_cursor
-   * @return int32_t 0 on success, non-zero otherwise
-   */
-  int32_t ffi_cursor_open(uint8_t *ftxn, uint32_t dbi, uint8_t *fcursor)
+   * @brief mdb_env_set_flags wrapper */
+  int32_t ffi_env_set_flags(uint8_t *fenv, uint32_t flags, int32_t onoff)
   {
-    MDB_txn *txn = unwrap_txn(ftxn);
-    MDB_cursor *cursor;
-    int rc = mdb_cursor_open(txn, dbi, &cursor);
-    DEBUG_PRINT(("mdb_cursor_open(%p, %d, %p): %d\n", txn, dbi, cursor, rc));
-    wrap_cursor(cursor, fcursor);
+    MDB_env *env = unwrap_env(fenv);
+    int rc = mdb_env_set_flags(env, (unsigned int)flags, (int)onoff);
+    DEBUG_PRINT(("mdb_env_set_flags(%p, 0x%x, %d): %d\n", env, flags, onoff, rc));
     return (int32_t)rc;
   }
 
   /**
-   * @brief mdb_cursor_close wrapper
-   *
-   * @param fcursor
+   * @brief mdb_env_get_flags wrapper
+   * @param[in] fenv MDB_env wrapper
+   * @param[out] flags
    */
-  void ffi_cursor_close(uint8_t *fcursor)
+  int32_t ffi_env_get_flags(uint8_t *fenv, uint32_t *flags)
   {
-    MDB_cursor *cursor = unwrap_cursor(fcursor);
-    mdb_cursor_close(cursor);
-    DEBUG_PRINT(("mdb_cursor_close(%p)\n", cursor));
+    MDB_env *env = unwrap_env(fenv);
+    unsigned int _flags;
+    int rc = mdb_env_get_flags(env, &_flags);
+    DEBUG_PRINT(("mdb_env_get_flags(%p, 0x%x): %d\n", env, _flags, rc));
+    *flags = (uint32_t)_flags;
+    return (int32_t)rc;
   }
 
   /**
-   * @brief mdb_cursor_renew wrapper
-   *
-   * @param ftxn
-   * @param fcursor
-   * @return int32_t
+   * @brief mdb_env_get_path wrapper
+   * @param[in] fenv MDB_env wrapper
+   * @param[out] fpath MDB_val wrapper
    */
-  int32_t ffi_cursor_renew(uint8_t *ftxn, uint8_t *fcursor)
+  int32_t ffi_env_get_path(uint8_t *fenv, uint8_t *fpath)
   {
-    MDB_txn *txn = unwrap_txn(ftxn);
-    MDB_cursor *cursor = unwrap_cursor(fcursor);
-    int rc = mdb_cursor_renew(txn, cursor);
-    DEBUG_PRINT(("mdb_cursor_renew(%p, %p): %d\n", txn, cursor, rc));
+    MDB_env *env = unwrap_env(fenv);
+    char *cpath;
+    int rc = mdb_env_get_path(env, (const char **)&cpath);
+    DEBUG_PRINT(("mdb_env_get_path(%p, '%s'): %d\n", env, cpath, rc));
+    MDB_val path;
+    path.mv_size = strlen(cpath);
+    path.mv_data = cpath;
+    wrap_val(path, fpath);
     return (int32_t)rc;
   }
 
   /**
-   * @brief mdb_cursor_txn wrapper
-   *
-   * @param fcursor
-   * @return uint64_t
+   * @brief mdb_env_get_fd wrapper
+   * @param[in] fenv MDB_env wrapper
+   * @param[out] fd file descriptor
    */
-  uint64_t ffi_cursor_txn(uint8_t *fcursor)
+  int32_t ffi_env_get_fd(uint8_t *fenv, int32_t *fd)
   {
-    MDB_cursor *cursor = unwrap_cursor(fcursor);
-    MDB_txn *txn = mdb_cursor_txn(cursor);
-    DEBUG_PRINT(("mdb_cursor_txn(%p): %p\n", cursor, txn));
-    return (uint64_t)txn;
+    MDB_env *env = unwrap_env(fenv);
+    int rc = mdb_env_get_fd(env, fd);
+    DEBUG_PRINT(("mdb_env_get_fd(%p, %d): %d\n", env, *fd, rc));
+    return (int32_t)rc;
   }
 
   /**
-   * @brief mdb_cursor_dbi wrapper
-   *
-   * @param fcursor
-   * @return uint32_t
+   * @brief mdb_env_get_map wrapper
+   * @param[in] fenv MDB_env wrapper
+   * @param[out] fmap MDB_val wrapper for the whole memory map
    */
-  uint32_t ffi_cursor_dbi(uint8_t *fcursor)
+  int32_t ffi_env_map(uint8_t *fenv, uint8_t *fmap)
   {
-    MDB_cursor *cursor = unwrap_cursor(fcursor);
-    MDB_dbi dbi = mdb_cursor_dbi(cursor);
-    DEBUG_PRINT(("mdb_cursor_dbi(%p): %d\n", cursor, dbi));
-    return (uint32_t)dbi;
+    MDB_env *env = unwrap_env(fenv);
+    MDB_val map;
+    mdb_size_t size;
+    int rc = mdb_env_get_map(env, &map.mv_data, &size);
+    DEBUG_PRINT(("mdb_env_get_map(%p, %p, %ld): %d\n", env, map.mv_data, size, rc));
+    if (rc)
+      return (int32_t)rc;
+    map.mv_size = (size_t)size;
+    wrap_val(map, fmap);
+    return MDB_SUCCESS;
+  }
+
+  /**
+   * @brief mdb_env_set_mapsize wrapper */
+  int32_t ffi_env_set_mapsize(uint8_t *fenv, uint64_t size)
+  {
+    MDB_env *env = unwrap_env(fenv);
+    int rc = mdb_env_set_mapsize(env, (mdb_size_t)size);
+    DEBUG_PRINT(("mdb_env_set_mapsize(%p, %ld): %d\n", env, size, rc));
+    if (!rc)
+      map_replaced(env);
+    return (int32_t)rc;
+  }
+
+  /**
+   * @brief mdb_env_set_flush_threads wrapper */
+  int32_t ffi_env_set_flush_threads(uint8_t *fenv, uint32_t threads)
+  {
+    MDB_env *env = unwrap_env(fenv);
+    int rc = mdb_env_set_flush_threads(env, (unsigned int)threads);
+    DEBUG_PRINT(("mdb_env_set_flush_threads(%p, %d): %d\n", env, threads, rc));
+    return (int32_t)rc;
+  }
+
+  /**
+   * @brief mdb_env_set_maxreaders wrapper
+   * NOTE: Must be called before ffi_env_open().
+   * */
+  int32_t ffi_env_set_maxreaders(uint8_t *fenv, uint32_t readers)
+  {
+    MDB_env *env = unwrap_env(fenv);
+    int rc = mdb_env_set_maxreaders(env, (unsigned int)readers);
+    DEBUG_PRINT(("mdb_env_set_maxreaders(%p, %d): %d\n", env, readers, rc));
+    return (int32_t)rc;
+  }
+
+  /**
+   * @brief mdb_env_get_maxreaders wrapper
+   * @param[in] fenv MDB_env wrapper
+   * @param[out] readers
+   */
+  int32_t ffi_env_get_maxreaders(uint8_t *fenv, uint32_t *readers)
+  {
+    MDB_env *env = unwrap_env(fenv);
+    unsigned int _readers;
+    int rc = mdb_env_get_maxreaders(env, &_readers);
+    DEBUG_PRINT(("mdb_env_get_maxreaders(%p, %d): %d\n", env, _readers, rc));
+    *readers = (uint32_t)_readers;
+    return (int32_t)rc;
+  }
+
+  /**
+   * @brief mdb_env_set_maxdbs wrapper
+   * NOTE: Must be called before ffi_env_open()
+   */
+  int32_t ffi_env_set_maxdbs(uint8_t *fenv, uint32_t dbs)
+  {
+    MDB_env *env = unwrap_env(fenv);
+    int rc = mdb_env_set_maxdbs(env, (MDB_dbi)dbs);
+    DEBUG_PRINT(("mdb_env_set_maxdbs(%p, %d): %d\n", env, dbs, rc));
+    return (int32_t)rc;
+  }
+
+  /**
+   * @brief mdb_env_get_maxkeysize wrapper
+   * @param[in] fenv MDB_env wrapper
+   * @returns max keysize, in bytes
+   */
+  int32_t ffi_env_get_maxkeysize(uint8_t *fenv)
+  {
+    MDB_env *env = unwrap_env(fenv);
+    int keysize = mdb_env_get_maxkeysize(env);
+    DEBUG_PRINT(("mdb_env_get_maxkeysize(%p): %d\n", env, keysize));
+    return (int32_t)keysize;
+  }
+
+  /**
+   * @brief mdb_env_set_userctx wrapper
+   * @param[in] fenv MDB_env wrapper
+   * @param[in] ctx a user-defined object
+   */
+  int32_t ffi_env_set_userctx(uint8_t *fenv, void *ctx)
+  {
+    MDB_env *env = unwrap_env(fenv);
+    int rc = mdb_env_set_userctx(env, ctx);
+    DEBUG_PRINT(("mdb_env_set_userctx(%p, %p): %d\n", env, ctx, rc));
+    return (int32_t)rc;
+  }
+
+  /**
+   * @brief mdb_env_get_userctx wrapper
+   * @param[in] fenv MDB_env wrapper
+   * @returns the ctx object passed into ffi_env_set_userctx()
+   */
+  void *ffi_env_get_userctx(uint8_t *fenv)
+  {
+    MDB_env *env = unwrap_env(fenv);
+    DEBUG_PRINT(("mdb_env_get_userctx(%p)\n", env));
+    return mdb_env_get_userctx(env);
+  }
+
+  ///////////////////////////////////////////////
+  // MDB_txn functions
+  ///////////////////////////////////////////////
+
+  /**
+   * @brief mdb_txn_begin wrapper
+   * @param[in] fenv MDB_env wrapper
+   * @param[in] hparent MDB_txn handle or 0
+   * @param[in] flags
+   * @param[out] htxn handle of the new MDB_txn
+   * @returns 0 on success, non-zero otherwise
+   */
+  int txn_begin(MDB_env *env, uint32_t hparent, uint32_t flags,
+                uint32_t *htxn, int gate)
+  {
+    MDB_txn *parent = NULL;
+    if (hparent && !(parent = unwrap_txn(hparent)))
+      return EINVAL;
+    int gated = !parent && !(flags & MDB_RDONLY);
+    int rc = gated ? write_gate_enter(env, gate) : MDB_SUCCESS;
+    if (rc)
+      return rc;
+    if (!parent && (rc = txn_activate(env)))
+    {
+      if (gated)
+        write_gate_leave(env);
+      return rc;
+    }
+    MDB_txn *txn;
+    rc = mdb_txn_begin(env, parent, (unsigned int)flags, &txn);
+    DEBUG_PRINT(("mdb_txn_begin(%p, %p, %d, %p): %d\n", env, parent, flags, txn, rc));
+    if (!rc && !(*htxn = handle_new(txn, env, HANDLE_TXN, hparent,
+                                    flags & MDB_RDONLY)))
+    {
+      mdb_txn_abort(txn);
+      rc = ENOMEM;
+    }
+    if (rc && !parent)
+      txn_deactivate(env);
+    if (rc && gated)
+      write_gate_leave(env);
+    return rc;
+  }
+
+  int32_t ffi_txn_begin(uint8_t *fenv, uint32_t hparent, uint32_t flags, uint32_t *htxn)
+  {
+    return (int32_t)txn_begin(unwrap_env(fenv), hparent, flags, htxn,
+                              GATE_WAIT);
+  }
+
+  /**
+   * @brief begin a top-level txn, or fail with EBUSY rather than wait if
+   * it is a write txn and another thread of this process is writing.
+   *
+   * @param[in] fenv MDB_env wrapper
+   * @param[in] flags
+   * @param[out] htxn handle of the new MDB_txn
+   * @returns 0 on success, EBUSY if the write gate is taken, non-zero
+   *          otherwise
+   */
+  int32_t ffi_txn_try_begin(uint8_t *fenv, uint32_t flags, uint32_t *htxn)
+  {
+    return (int32_t)txn_begin(unwrap_env(fenv), 0, flags, htxn, GATE_TRY);
+  }
+
+  /**
+   * @brief begin a top-level write txn after ffi_write_gate_wait; the txn
+   * takes over the gate, which is left if it cannot begin.
+   *
+   * @param[in] fenv MDB_env wrapper
+   * @param[in] flags
+   * @param[out] htxn handle of the new MDB_txn
+   * @returns 0 on success, non-zero otherwise
+   */
+  int32_t ffi_txn_begin_entered(uint8_t *fenv, uint32_t flags, uint32_t *htxn)
+  {
+    return (int32_t)txn_begin(unwrap_env(fenv), 0, flags & ~MDB_RDONLY,
+                              htxn, GATE_ENTERED);
+  }
+
+  /** @brief the env whose write gate htxn holds, if it is a top-level
+   *  write txn, to be left once it ends */
+  MDB_env *txn_gated_env(uint32_t htxn)
+  {
+    FFI_slot *slot = handle_get(htxn, HANDLE_TXN);
+    if (!slot || slot->owner || (slot->flags & MDB_RDONLY))
+      return NULL;
+    return slot->env;
+  }
+
+  /**
+   * @brief mdb_txn_env wrapper
+   * @param[in] htxn MDB_txn handle
+   * @returns address of MDB_env object, which must be wrapped.
+   */
+  uint64_t ffi_txn_env(uint32_t htxn)
+  {
+    MDB_txn *txn = unwrap_txn(htxn);
+    if (!txn)
+      return 0;
+    MDB_env *env = mdb_txn_env(txn);
+    DEBUG_PRINT(("mdb_txn_env(%p): %p\n", txn, env));
+    return (uint64_t)env;
+  }
+
+  /**
+   * @brief mdb_txn_id wrapper
+   * @param[in] htxn
+   * @returns id of the MDB_txn, or 0 if htxn is stale
+   */
+  size_t ffi_txn_id(uint32_t htxn)
+  {
+    MDB_txn *txn = unwrap_txn(htxn);
+    if (!txn)
+      return 0;
+    DEBUG_PRINT(("mdb_txn_id(%p)\n", txn));
+    return (size_t)mdb_txn_id(txn);
+  }
+
+  /**
+   * @brief mdb_txn_commit wrapper */
+  int32_t ffi_txn_commit(uint32_t htxn)
+  {
+    MDB_txn *txn = unwrap_txn(htxn);
+    if (!txn)
+      return EINVAL;
+    MDB_env *gated_env = txn_gated_env(htxn);
+    MDB_env *active_env = txn_retire(htxn);
+    int rc = mdb_txn_commit(txn);
+    handle_free(htxn);
+    if (gated_env)
+      write_gate_leave(gated_env);
+    if (active_env)
+      txn_deactivate(active_env);
+    DEBUG_PRINT(("mdb_txn_commit(%p): %d\n", txn, rc));
+    return (int32_t)rc;
+  }
+
+  /**
+   * @brief mdb_txn_abort wrapper */
+  void ffi_txn_abort(uint32_t htxn)
+  {
+    MDB_txn *txn = unwrap_txn(htxn);
+    if (!txn)
+      return;
+    MDB_env *gated_env = txn_gated_env(htxn);
+    MDB_env *active_env = txn_retire(htxn);
+    mdb_txn_abort(txn);
+    handle_free(htxn);
+    if (gated_env)
+      write_gate_leave(gated_env);
+    if (active_env)
+      txn_deactivate(active_env);
+    DEBUG_PRINT(("mdb_txn_abort(%p)\n", txn));
+  }
+
+  /**
+   * @brief mdb_txn_reset wrapper */
+  void ffi_txn_reset(uint32_t htxn)
+  {
+    MDB_txn *txn = unwrap_txn(htxn);
+    if (!txn)
+      return;
+    MDB_env *active_env = txn_retire(htxn);
+    if (active_env)
+    {
+      mdb_txn_reset(txn);
+      txn_deactivate(active_env);
+    }
+    DEBUG_PRINT(("mdb_txn_reset(%p)\n", txn));
+  }
+
+  /**
+   * @brief mdb_txn_renew wrapper */
+  uint32_t ffi_txn_renew(uint32_t htxn)
+  {
+    MDB_txn *txn = unwrap_txn(htxn);
+    if (!txn)
+      return EINVAL;
+    FFI_slot *slot = handle_get(htxn, HANDLE_TXN);
+    int reset = slot->flags & TXN_RESET;
+    int rc = reset ? txn_activate(slot->env) : MDB_SUCCESS;
+    if (rc)
+      return (uint32_t)rc;
+    rc = mdb_txn_renew(txn);
+    if (reset && rc)
+      txn_deactivate(slot->env);
+    else if (reset)
+      slot->flags &= ~TXN_RESET;
+    DEBUG_PRINT(("mdb_txn_renew(%p): %d\n", txn, rc));
+    return (uint32_t)rc;
+  }
+
+  /**
+   * @brief renew a read-only txn if its snapshot is too far behind
+   *
+   * Resets and renews the txn if more than max_lag write txns have been
+   * committed since its snapshot was taken, so that a pooled read txn can
+   * be reused without beginning a new one for every read.
+   *
+   * @param[in] htxn read-only MDB_txn handle
+   * @param[in] max_lag number of commits the snapshot may fall behind
+   * @param[out] renewed set to 1 if the txn was renewed, 0 otherwise
+   * @return int32_t 0 on success, non-zero otherwise, in which case the txn
+   *                 may be left reset, and should be aborted
+   */
+  int32_t ffi_txn_refresh(uint32_t htxn, uint32_t max_lag, uint32_t *renewed)
+  {
+    *renewed = 0;
+    MDB_txn *txn = unwrap_txn(htxn);
+    if (!txn)
+      return EINVAL;
+    MDB_envinfo info;
+    int rc = mdb_env_info(mdb_txn_env(txn), &info);
+    if (rc)
+      return rc;
+    if (info.me_last_txnid - mdb_txn_id(txn) <= max_lag)
+      return MDB_SUCCESS;
+    mdb_txn_reset(txn);
+    rc = mdb_txn_renew(txn);
+    *renewed = !rc;
+    DEBUG_PRINT(("ffi_txn_refresh(%p, %u): %d\n", txn, max_lag, rc));
+    return rc;
+  }
+  /**
+   * @brief park an idle read-only txn, which JS keeps for reuse. It stays
+   * active, but a resize of the map (see ffi_env_grow) may reset it rather
+   * than wait for it to end. It must not be used until ffi_txn_unpark,
+   * other than to be aborted.
+   *
+   * @param[in] htxn top-level read-only MDB_txn handle
+   * @return int32_t 0 on success, non-zero otherwise
+   */
+  int32_t ffi_txn_park(uint32_t htxn)
+  {
+    int rc = EINVAL;
+    pthread_mutex_lock(&handle_mutex);
+    FFI_slot *slot = handle_live(htxn);
+    if (slot && slot->type == HANDLE_TXN && !slot->owner &&
+        (slot->flags & MDB_RDONLY))
+    {
+      slot->flags |= TXN_PARKED;
+      rc = MDB_SUCCESS;
+    }
+    pthread_mutex_unlock(&handle_mutex);
+    DEBUG_PRINT(("ffi_txn_park(%d): %d\n", htxn, rc));
+    return (int32_t)rc;
+  }
+
+  /**
+   * @brief take back a txn parked by ffi_txn_park. If a resize reset it
+   * meanwhile, it is renewed; otherwise it is refreshed as by
+   * ffi_txn_refresh.
+   *
+   * @param[in] htxn parked MDB_txn handle
+   * @param[in] max_lag number of commits the snapshot may fall behind
+   * @param[out] renewed set to 1 if the txn was renewed, 0 otherwise
+   * @return int32_t 0 on success, non-zero otherwise, in which case the txn
+   *                 should be aborted
+   */
+  int32_t ffi_txn_unpark(uint32_t htxn, uint32_t max_lag, uint32_t *renewed)
+  {
+    *renewed = 0;
+    int reset = 0;
+    pthread_mutex_lock(&handle_mutex);
+    FFI_slot *slot = handle_live(htxn);
+    if (slot && slot->type == HANDLE_TXN)
+    {
+      reset = slot->flags & TXN_RESET;
+      slot->flags &= ~TXN_PARKED;
+    }
+    pthread_mutex_unlock(&handle_mutex);
+    if (!slot)
+      return EINVAL;
+    if (!reset)
+      return ffi_txn_refresh(htxn, max_lag, renewed);
+    int rc = ffi_txn_renew(htxn);
+    *renewed = !rc;
+    DEBUG_PRINT(("ffi_txn_unpark(%d): %d\n", htxn, rc));
+    return (int32_t)rc;
+  }
+
+
+  ///////////////////////////////////////////////
+  // MDB_dbi functions
+  ///////////////////////////////////////////////
+
+  /**
+   * @brief mdb_dbi_open wrapper
+   * @param[in] htxn MDB_txn handle
+   * @param[in] fname MDB_val wrapper or null
+   * @param[in] flags
+   * @param[out] MDB_dbi handle
+   * @returns 0 on success, non-zero otherwise
+   */
+  int32_t ffi_dbi_open(uint32_t htxn,
+                       uint8_t *fname,
+                       uint32_t flags,
+                       uint32_t *dbi)
+  {
+    MDB_txn *txn = unwrap_txn(htxn);
+    if (!txn)
+      return EINVAL;
+    const char *name;
+    if (fname)
+    {
+      MDB_val nameval = unwrap_val(fname);
+      CSTR_FROM_VAL(cname, nameval);
+      name = cname;
+    }
+    else
+      name = NULL;
+    MDB_dbi _dbi;
+    // DEBUG_PRINT comes before mdb_dbi_open() because name ptr gets redirected.
+    DEBUG_PRINT(("mdb_dbi_open(%p, '%s', 0x%x, %d):\n", txn, name, flags, _dbi));
+    int rc = mdb_dbi_open(txn, name, (unsigned int)flags, &_dbi);
+    *dbi = _dbi;
+    return (int32_t)rc;
+  }
+
+  /**
+   * @brief mdb_stat wrapper
+   * @param[in] htxn MDB_txn handle
+   * @param[in] dbi MDB_dbi handle
+   * @param[out] fstat_dbl array of doubles containing MDB_stat data
+   * @returns 0 on success, non-zero otherwise
+   */
+  int32_t ffi_stat(uint32_t htxn, uint32_t dbi, uint8_t *fstat_dbl)
+  {
+    MDB_txn *txn = unwrap_txn(htxn);
+    if (!txn)
+      return EINVAL;
+    MDB_stat stat;
+    int rc = mdb_stat(txn, (MDB_dbi)dbi, &stat);
+    DEBUG_PRINT(("mdb_stat(%p, %d, %p): %d\n", txn, dbi, &stat, rc));
+    copy_stat(fstat_dbl, &stat);
+    return (int32_t)rc;
+  }
+
+  /**
+   * @brief mdb_dbi_flags wrapper
+   * @param[in] htxn MDB_txn handle
+   * @param[in] dbi MDB_dbi handle
+   * @param[out] flags
+   * @returns 0 on success, non-zero otherwise
+   */
+  int32_t ffi_dbi_flags(uint32_t htxn, uint32_t dbi, uint32_t *flags)
+  {
+    MDB_txn *txn = unwrap_txn(htxn);
+    if (!txn)
+      return EINVAL;
+    unsigned int _flags;
+    int rc = mdb_dbi_flags(txn, (MDB_dbi)dbi, &_flags);
+    DEBUG_PRINT(("mdb_dbi_flags(%p, %d, 0x%x): %d\n", txn, dbi, _flags, rc));
+    *flags = (uint32_t)_flags;
+    return (int32_t)rc;
+  }
+
+  /**
+   * @brief mdb_dbi_close wrapper */
+  void ffi_dbi_close(uint8_t *fenv, uint32_t dbi)
+  {
+    MDB_env *env = unwrap_env(fenv);
+    mdb_dbi_close(env, (MDB_dbi)dbi);
+    DEBUG_PRINT(("mdb_dbi_close(%p, %d)\n", env, dbi));
+  }
+
+#define DROP_EMPTY 0
+#define DROP_DELETE 1
+  /**
+   * @brief mdb_drop wrapper */
+  int32_t ffi_drop(uint32_t htxn, uint32_t dbi, uint32_t del)
+  {
+    MDB_txn *txn = unwrap_txn(htxn);
+    if (!txn)
+      return EINVAL;
+    int rc = mdb_drop(txn, (MDB_dbi)dbi, (int)del);
+    DEBUG_PRINT(("mdb_drop(%p, %d): %d\n", txn, dbi, del));
+    return (int32_t)rc;
+  }
+
+  /**
+   * @brief mdb_get wrapper
+   * @param[in] htxn MDB_txn handle
+   * @param[in] dbi MDB_dbi handle
+   * @param[in] fkey MDB_val wrapper
+   * @param[out] fdata MDB_val wrapper
+   * @returns 0 on success, non-zero otherwise
+   */
+  int32_t ffi_get(uint32_t htxn,
+                  uint32_t dbi,
+                  uint8_t *fkey,
+                  uint8_t *fdata)
+  {
+    MDB_txn *txn = unwrap_txn(htxn);
+    if (!txn)
+      return EINVAL;
+    MDB_val key = unwrap_val(fkey);
+    MDB_val data = unwrap_val(fdata);
+    int rc = mdb_get(txn, (MDB_dbi)dbi, &key, &data);
+    DEBUG_PRINT(("mdb_get(%p, %d, %p, %p): %d\n",
+                 txn, dbi, key.mv_data, data.mv_data, rc));
+    wrap_val(data, fdata);
+    return (int32_t)rc;
+  }
+
+#define REF_OFFSET 0
+#define REF_LENGTH 1
+#define REF_LEN 2
+
+  /**
+   * @brief check that map is still the whole memory map of env, and not a
+   * view which was taken before the map was replaced
+   * @returns 0 if it is, MDB_MAP_RESIZED if not, non-zero otherwise
+   */
+  int check_map(MDB_env *env, MDB_val *map)
+  {
+    void *addr;
+    mdb_size_t size;
+    int rc = mdb_env_get_map(env, &addr, &size);
+    if (rc)
+      return rc;
+    if (addr != map->mv_data || (size_t)size != map->mv_size)
+      return MDB_MAP_RESIZED;
+    return MDB_SUCCESS;
+  }
+
+  /**
+   * @brief serialize val into dest as (offset, length) doubles, where offset
+   * is relative to the start of map, or -1 if val lies outside of map
+   * (e.g. in a dirty page of a write transaction).
+   */
+  void copy_ref(uint8_t *dest, MDB_val *map, MDB_val *val)
+  {
+    uint8_t *base = (uint8_t *)map->mv_data;
+    uint8_t *data = (uint8_t *)val->mv_data;
+    double offset = -1;
+    if (data >= base && data + val->mv_size <= base + map->mv_size)
+      offset = (double)(data - base);
+    double length = (double)val->mv_size;
+    memcpy(dest + (REF_OFFSET * sizedbl), &offset, sizedbl);
+    memcpy(dest + (REF_LENGTH * sizedbl), &length, sizedbl);
+  }
+
+  /**
+   * @brief like ffi_get, but also reports where the value lies within the
+   * memory map, so it can be read from a single view of the map.
+   * @param[in] htxn MDB_txn handle
+   * @param[in] dbi MDB_dbi handle
+   * @param[in] fkey MDB_val wrapper
+   * @param[out] fdata MDB_val wrapper
+   * @param[in] fmap MDB_val wrapper for the memory map (see ffi_env_map)
+   * @param[out] fref (offset, length) doubles for the value (see copy_ref)
+   * @returns 0 on success, MDB_MAP_RESIZED if fmap is out of date,
+   *          non-zero otherwise
+   */
+  int32_t ffi_get_ref(uint32_t htxn,
+                      uint32_t dbi,
+                      uint8_t *fkey,
+                      uint8_t *fdata,
+                      uint8_t *fmap,
+                      uint8_t *fref)
+  {
+    MDB_txn *txn = unwrap_txn(htxn);
+    if (!txn)
+      return EINVAL;
+    MDB_val key = unwrap_val(fkey);
+    MDB_val data;
+    int rc = mdb_get(txn, (MDB_dbi)dbi, &key, &data);
+    DEBUG_PRINT(("ffi_get_ref(%p, %d, %p): %d\n", txn, dbi, key.mv_data, rc));
+    if (rc)
+      return (int32_t)rc;
+    MDB_val map = unwrap_val(fmap);
+    rc = check_map(mdb_txn_env(txn), &map);
+    if (rc)
+      return (int32_t)rc;
+    wrap_val(data, fdata);
+    copy_ref(fref, &map, &data);
+    return MDB_SUCCESS;
+  }
+
+  /**
+   * @brief mdb_put wrapper
+   * @param[in] htxn MDB_txn handle
+   * @param[in] dbi MDB_dbi handle
+   * @param[in] fkey MDB_val wrapper
+   * @param[in,out] fdata MDV_val wrapper
+   * @param[in] flags
+   * @returns 0 on success, non-zero otherwise
+   */
+  int32_t ffi_put(uint32_t htxn,
+                  uint32_t dbi,
+                  uint8_t *fkey,
+                  uint8_t *fdata,
+                  uint32_t flags)
+  {
+    MDB_txn *txn = unwrap_txn(htxn);
+    if (!txn)
+      return EINVAL;
+    MDB_val key = unwrap_val(fkey);
+    MDB_val data = unwrap_val(fdata);
+#if DEBUG
+    CSTR_FROM_VAL(ckey, key);
+    CSTR_FROM_VAL(cdata, data);
+    DEBUG_PRINT(("ffi_put: key='%s', data='%s'\n", ckey, cdata));
+#endif
+    int rc = mdb_put(txn, (MDB_dbi)dbi, &key, &data, (unsigned int)flags);
+    DEBUG_PRINT(("mdb_put(%p, %d, %p, %p): %d\n",
+                 txn, dbi, key.mv_data, data.mv_data, rc));
+    wrap_val(key, fkey);
+    wrap_val(data, fdata);
+    return (int32_t)rc;
+  }
+
+  /**
+   * @brief mdb_del wrapper */
+  int32_t ffi_del(uint32_t htxn,
+                  uint32_t dbi,
+                  uint8_t *fkey,
+                  uint8_t *fdata)
+  {
+    MDB_txn *txn = unwrap_txn(htxn);
+    if (!txn)
+      return EINVAL;
+    MDB_val key = unwrap_val(fkey);
+    int rc;
+    if (fdata)
+    {
+      MDB_val data = unwrap_val(fdata);
+      rc = mdb_del(txn, (MDB_dbi)dbi, &key, &data);
+      DEBUG_PRINT(("mdb_del(%p, %d, %p, %p): %d\n",
+                   txn, dbi, key.mv_data, data.mv_data, rc));
+    }
+    else
+    {
+      rc = mdb_del(txn, (MDB_dbi)dbi, &key, NULL);
+      DEBUG_PRINT(("mdb_del(%p, %d, %p, %p): %d\n",
+                   txn, dbi, key.mv_data, NULL, rc));
+    }
+    return (int32_t)rc;
+  }
+
+#define GET_MANY_OFFSET 0
+#define GET_MANY_LENGTH 1
+#define GET_MANY_RC 2
+#define GET_MANY_STRIDE 3
+/* keys passed to each mdb_get_multi() call */
+#define GET_MANY_GROUP 64
+
+  /**
+   * @brief batched mdb_get: looks up many keys with a single FFI call,
+   * all under the same transaction.
+   *
+   * Keys are looked up GET_MANY_GROUP at a time with mdb_get_multi(),
+   * which overlaps the page misses of their tree descents.
+   *
+   * Each value found is copied into fvalues. For each key, a triple of
+   * doubles (offset, length, rc) is written into fresults. If fvalues is
+   * too small, lookups continue so that every length is still reported,
+   * and ENOMEM is returned so the caller can retry with a larger buffer.
+   *
+   * @param[in] txn
+   * @param[in] dbi MDB_dbi handle
+   * @param[in] fkeys packed keys: uint32_t length followed by key bytes
+   * @param[in] count number of keys packed into fkeys
+   * @param[out] fresults array of (offset, length, rc) doubles, one per key
+   * @param[out] fvalues buffer to receive copies of the values found
+   * @param[in] values_size size of fvalues, in bytes
+   * @returns 0 on success, ENOMEM if fvalues was too small
+   */
+  int get_many(MDB_txn *txn,
+               uint32_t dbi,
+               uint8_t *fkeys,
+               uint32_t count,
+               uint8_t *fresults,
+               uint8_t *fvalues,
+               size_t values_size)
+  {
+    MDB_val keys[GET_MANY_GROUP];
+    MDB_val data[GET_MANY_GROUP];
+    int rcs[GET_MANY_GROUP];
+    size_t used = 0;
+    int result = 0;
+    uint8_t *pos = fkeys;
+    for (uint32_t first = 0; first < count; first += GET_MANY_GROUP)
+    {
+      uint32_t n = count - first;
+      if (n > GET_MANY_GROUP)
+        n = GET_MANY_GROUP;
+      for (uint32_t j = 0; j < n; j++)
+      {
+        uint32_t key_size;
+        memcpy(&key_size, pos, sizeof(key_size));
+        keys[j].mv_size = key_size;
+        keys[j].mv_data = pos + sizeof(key_size);
+        pos += sizeof(key_size) + key_size;
+      }
+      int rc = mdb_get_multi(txn, (MDB_dbi)dbi, n, keys, data, rcs);
+      for (uint32_t j = 0; j < n; j++)
+      {
+        if (rc)
+          rcs[j] = rc;
+        double offset = (double)used;
+        double length = 0;
+        if (!rcs[j])
+        {
+          length = (double)data[j].mv_size;
+          if (used + data[j].mv_size <= values_size)
+            memcpy(fvalues + used, data[j].mv_data, data[j].mv_size);
+          else
+            result = ENOMEM;
+          used += data[j].mv_size;
+        }
+        double drc = (double)rcs[j];
+        uint8_t *dest = fresults + ((first + j) * GET_MANY_STRIDE * sizedbl);
+        memcpy(dest + (GET_MANY_OFFSET * sizedbl), &offset, sizedbl);
+        memcpy(dest + (GET_MANY_LENGTH * sizedbl), &length, sizedbl);
+        memcpy(dest + (GET_MANY_RC * sizedbl), &drc, sizedbl);
+      }
+    }
+    DEBUG_PRINT(("get_many(%p, %d, %d): %ld bytes, %d\n",
+                 txn, dbi, count, used, result));
+    return result;
+  }
+
+  /**
+   * @brief get_many wrapper
+   * @param[in] htxn MDB_txn handle
+   * @returns 0 on success, ENOMEM if fvalues was too small
+   */
+  int32_t ffi_get_many(uint32_t htxn,
+                       uint32_t dbi,
+                       uint8_t *fkeys,
+                       uint32_t count,
+                       uint8_t *fresults,
+                       uint8_t *fvalues,
+                       size_t values_size)
+  {
+    MDB_txn *txn = unwrap_txn(htxn);
+    if (!txn)
+      return EINVAL;
+    return (int32_t)get_many(txn, dbi, fkeys, count,
+                             fresults, fvalues, values_size);
+  }
+
+#define BATCH_PUT 0
+#define BATCH_DEL 1
+#define BATCH_CHECK 2
+
+/* BATCH_CHECK flags */
+#define CHECK_EQUAL 0
+#define CHECK_MISSING 1
+
+#define BATCH_OP 0
+#define BATCH_DBI 1
+#define BATCH_FLAGS 2
+#define BATCH_KEY_SIZE 3
+#define BATCH_DATA_SIZE 4
+#define BATCH_HEADER_LEN 5
+
+  /**
+   * @brief apply a serialized write batch to an open write transaction.
+   *
+   * Each op is a header of BATCH_HEADER_LEN uint32_t values
+   * (op, dbi, flags, key size, data size) followed by the key bytes and
+   * the data bytes. MDB_KEYEXIST and MDB_NOTFOUND are recorded in the
+   * op's result and do not stop the batch. Any other error stops the
+   * batch and is returned; the transaction must then be aborted.
+   *
+   * A BATCH_CHECK op guards the op after it: with CHECK_EQUAL, the key's
+   * current data must equal the op's data, and with CHECK_MISSING, the key
+   * must not exist. If not, both ops are skipped with ECANCELED.
+   *
+   * @param[in] txn open write transaction
+   * @param[in] batch serialized ops
+   * @param[in] count number of ops in batch
+   * @param[out] results one rc per op
+   * @returns 0 on success, non-zero otherwise
+   */
+  int apply_batch(MDB_txn *txn, uint8_t *batch, uint32_t count, int32_t *results)
+  {
+    uint8_t *pos = batch;
+    int skip = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+      uint32_t header[BATCH_HEADER_LEN];
+      memcpy(header, pos, sizeof(header));
+      pos += sizeof(header);
+      MDB_val key = {header[BATCH_KEY_SIZE], pos};
+      pos += header[BATCH_KEY_SIZE];
+      MDB_val data = {header[BATCH_DATA_SIZE], pos};
+      pos += header[BATCH_DATA_SIZE];
+      int rc;
+      if (skip)
+      {
+        skip = 0;
+        rc = ECANCELED;
+      }
+      else if (header[BATCH_OP] == BATCH_CHECK)
+      {
+        MDB_val current;
+        rc = mdb_get(txn, (MDB_dbi)header[BATCH_DBI], &key, &current);
+        if (rc && rc != MDB_NOTFOUND)
+          return rc;
+        if (header[BATCH_FLAGS] & CHECK_MISSING)
+          skip = rc != MDB_NOTFOUND;
+        else
+          skip = rc == MDB_NOTFOUND || current.mv_size != data.mv_size ||
+                 memcmp(current.mv_data, data.mv_data, data.mv_size);
+        rc = skip ? ECANCELED : MDB_SUCCESS;
+      }
+      else if (header[BATCH_OP] == BATCH_PUT)
+        rc = mdb_put(txn, (MDB_dbi)header[BATCH_DBI], &key, &data,
+                     (unsigned int)header[BATCH_FLAGS]);
+      else if (header[BATCH_OP] == BATCH_DEL)
+        rc = mdb_del(txn, (MDB_dbi)header[BATCH_DBI], &key,
+                     data.mv_size ? &data : NULL);
+      else
+        rc = EINVAL;
+      results[i] = (int32_t)rc;
+      if (rc && rc != MDB_KEYEXIST && rc != MDB_NOTFOUND && rc != ECANCELED)
+        return rc;
+    }
+    return MDB_SUCCESS;
+  }
+
+  /**
+   * @brief apply a serialized write batch (see apply_batch) inside a single
+   * write transaction, which is committed if every op succeeds or
+   * fails with MDB_KEYEXIST or MDB_NOTFOUND, and aborted otherwise.
+   *
+   * @param[in] fenv MDB_env wrapper
+   * @param[in] fbatch serialized ops
+   * @param[in] count number of ops in fbatch
+   * @param[out] results one rc per op
+   * @returns 0 on success, non-zero otherwise
+   */
+  int32_t ffi_write_batch(uint8_t *fenv,
+                          uint8_t *fbatch,
+                          uint32_t count,
+                          int32_t *results)
+  {
+    MDB_env *env = unwrap_env(fenv);
+    MDB_txn *txn;
+    int rc = write_txn_begin(env, &txn);
+    if (rc)
+      return (int32_t)rc;
+    rc = apply_batch(txn, fbatch, count, results);
+    if (rc)
+      mdb_txn_abort(txn);
+    else
+      rc = mdb_txn_commit(txn);
+    write_txn_end(env);
+    DEBUG_PRINT(("ffi_write_batch(%p, %d): %d\n", env, count, rc));
+    return (int32_t)rc;
+  }
+
+#define BULK_KEY_SIZE 0
+#define BULK_DATA_SIZE 1
+#define BULK_HEADER_LEN 2
+
+  /**
+   * @brief put a chunk of records into dbi inside a single write
+   * transaction, which is committed only if every put succeeds. Each
+   * record is serialized as [keySize, dataSize] (uint32), then the key
+   * and the data. Records are appended (MDB_APPEND) for as long as each
+   * sorts after the last key in dbi, which skips the search and leaves
+   * full pages unsplit; from the first one which does not, the rest of
+   * the chunk is put normally. Intended to be bound with
+   * "nonblocking: true".
+   *
+   * @param[in] fenv MDB_env wrapper
+   * @param[in] dbi MDB_dbi handle
+   * @param[in] fbuf serialized records
+   * @param[in] count number of records in fbuf
+   * @param[out] appended number of records which were appended
+   * @returns 0 on success, non-zero otherwise
+   */
+  int32_t ffi_bulk_load(uint8_t *fenv,
+                        uint32_t dbi,
+                        uint8_t *fbuf,
+                        uint32_t count,
+                        uint32_t *appended)
+  {
+    MDB_env *env = unwrap_env(fenv);
+    MDB_txn *txn;
+    MDB_cursor *cursor;
+    FFI_env_state *state;
+    *appended = 0;
+    int rc = env_enter(env, &state);
+    if (rc)
+      return (int32_t)rc;
+    rc = write_txn_begin(env, &txn);
+    if (rc)
+    {
+      env_leave(state);
+      return (int32_t)rc;
+    }
+    rc = mdb_cursor_open(txn, (MDB_dbi)dbi, &cursor);
+    uint8_t *pos = fbuf;
+    int append = 1;
+    for (uint32_t i = 0; i < count && !rc; i++)
+    {
+      uint32_t header[BULK_HEADER_LEN];
+      memcpy(header, pos, sizeof(header));
+      pos += sizeof(header);
+      MDB_val key = {header[BULK_KEY_SIZE], pos};
+      pos += header[BULK_KEY_SIZE];
+      MDB_val data = {header[BULK_DATA_SIZE], pos};
+      pos += header[BULK_DATA_SIZE];
+      if (append)
+      {
+        rc = mdb_cursor_put(cursor, &key, &data, MDB_APPEND);
+        if (!rc)
+        {
+          (*appended)++;
+          continue;
+        }
+        if (rc != MDB_KEYEXIST)
+          break;
+        // out of order: searching for the rest is cheaper than failing
+        append = 0;
+      }
+      rc = mdb_cursor_put(cursor, &key, &data, 0);
+    }
+    if (rc)
+      mdb_txn_abort(txn);
+    else
+    {
+      mdb_cursor_close(cursor);
+      rc = mdb_txn_commit(txn);
+    }
+    write_txn_end(env);
+    env_leave(state);
+    DEBUG_PRINT(("ffi_bulk_load(%p, %d, %d): %d, %d appended\n", env, dbi,
+                 count, rc, *appended));
+    return (int32_t)rc;
+  }
+
+  ///////////////////////////////////////////////
+  // MDB_cursor functions
+  ///////////////////////////////////////////////
+
+  /**
+   * @brief mdb_cursor_open wrapper
+   *
+   * @param[in] htxn MDB_txn handle
+   * @param[in] dbi MDB_dbi handle
+   * @param[out] hcursor handle of the new MDB_cursor
+   * @return int32_t 0 on success, non-zero otherwise
+   */
+  int32_t ffi_cursor_open(uint32_t htxn, uint32_t dbi, uint32_t *hcursor)
+  {
+    MDB_txn *txn = unwrap_txn(htxn);
+    if (!txn)
+      return EINVAL;
+    MDB_cursor *cursor;
+    int rc = mdb_cursor_open(txn, dbi, &cursor);
+    DEBUG_PRINT(("mdb_cursor_open(%p, %d, %p): %d\n", txn, dbi, cursor, rc));
+    if (rc)
+      return (int32_t)rc;
+    uint32_t flags = handle_get(htxn, HANDLE_TXN)->flags;
+    *hcursor = handle_new(cursor, mdb_txn_env(txn), HANDLE_CURSOR, htxn, flags);
+    if (!*hcursor)
+    {
+      mdb_cursor_close(cursor);
+      return ENOMEM;
+    }
+    return MDB_SUCCESS;
+  }
+
+  /**
+   * @brief mdb_cursor_close wrapper
+   *
+   * @param hcursor
+   */
+  void ffi_cursor_close(uint32_t hcursor)
+  {
+    MDB_cursor *cursor = unwrap_cursor(hcursor);
+    if (!cursor)
+      return;
+    mdb_cursor_close(cursor);
+    handle_free(hcursor);
+    DEBUG_PRINT(("mdb_cursor_close(%p)\n", cursor));
+  }
+
+  /**
+   * @brief mdb_cursor_renew wrapper
+   *
+   * @param htxn
+   * @param hcursor
+   * @return int32_t
+   */
+  int32_t ffi_cursor_renew(uint32_t htxn, uint32_t hcursor)
+  {
+    MDB_txn *txn = unwrap_txn(htxn);
+    MDB_cursor *cursor = unwrap_cursor(hcursor);
+    if (!txn || !cursor)
+      return EINVAL;
+    int rc = mdb_cursor_renew(txn, cursor);
+    DEBUG_PRINT(("mdb_cursor_renew(%p, %p): %d\n", txn, cursor, rc));
+    if (!rc)
+      handle_set_owner(hcursor, htxn);
+    return (int32_t)rc;
+  }
+
+  /**
+   * @brief mdb_cursor_txn wrapper
+   *
+   * @param hcursor
+   * @return uint32_t handle of the cursor's txn, or 0
+   */
+  uint32_t ffi_cursor_txn(uint32_t hcursor)
+  {
+    FFI_slot *slot = handle_get(hcursor, HANDLE_CURSOR);
+    DEBUG_PRINT(("mdb_cursor_txn(%d): %d\n", hcursor, slot ? slot->owner : 0));
+    return slot ? slot->owner : 0;
+  }
+
+  /**
+   * @brief mdb_cursor_dbi wrapper
+   *
+   * @param hcursor
+   * @return uint32_t
+   */
+  uint32_t ffi_cursor_dbi(uint32_t hcursor)
+  {
+    MDB_cursor *cursor = unwrap_cursor(hcursor);
+    if (!cursor)
+      return 0;
+    MDB_dbi dbi = mdb_cursor_dbi(cursor);
+    DEBUG_PRINT(("mdb_cursor_dbi(%p): %d\n", cursor, dbi));
+    return (uint32_t)dbi;
   }
 
   /**
    * @brief mdb_cursor_get wrapper
    *
-   * @param[in] fcursor MDB_cursor wrapper
+   * @param[in] hcursor MDB_cursor handle
    * @param[in,out] fkey MDB_val wrapper for key
    * @param[in,out] fdata MDB_val wrapper for data
    * @param[in] op cursor operation
    * @return int32_t 0 on success, non-zero otherwise
    */
-  int32_t ffi_cursor_get(uint8_t *fcursor,
+  int32_t ffi_cursor_get(uint32_t hcursor,
                          uint8_t *fkey,
                          uint8_t *fdata,
                          uint32_t op)
   {
-    MDB_cursor *cursor = unwrap_cursor(fcursor);
+    MDB_cursor *cursor = unwrap_cursor(hcursor);
+    if (!cursor)
+      return EINVAL;
     MDB_val key = unwrap_val(fkey);
     MDB_val data = unwrap_val(fdata);
     int rc = mdb_cursor_get(cursor, &key, &data, (MDB_cursor_op)op);
@@ -816,76 +2785,471 @@ extern "C"
   }
 
   /**
-   * @brief mdb_cursor_put wrapper
+   * @brief like ffi_cursor_get, but also reports where the key and value lie
+   * within the memory map (see copy_ref).
+   *
+   * @param[in] hcursor MDB_cursor handle
+   * @param[in,out] fkey MDB_val wrapper for key
+   * @param[in,out] fdata MDB_val wrapper for data
+   * @param[in] op cursor operation
+   * @param[in] fmap MDB_val wrapper for the memory map (see ffi_env_map)
+   * @param[out] fref (offset, length) doubles for the key, then the value
+   * @return int32_t 0 on success, MDB_MAP_RESIZED if fmap is out of date,
+   *                 non-zero otherwise
+   */
+  int32_t ffi_cursor_get_ref(uint32_t hcursor,
+                             uint8_t *fkey,
+                             uint8_t *fdata,
+                             uint32_t op,
+                             uint8_t *fmap,
+                             uint8_t *fref)
+  {
+    MDB_val map = unwrap_val(fmap);
+    MDB_cursor *cursor = unwrap_cursor(hcursor);
+    int rc = cursor ? check_map(mdb_txn_env(mdb_cursor_txn(cursor)), &map)
+                    : EINVAL;
+    if (rc)
+      return (int32_t)rc;
+    rc = ffi_cursor_get(hcursor, fkey, fdata, op);
+    if (rc)
+      return (int32_t)rc;
+    MDB_val key = unwrap_val(fkey);
+    MDB_val data = unwrap_val(fdata);
+    copy_ref(fref, &map, &key);
+    copy_ref(fref + (REF_LEN * sizedbl), &map, &data);
+    return MDB_SUCCESS;
+  }
+
+  /**
+   * @brief mdb_cursor_put wrapper
+   *
+   * @param[in] hcursor
+   * @param[in] fkey
+   * @param[in] fdata
+   * @param[in] flags
+   * @return uint32_t 0 on success, non-zero otherwise
+   */
+  int32_t ffi_cursor_put(uint32_t hcursor, uint8_t *fkey, uint8_t *fdata, uint32_t flags)
+  {
+    MDB_cursor *cursor = unwrap_cursor(hcursor);
+    if (!cursor)
+      return EINVAL;
+    MDB_val key = unwrap_val(fkey);
+    MDB_val data = unwrap_val(fdata);
+#if DEBUG
+    CSTR_FROM_VAL(ckey, key);
+    CSTR_FROM_VAL(cdata, data);
+    DEBUG_PRINT(("ffi_cursor_put: key='%s', data='%s'\n", ckey, cdata));
+#endif
+    int rc = mdb_cursor_put(cursor, &key, &data, (unsigned int)flags);
+    DEBUG_PRINT(("mdb_cursor_put(%p, %p, %p, 0x%x): %d\n",
+                 cursor, key.mv_data, data.mv_data, flags, rc));
+    wrap_val(key, fkey);
+    wrap_val(data, fdata);
+    return (int32_t)rc;
+  }
+
+  /**
+   * @brief mdb_cursor_del wrapper
+   *
+   * @param[in] hcursor
+   * @param[in] flags
+   * @return int32_t 0 on success, non-zero otherwise
+   */
+  int32_t ffi_cursor_del(uint32_t hcursor, uint32_t flags)
+  {
+    MDB_cursor *cursor = unwrap_cursor(hcursor);
+    if (!cursor)
+      return EINVAL;
+    int rc = mdb_cursor_del(cursor, (unsigned int)flags);
+    DEBUG_PRINT(("mdb_cursor_del(%p, %d): %d\n", cursor, flags, rc));
+    return (int32_t)rc;
+  }
+
+  /**
+   * @brief mdb_cursor_count wrapper
+   *
+   * @param[in] hcursor
+   * @param[out] count
+   * @return int32_t 0 on success, non-zero otherwise
+   */
+  int32_t ffi_cursor_count(uint32_t hcursor, size_t *count)
+  {
+    MDB_cursor *cursor = unwrap_cursor(hcursor);
+    if (!cursor)
+      return EINVAL;
+    mdb_size_t _count = (mdb_size_t)*count;
+    int rc = mdb_cursor_count(cursor, &_count);
+    DEBUG_PRINT(("mdb_cursor_count(%p, %ld): %d\n", cursor, _count, rc));
+    *count = _count;
+    return (int32_t)rc;
+  }
+
+#define SCAN_KEY_SIZE 0
+#define SCAN_DATA_SIZE 1
+#define SCAN_HEADER_LEN 2
+
+  /**
+   * @brief append one item to a scan buffer as SCAN_HEADER_LEN uint32_t
+   * values (key size, data size) followed by the key bytes and data bytes.
+   *
+   * @param[out] fbuf scan buffer
+   * @param[in,out] used bytes of fbuf already used
+   * @param[in] buf_size size of fbuf, in bytes
+   * @param[in] key
+   * @param[in] data
+   * @returns 0 on success, ENOMEM if the item does not fit
+   */
+  int scan_put(uint8_t *fbuf, size_t *used, size_t buf_size,
+               MDB_val *key, MDB_val *data)
+  {
+    uint32_t header[SCAN_HEADER_LEN];
+    size_t pos = *used;
+    if (pos + sizeof(header) + key->mv_size + data->mv_size > buf_size)
+      return ENOMEM;
+    header[SCAN_KEY_SIZE] = (uint32_t)key->mv_size;
+    header[SCAN_DATA_SIZE] = (uint32_t)data->mv_size;
+    memcpy(fbuf + pos, header, sizeof(header));
+    pos += sizeof(header);
+    memcpy(fbuf + pos, key->mv_data, key->mv_size);
+    pos += key->mv_size;
+    memcpy(fbuf + pos, data->mv_data, data->mv_size);
+    pos += data->mv_size;
+    *used = pos;
+    return MDB_SUCCESS;
+  }
+
+  /**
+   * @brief walk up to max_entries items with a single FFI call, copying each
+   * one into fbuf (see scan_put).
+   *
+   * If the next item does not fit into fbuf, the cursor is left positioned
+   * on it and ENOMEM is returned: resume with first_op = MDB_GET_CURRENT.
+   *
+   * @param[in] hcursor MDB_cursor handle
+   * @param[in] first_op cursor operation for the first item
+   * @param[in] op cursor operation for every following item
+   * @param[in] max_entries
+   * @param[out] fbuf buffer to receive the items
+   * @param[in] buf_size size of fbuf, in bytes
+   * @param[out] count number of items written into fbuf
+   * @return int32_t 0 if max_entries were read, MDB_NOTFOUND at the end of
+   *                 the database, ENOMEM if fbuf is full, non-zero otherwise
+   */
+  int32_t ffi_cursor_scan(uint32_t hcursor,
+                          uint32_t first_op,
+                          uint32_t op,
+                          uint32_t max_entries,
+                          uint8_t *fbuf,
+                          size_t buf_size,
+                          uint32_t *count)
+  {
+    MDB_cursor *cursor = unwrap_cursor(hcursor);
+    if (!cursor)
+      return EINVAL;
+    MDB_cursor_op next = (MDB_cursor_op)first_op;
+    MDB_val key, data;
+    size_t used = 0;
+    uint32_t found = 0;
+    int rc = MDB_SUCCESS;
+    while (found < max_entries)
+    {
+      rc = mdb_cursor_get(cursor, &key, &data, next);
+      if (rc)
+        break;
+      next = (MDB_cursor_op)op;
+      rc = scan_put(fbuf, &used, buf_size, &key, &data);
+      if (rc)
+        break;
+      found++;
+    }
+    DEBUG_PRINT(("ffi_cursor_scan(%p, %d, %d, %d): %d entries, %d\n",
+                 cursor, first_op, op, max_entries, found, rc));
+    *count = found;
+    return (int32_t)rc;
+  }
+
+  ///////////////////////////////////////////////
+  // Range cursor functions
+  ///////////////////////////////////////////////
+
+#define RANGE_REVERSE 0x01
+#define RANGE_EXCLUDE_START 0x02
+#define RANGE_EXCLUDE_END 0x04
+#define RANGE_HAS_START 0x08
+#define RANGE_HAS_END 0x10
+
+#define RANGE_STATE_INIT 0
+#define RANGE_STATE_ACTIVE 1
+#define RANGE_STATE_PENDING 2
+#define RANGE_STATE_DONE 3
+
+  /**
+   * A cursor walking the keys between optional start and end bounds, which
+   * applies offset and limit natively. The bound keys are copied into the
+   * same allocation, just after the struct.
+   */
+  typedef struct FFI_range
+  {
+    /** resolved from the owning cursor handle at the start of every call */
+    MDB_cursor *cursor;
+    MDB_txn *txn;
+    MDB_dbi dbi;
+    uint32_t flags;
+    int state;
+    size_t offset;
+    size_t limit;
+    size_t found;
+    MDB_val start;
+    MDB_val end;
+  } FFI_range;
+
+  /**
+   * @brief resolve a range cursor handle, and the cursor it reads from
+   * @returns NULL if either handle is stale
+   */
+  FFI_range *unwrap_range(uint32_t hrange)
+  {
+    FFI_slot *slot = handle_get(hrange, HANDLE_RANGE);
+    if (!slot)
+      return NULL;
+    FFI_range *range = (FFI_range *)slot->ptr;
+    range->cursor = slot->owner ? unwrap_cursor(slot->owner) : NULL;
+    if (!range->cursor)
+      return NULL;
+    range->txn = mdb_cursor_txn(range->cursor);
+    return range;
+  }
+
+  /** true if key lies beyond the end bound of range */
+  int range_past_end(FFI_range *range, MDB_val *key)
+  {
+    if (!(range->flags & RANGE_HAS_END))
+      return 0;
+    int cmp = mdb_cmp(range->txn, range->dbi, key, &range->end);
+    if (range->flags & RANGE_REVERSE)
+      cmp = -cmp;
+    return cmp > 0 || (cmp == 0 && (range->flags & RANGE_EXCLUDE_END));
+  }
+
+  /** position range->cursor on the first key at or after the start bound */
+  int range_first(FFI_range *range, MDB_val *key, MDB_val *data)
+  {
+    int reverse = range->flags & RANGE_REVERSE;
+    if (!(range->flags & RANGE_HAS_START))
+      return mdb_cursor_get(range->cursor, key, data,
+                            reverse ? MDB_LAST : MDB_FIRST);
+    *key = range->start;
+    int rc = mdb_cursor_get(range->cursor, key, data, MDB_SET_RANGE);
+    if (rc == MDB_NOTFOUND && reverse)
+      return mdb_cursor_get(range->cursor, key, data, MDB_LAST);
+    if (rc)
+      return rc;
+    int cmp = mdb_cmp(range->txn, range->dbi, key, &range->start);
+    if (reverse && (cmp > 0 || (range->flags & RANGE_EXCLUDE_START)))
+      return mdb_cursor_get(range->cursor, key, data, MDB_PREV);
+    if (!reverse && cmp == 0 && (range->flags & RANGE_EXCLUDE_START))
+      return mdb_cursor_get(range->cursor, key, data, MDB_NEXT);
+    return MDB_SUCCESS;
+  }
+
+  /** read the next item of range, or MDB_NOTFOUND past its bounds */
+  int range_next(FFI_range *range, MDB_val *key, MDB_val *data)
+  {
+    MDB_cursor_op op = (range->flags & RANGE_REVERSE) ? MDB_PREV : MDB_NEXT;
+    int rc;
+    switch (range->state)
+    {
+    case RANGE_STATE_INIT:
+      range->state = RANGE_STATE_ACTIVE;
+      rc = range_first(range, key, data);
+      for (size_t skipped = 0; !rc && skipped < range->offset; skipped++)
+      {
+        if (range_past_end(range, key))
+          break;
+        rc = mdb_cursor_get(range->cursor, key, data, op);
+      }
+      break;
+    case RANGE_STATE_ACTIVE:
+      rc = mdb_cursor_get(range->cursor, key, data, op);
+      break;
+    case RANGE_STATE_PENDING:
+      range->state = RANGE_STATE_ACTIVE;
+      rc = mdb_cursor_get(range->cursor, key, data, MDB_GET_CURRENT);
+      break;
+    default:
+      return MDB_NOTFOUND;
+    }
+    if (!rc && (range->found >= range->limit || range_past_end(range, key)))
+      rc = MDB_NOTFOUND;
+    if (rc)
+      range->state = RANGE_STATE_DONE;
+    else
+      range->found++;
+    return rc;
+  }
+
+  /**
+   * @brief create a range cursor on top of an open cursor.
+   *
+   * @param[in] hcursor MDB_cursor handle
+   * @param[in] fstart MDB_val wrapper for the start key, or NULL
+   * @param[in] fend MDB_val wrapper for the end key, or NULL
+   * @param[in] flags RANGE_REVERSE, RANGE_EXCLUDE_START, RANGE_EXCLUDE_END
+   * @param[in] offset number of items in range to skip
+   * @param[in] limit maximum number of items to return, or 0 for no limit
+   * @param[out] hrange handle of the new range cursor
+   * @return int32_t 0 on success, non-zero otherwise
+   */
+  int32_t ffi_range_open(uint32_t hcursor,
+                         uint8_t *fstart,
+                         uint8_t *fend,
+                         uint32_t flags,
+                         size_t offset,
+                         size_t limit,
+                         uint32_t *hrange)
+  {
+    MDB_cursor *cursor = unwrap_cursor(hcursor);
+    if (!cursor)
+      return EINVAL;
+    MDB_val start = {0, NULL}, end = {0, NULL};
+    if (fstart)
+    {
+      start = unwrap_val(fstart);
+      flags |= RANGE_HAS_START;
+    }
+    if (fend)
+    {
+      end = unwrap_val(fend);
+      flags |= RANGE_HAS_END;
+    }
+    FFI_range *range = malloc(sizeof(FFI_range) + start.mv_size + end.mv_size);
+    if (!range)
+      return ENOMEM;
+    range->cursor = cursor;
+    range->txn = mdb_cursor_txn(cursor);
+    range->dbi = mdb_cursor_dbi(cursor);
+    range->flags = flags;
+    range->state = RANGE_STATE_INIT;
+    range->offset = offset;
+    range->limit = limit ? limit : SIZE_MAX;
+    range->found = 0;
+    range->start.mv_size = start.mv_size;
+    range->start.mv_data = (uint8_t *)(range + 1);
+    memcpy(range->start.mv_data, start.mv_data, start.mv_size);
+    range->end.mv_size = end.mv_size;
+    range->end.mv_data = (uint8_t *)range->start.mv_data + start.mv_size;
+    memcpy(range->end.mv_data, end.mv_data, end.mv_size);
+    DEBUG_PRINT(("ffi_range_open(%p, 0x%x, %ld, %ld): %p\n",
+                 range->cursor, flags, offset, limit, range));
+    FFI_slot *cursor_slot = handle_get(hcursor, HANDLE_CURSOR);
+    *hrange = handle_new(range, mdb_txn_env(range->txn), HANDLE_RANGE, hcursor,
+                         cursor_slot->flags);
+    if (!*hrange)
+    {
+      free(range);
+      return ENOMEM;
+    }
+    return MDB_SUCCESS;
+  }
+
+  /**
+   * @brief read the next item of a range cursor
    *
-   * @param[in] fcursor
-   * @param[in] fkey
-   * @param[in] fdata
-   * @param[in] flags
-   * @return uint32_t 0 on success, non-zero otherwise
+   * @param[in] hrange range cursor handle
+   * @param[out] fkey MDB_val wrapper for key
+   * @param[out] fdata MDB_val wrapper for data
+   * @return int32_t 0 on success, MDB_NOTFOUND past the end of the range,
+   *                 non-zero otherwise
    */
-  int32_t ffi_cursor_put(uint8_t *fcursor, uint8_t *fkey, uint8_t *fdata, uint32_t flags)
+  int32_t ffi_range_next(uint32_t hrange, uint8_t *fkey, uint8_t *fdata)
   {
-    MDB_cursor *cursor = unwrap_cursor(fcursor);
-    MDB_val key = unwrap_val(fkey);
-    MDB_val data = unwrap_val(fdata);
-#if DEBUG
-    CSTR_FROM_VAL(ckey, key);
-    CSTR_FROM_VAL(cdata, data);
-    DEBUG_PRINT(("ffi_cursor_put: key='%s', data='%s'\n", ckey, cdata));
-#endif
-    int rc = mdb_cursor_put(cursor, &key, &data, (unsigned int)flags);
-    DEBUG_PRINT(("mdb_cursor_put(%p, %p, %p, 0x%x): %d\n",
-                 cursor, key.mv_data, data.mv_data, flags, rc));
-    wrap_val(key, fkey);
-    wrap_val(data, fdata);
+    FFI_range *range = unwrap_range(hrange);
+    if (!range)
+      return EINVAL;
+    MDB_val key, data;
+    int rc = range_next(range, &key, &data);
+    DEBUG_PRINT(("ffi_range_next(%p): %d\n", range, rc));
+    if (!rc)
+    {
+      wrap_val(key, fkey);
+      wrap_val(data, fdata);
+    }
     return (int32_t)rc;
   }
 
   /**
-   * @brief mdb_cursor_del wrapper
+   * @brief like ffi_cursor_scan, but stays within the range. If the next
+   * item does not fit into fbuf, it is returned first by the next call.
    *
-   * @param[in] fcursor
-   * @param[in] flags
-   * @return int32_t 0 on success, non-zero otherwise
+   * @param[in] hrange range cursor handle
+   * @param[in] max_entries
+   * @param[out] fbuf buffer to receive the items
+   * @param[in] buf_size size of fbuf, in bytes
+   * @param[out] count number of items written into fbuf
+   * @return int32_t 0 if max_entries were read, MDB_NOTFOUND past the end
+   *                 of the range, ENOMEM if fbuf is full, non-zero otherwise
    */
-  int32_t ffi_cursor_del(uint8_t *fcursor, uint32_t flags)
+  int32_t ffi_range_scan(uint32_t hrange,
+                         uint32_t max_entries,
+                         uint8_t *fbuf,
+                         size_t buf_size,
+                         uint32_t *count)
   {
-    MDB_cursor *cursor = unwrap_cursor(fcursor);
-    int rc = mdb_cursor_del(cursor, (unsigned int)flags);
-    DEBUG_PRINT(("mdb_cursor_del(%p, %d): %d\n", cursor, flags, rc));
+    FFI_range *range = unwrap_range(hrange);
+    if (!range)
+      return EINVAL;
+    MDB_val key, data;
+    size_t used = 0;
+    uint32_t found = 0;
+    int rc = MDB_SUCCESS;
+    while (found < max_entries)
+    {
+      rc = range_next(range, &key, &data);
+      if (rc)
+        break;
+      rc = scan_put(fbuf, &used, buf_size, &key, &data);
+      if (rc)
+      {
+        range->found--;
+        range->state = RANGE_STATE_PENDING;
+        break;
+      }
+      found++;
+    }
+    DEBUG_PRINT(("ffi_range_scan(%p, %d): %d entries, %d\n",
+                 range, max_entries, found, rc));
+    *count = found;
     return (int32_t)rc;
   }
 
   /**
-   * @brief mdb_cursor_count wrapper
-   *
-   * @param[in] fcursor
-   * @param[out] count
-   * @return int32_t 0 on success, non-zero otherwise
-   */
-  int32_t ffi_cursor_count(uint8_t *fcursor, size_t *count)
+   * @brief free a range cursor. The underlying cursor stays open. */
+  void ffi_range_close(uint32_t hrange)
   {
-    MDB_cursor *cursor = unwrap_cursor(fcursor);
-    mdb_size_t _count = (mdb_size_t)*count;
-    int rc = mdb_cursor_count(cursor, &_count);
-    DEBUG_PRINT(("mdb_cursor_count(%p, %ld): %d\n", cursor, _count, rc));
-    *count = _count;
-    return (int32_t)rc;
+    FFI_slot *slot = handle_get(hrange, HANDLE_RANGE);
+    if (!slot)
+      return;
+    FFI_range *range = (FFI_range *)slot->ptr;
+    handle_free(hrange);
+    DEBUG_PRINT(("ffi_range_close(%p)\n", range));
+    free(range);
   }
 
   /**
    * @brief mdb_cmp wrapper
    *
-   * @param[in] ftxn
+   * @param[in] htxn
    * @param[in] dbi
    * @param[in] fa
    * @param[in] fb
    * @return int32_t comparison result (a - b) <=> 0
    */
-  int32_t ffi_cmp(uint8_t *ftxn, uint32_t dbi, uint8_t *fa, uint8_t *fb)
+  int32_t ffi_cmp(uint32_t htxn, uint32_t dbi, uint8_t *fa, uint8_t *fb)
   {
-    MDB_txn *txn = unwrap_txn(ftxn);
+    MDB_txn *txn = unwrap_txn(htxn);
+    if (!txn)
+      return EINVAL;
     const MDB_val a = unwrap_val(fa);
     const MDB_val b = unwrap_val(fb);
     int cmp = mdb_cmp(txn, (MDB_dbi)dbi, &a, &b);
@@ -897,15 +3261,17 @@ extern "C"
   /**
    * @brief mdb_dcmp wrapper
    *
-   * @param[in] ftxn
+   * @param[in] htxn
    * @param[in] dbi
    * @param[in] fa
    * @param[in] fb
    * @return int32_t comparison result (a - b) <=> 0
    */
-  int32_t ffi_dcmp(uint8_t *ftxn, uint32_t dbi, uint8_t *fa, uint8_t *fb)
+  int32_t ffi_dcmp(uint32_t htxn, uint32_t dbi, uint8_t *fa, uint8_t *fb)
   {
-    MDB_txn *txn = unwrap_txn(ftxn);
+    MDB_txn *txn = unwrap_txn(htxn);
+    if (!txn)
+      return EINVAL;
     const MDB_val a = unwrap_val(fa);
     const MDB_val b = unwrap_val(fb);
     int dcmp = mdb_dcmp(txn, (MDB_dbi)dbi, &a, &b);
@@ -931,6 +3297,859 @@ extern "C"
     return (int32_t)rc;
   }
 
+  ///////////////////////////////////////////////
+  // fast-call functions
+  ///////////////////////////////////////////////
+
+  /*
+   * Variants of the hot-path functions which take only numbers and buffers,
+   * and return a number, so that they qualify for V8's fast API calls.
+   * Where a result is returned in place of an rc, errors are returned as
+   * negative numbers: MDB_* codes as they are, and errno values negated.
+   */
+
+  static __thread int32_t fast_rc;
+
+  /** encode rc as a negative number, see above */
+  int32_t fast_error(int rc)
+  {
+    if (rc >= MDB_KEYEXIST && rc <= MDB_LAST_ERRCODE)
+      return (int32_t)rc;
+    return (int32_t)-rc;
+  }
+
+  /**
+   * @brief rc of the last fast-call function which returned 0 in place of
+   * a handle, on the calling thread
+   */
+  int32_t ffi_last_error()
+  {
+    return fast_rc;
+  }
+
+  /**
+   * @brief like ffi_txn_begin, but returns the handle
+   *
+   * @param[in] fenv MDB_env wrapper, as bytes
+   * @param[in] hparent MDB_txn handle or 0
+   * @param[in] flags
+   * @return uint32_t handle of the new MDB_txn, or 0 on failure, in which
+   *                  case the rc is returned by ffi_last_error()
+   */
+  uint32_t ffi_txn_begin_fast(uint8_t *fenv, uint32_t hparent, uint32_t flags)
+  {
+    uint32_t htxn = 0;
+    fast_rc = ffi_txn_begin(fenv, hparent, flags, &htxn);
+    return fast_rc ? 0 : htxn;
+  }
+
+  /**
+   * @brief like ffi_get, but copies the value into buf
+   *
+   * @param[in] htxn MDB_txn handle
+   * @param[in] dbi MDB_dbi handle
+   * @param[in] key
+   * @param[in] key_size
+   * @param[out] buf buffer to receive the value
+   * @param[in] buf_size size of buf, in bytes
+   * @return int32_t size of the value, which was only copied if it is not
+   *                 larger than buf_size; negative on failure
+   */
+  int32_t ffi_get_fast(uint32_t htxn,
+                       uint32_t dbi,
+                       uint8_t *key,
+                       uint32_t key_size,
+                       uint8_t *buf,
+                       uint32_t buf_size)
+  {
+    MDB_txn *txn = unwrap_txn(htxn);
+    if (!txn)
+      return fast_error(EINVAL);
+    MDB_val k = {key_size, key}, data;
+    int rc = mdb_get(txn, (MDB_dbi)dbi, &k, &data);
+    DEBUG_PRINT(("ffi_get_fast(%p, %d): %d\n", txn, dbi, rc));
+    if (rc)
+      return fast_error(rc);
+    if (data.mv_size > INT32_MAX)
+      return fast_error(ENOMEM);
+    if (data.mv_size <= buf_size)
+      memcpy(buf, data.mv_data, data.mv_size);
+    return (int32_t)data.mv_size;
+  }
+
+  /**
+   * @brief like ffi_put, with plain buffers for key and data
+   * @return int32_t 0 on success, non-zero otherwise
+   */
+  int32_t ffi_put_fast(uint32_t htxn,
+                       uint32_t dbi,
+                       uint8_t *key,
+                       uint32_t key_size,
+                       uint8_t *data,
+                       uint32_t data_size,
+                       uint32_t flags)
+  {
+    MDB_txn *txn = unwrap_txn(htxn);
+    if (!txn)
+      return EINVAL;
+    MDB_val k = {key_size, key}, d = {data_size, data};
+    int rc = mdb_put(txn, (MDB_dbi)dbi, &k, &d, (unsigned int)flags);
+    DEBUG_PRINT(("ffi_put_fast(%p, %d, 0x%x): %d\n", txn, dbi, flags, rc));
+    return (int32_t)rc;
+  }
+
+  /**
+   * @brief like ffi_del, with a plain buffer for key, for all data items
+   * @return int32_t 0 on success, non-zero otherwise
+   */
+  int32_t ffi_del_fast(uint32_t htxn,
+                       uint32_t dbi,
+                       uint8_t *key,
+                       uint32_t key_size)
+  {
+    MDB_txn *txn = unwrap_txn(htxn);
+    if (!txn)
+      return EINVAL;
+    MDB_val k = {key_size, key};
+    int rc = mdb_del(txn, (MDB_dbi)dbi, &k, NULL);
+    DEBUG_PRINT(("ffi_del_fast(%p, %d): %d\n", txn, dbi, rc));
+    return (int32_t)rc;
+  }
+
+  /**
+   * @brief like ffi_cursor_get, but copies the item into buf, in the same
+   * format as ffi_cursor_scan. If it does not fit, call again with
+   * MDB_GET_CURRENT and a larger buffer.
+   *
+   * @param[in] hcursor MDB_cursor handle
+   * @param[in] op cursor operation
+   * @param[in] key key for the SET ops; ignored if key_size is 0
+   * @param[in] key_size
+   * @param[out] buf buffer to receive the item
+   * @param[in] buf_size size of buf, in bytes
+   * @return int32_t size of the item, which was only copied if it is not
+   *                 larger than buf_size; negative on failure
+   */
+  int32_t ffi_cursor_get_fast(uint32_t hcursor,
+                              uint32_t op,
+                              uint8_t *key,
+                              uint32_t key_size,
+                              uint8_t *buf,
+                              uint32_t buf_size)
+  {
+    MDB_cursor *cursor = unwrap_cursor(hcursor);
+    if (!cursor)
+      return fast_error(EINVAL);
+    MDB_val k = {key_size, key}, data = {0, NULL};
+    int rc = mdb_cursor_get(cursor, &k, &data, (MDB_cursor_op)op);
+    DEBUG_PRINT(("ffi_cursor_get_fast(%p, %d): %d\n", cursor, op, rc));
+    if (rc)
+      return fast_error(rc);
+    size_t size = SCAN_HEADER_LEN * sizeof(uint32_t) + k.mv_size + data.mv_size;
+    if (size > INT32_MAX)
+      return fast_error(ENOMEM);
+    size_t used = 0;
+    scan_put(buf, &used, buf_size, &k, &data);
+    return (int32_t)size;
+  }
+
+  ///////////////////////////////////////////////
+  // worker pool
+  ///////////////////////////////////////////////
+
+  /*
+   * A fixed-size pool of threads which runs reads off the JS thread, so that
+   * a page fault on a cold part of the map does not stall the event loop.
+   * Requests are queued in a shared submission ring. Each JS thread is a
+   * client with its own completion ring, into which the id and rc of its
+   * finished requests are queued, and which it drains with a single
+   * nonblocking call, ffi_pool_poll. A JS thread which is done with the
+   * pool, e.g. a worker shutting down, releases its client with
+   * ffi_pool_client_release, so that its slot can be reused.
+   *
+   * A txn or range passed to the pool may be used by a different thread
+   * from the one which began it, so the environment must be opened with
+   * MDB_NOTLS, and the caller must not use it until the request completes.
+   */
+#define POOL_RING_SIZE 1024
+#define POOL_MAX_THREADS 64
+#define POOL_MAX_CLIENTS 256
+
+#define POOL_GET_MANY 0
+#define POOL_SCAN 1
+
+  typedef struct FFI_request
+  {
+    uint32_t op;
+    uint32_t id;
+    uint32_t client;
+    MDB_env *env;
+    /** POOL_GET_MANY: txn handle, or 0 for a one-shot read txn.
+     *  POOL_SCAN: range cursor handle */
+    uint32_t handle;
+    uint32_t dbi;
+    /** POOL_GET_MANY: number of keys. POOL_SCAN: max entries */
+    uint32_t count;
+    uint8_t *keys;
+    /** POOL_GET_MANY: fresults. POOL_SCAN: fbuf */
+    uint8_t *out;
+    uint8_t *values;
+    /** POOL_GET_MANY: size of values. POOL_SCAN: size of fbuf */
+    size_t size;
+    uint32_t *out_count;
+    /** from handle_pin, while the request is in flight, or 0 */
+    uint32_t pinned;
+    /** from env_enter, while the request is in flight */
+    FFI_env_state *entered;
+  } FFI_request;
+
+  typedef struct FFI_completion
+  {
+    uint32_t id;
+    int32_t rc;
+  } FFI_completion;
+
+  typedef struct FFI_pool_client
+  {
+    pthread_cond_t completed;
+    /** requests submitted and not yet polled; updated atomically, since
+     *  the native writer submits without taking the pool mutex */
+    uint32_t in_flight;
+    /** free-running ring positions: head is written, tail is read */
+    uint32_t head, tail;
+    /** set by ffi_pool_client_release; the client is freed once idle */
+    int released;
+    /** ffi_pool_poll calls using the client */
+    int polling;
+    FFI_completion completions[POOL_RING_SIZE];
+  } FFI_pool_client;
+
+  static struct
+  {
+    pthread_mutex_t mutex;
+    pthread_cond_t submitted;
+    uint32_t threads;
+    uint32_t clients;
+    uint32_t head, tail;
+    FFI_request requests[POOL_RING_SIZE];
+    FFI_pool_client *client[POOL_MAX_CLIENTS];
+  } pool = {.mutex = PTHREAD_MUTEX_INITIALIZER,
+            .submitted = PTHREAD_COND_INITIALIZER};
+
+  int pool_run(FFI_request *req)
+  {
+    if (req->op == POOL_SCAN)
+      return ffi_range_scan(req->handle, req->count, req->out, req->size,
+                            req->out_count);
+    if (req->handle)
+      return ffi_get_many(req->handle, req->dbi, req->keys, req->count,
+                          req->out, req->values, req->size);
+    MDB_txn *txn;
+    int rc = txn_activate(req->env);
+    if (rc)
+      return rc;
+    rc = mdb_txn_begin(req->env, NULL, MDB_RDONLY, &txn);
+    if (!rc)
+    {
+      rc = get_many(txn, req->dbi, req->keys, req->count,
+                    req->out, req->values, req->size);
+      mdb_txn_abort(txn);
+    }
+    txn_deactivate(req->env);
+    return rc;
+  }
+
+  /**
+   * @brief free a released client once nothing refers to it any more, so
+   * that its slot can be reused, with pool.mutex held
+   */
+  void pool_client_reap(uint32_t client_id)
+  {
+    FFI_pool_client *client = pool.client[client_id];
+    if (!client->released || client->polling ||
+        __atomic_load_n(&client->in_flight, __ATOMIC_ACQUIRE))
+      return;
+    __atomic_store_n(&pool.client[client_id], NULL, __ATOMIC_RELEASE);
+    pthread_cond_destroy(&client->completed);
+    free(client);
+  }
+
+  /** @brief queue the completion of request id for client, with
+   *  pool.mutex held. That of a released client is dropped. */
+  void pool_complete(uint32_t client_id, uint32_t id, int rc)
+  {
+    FFI_pool_client *client = pool.client[client_id];
+    if (client->released)
+    {
+      __atomic_sub_fetch(&client->in_flight, 1, __ATOMIC_ACQ_REL);
+      pool_client_reap(client_id);
+      return;
+    }
+    FFI_completion *done =
+        &client->completions[client->head++ % POOL_RING_SIZE];
+    done->id = id;
+    done->rc = (int32_t)rc;
+    pthread_cond_signal(&client->completed);
+  }
+
+  /**
+   * @brief reserve a completion slot for a new request of client
+   * @returns EINVAL if client is unknown, EAGAIN if it has a full ring
+   */
+  int pool_reserve(uint32_t client_id)
+  {
+    if (client_id >= POOL_MAX_CLIENTS)
+      return EINVAL;
+    FFI_pool_client *client =
+        __atomic_load_n(&pool.client[client_id], __ATOMIC_ACQUIRE);
+    if (!client || __atomic_load_n(&client->released, __ATOMIC_ACQUIRE))
+      return EINVAL;
+    if (__atomic_add_fetch(&client->in_flight, 1, __ATOMIC_ACQ_REL) >
+        POOL_RING_SIZE)
+    {
+      __atomic_sub_fetch(&client->in_flight, 1, __ATOMIC_ACQ_REL);
+      return EAGAIN;
+    }
+    return MDB_SUCCESS;
+  }
+
+  /** @brief release a slot taken by pool_reserve for a failed submit */
+  void pool_unreserve(uint32_t client_id)
+  {
+    __atomic_sub_fetch(&pool.client[client_id]->in_flight, 1, __ATOMIC_ACQ_REL);
+  }
+
+  void *pool_worker(void *arg)
+  {
+    pthread_mutex_lock(&pool.mutex);
+    for (;;)
+    {
+      while (pool.tail == pool.head)
+        pthread_cond_wait(&pool.submitted, &pool.mutex);
+      FFI_request req = pool.requests[pool.tail++ % POOL_RING_SIZE];
+      pthread_mutex_unlock(&pool.mutex);
+      int rc = pool_run(&req);
+      DEBUG_PRINT(("pool_worker: request %d, op %d: %d\n", req.id, req.op, rc));
+      if (req.pinned)
+        handle_unpin(req.pinned);
+      env_leave(req.entered);
+      pthread_mutex_lock(&pool.mutex);
+      pool_complete(req.client, req.id, rc);
+    }
+    return NULL;
+  }
+
+  /**
+   * @brief start the worker pool, or grow it to the given number of threads
+   * @param[in] threads
+   * @return int32_t 0 on success, non-zero otherwise
+   */
+  int32_t ffi_pool_start(uint32_t threads)
+  {
+    int rc = MDB_SUCCESS;
+    if (threads > POOL_MAX_THREADS)
+      threads = POOL_MAX_THREADS;
+    pthread_mutex_lock(&pool.mutex);
+    while (pool.threads < threads)
+    {
+      pthread_t thread;
+      rc = pthread_create(&thread, NULL, pool_worker, NULL);
+      if (rc)
+        break;
+      pthread_detach(thread);
+      pool.threads++;
+    }
+    pthread_mutex_unlock(&pool.mutex);
+    DEBUG_PRINT(("ffi_pool_start(%d): %d\n", threads, rc));
+    return (int32_t)rc;
+  }
+
+  /**
+   * @brief register the calling JS thread as a client of the worker pool
+   * @param[out] client id of the new client
+   * @return int32_t 0 on success, non-zero otherwise
+   */
+  int32_t ffi_pool_client(uint32_t *client)
+  {
+    FFI_pool_client *new_client = calloc(1, sizeof(FFI_pool_client));
+    if (!new_client)
+      return ENOMEM;
+    pthread_cond_init(&new_client->completed, NULL);
+    pthread_mutex_lock(&pool.mutex);
+    /* reuse the slot of a released client, if there is one */
+    uint32_t id = 0;
+    while (id < pool.clients && pool.client[id])
+      id++;
+    if (id == POOL_MAX_CLIENTS)
+    {
+      pthread_mutex_unlock(&pool.mutex);
+      pthread_cond_destroy(&new_client->completed);
+      free(new_client);
+      return ENOMEM;
+    }
+    if (id == pool.clients)
+      pool.clients++;
+    *client = id;
+    __atomic_store_n(&pool.client[id], new_client, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&pool.mutex);
+    return MDB_SUCCESS;
+  }
+
+  /**
+   * @brief unregister a client of the worker pool, when its JS thread
+   * is done with the pool. The completions of its requests still in
+   * flight are dropped, and its slot is reused once they are done. The
+   * client must not submit any more requests.
+   *
+   * @param[in] client from ffi_pool_client
+   * @return int32_t 0 on success, EINVAL if client is unknown
+   */
+  int32_t ffi_pool_client_release(uint32_t client)
+  {
+    if (client >= POOL_MAX_CLIENTS)
+      return EINVAL;
+    pthread_mutex_lock(&pool.mutex);
+    FFI_pool_client *c = pool.client[client];
+    if (!c || c->released)
+    {
+      pthread_mutex_unlock(&pool.mutex);
+      return EINVAL;
+    }
+    __atomic_store_n(&c->released, 1, __ATOMIC_RELEASE);
+    __atomic_sub_fetch(&c->in_flight, c->head - c->tail, __ATOMIC_ACQ_REL);
+    c->tail = c->head;
+    /* a poll still waiting returns with nothing */
+    pthread_cond_broadcast(&c->completed);
+    pool_client_reap(client);
+    pthread_mutex_unlock(&pool.mutex);
+    DEBUG_PRINT(("ffi_pool_client_release(%d)\n", client));
+    return MDB_SUCCESS;
+  }
+
+  int pool_submit(FFI_request *req)
+  {
+    if (req->handle && !(req->pinned = handle_pin(req->handle, &req->env)))
+      return EINVAL;
+    int rc = env_enter(req->env, &req->entered);
+    if (!rc && (rc = pool_reserve(req->client)))
+      env_leave(req->entered);
+    if (rc)
+    {
+      if (req->pinned)
+        handle_unpin(req->pinned);
+      return rc;
+    }
+    pthread_mutex_lock(&pool.mutex);
+    if (!pool.threads)
+      rc = EINVAL;
+    else if (pool.head - pool.tail == POOL_RING_SIZE)
+      rc = EAGAIN;
+    else
+    {
+      pool.requests[pool.head++ % POOL_RING_SIZE] = *req;
+      pthread_cond_signal(&pool.submitted);
+    }
+    pthread_mutex_unlock(&pool.mutex);
+    if (rc)
+    {
+      pool_unreserve(req->client);
+      env_leave(req->entered);
+      if (req->pinned)
+        handle_unpin(req->pinned);
+    }
+    return rc;
+  }
+
+  /**
+   * @brief queue ffi_get_many on the worker pool
+   *
+   * @param[in] client from ffi_pool_client
+   * @param[in] id returned by ffi_pool_poll once the request completes
+   * @param[in] fenv MDB_env wrapper
+   * @param[in] htxn MDB_txn handle, or 0 to use a one-shot read txn
+   * @see ffi_get_many for the other parameters, which must stay valid
+   *      until the request completes
+   * @return int32_t 0 if queued, EAGAIN if the pool is full, non-zero
+   *                 otherwise
+   */
+  int32_t ffi_pool_get_many(uint32_t client,
+                            uint32_t id,
+                            uint8_t *fenv,
+                            uint32_t htxn,
+                            uint32_t dbi,
+                            uint8_t *fkeys,
+                            uint32_t count,
+                            uint8_t *fresults,
+                            uint8_t *fvalues,
+                            size_t values_size)
+  {
+    FFI_request req = {0};
+    req.op = POOL_GET_MANY;
+    req.id = id;
+    req.client = client;
+    req.env = unwrap_env(fenv);
+    req.handle = htxn;
+    req.dbi = dbi;
+    req.count = count;
+    req.keys = fkeys;
+    req.out = fresults;
+    req.values = fvalues;
+    req.size = values_size;
+    return (int32_t)pool_submit(&req);
+  }
+
+  /**
+   * @brief queue ffi_range_scan on the worker pool
+   *
+   * @param[in] client from ffi_pool_client
+   * @param[in] id returned by ffi_pool_poll once the request completes
+   * @param[in] hrange range cursor handle
+   * @see ffi_range_scan for the other parameters, which must stay valid
+   *      until the request completes
+   * @return int32_t 0 if queued, EAGAIN if the pool is full, non-zero
+   *                 otherwise
+   */
+  int32_t ffi_pool_scan(uint32_t client,
+                        uint32_t id,
+                        uint32_t hrange,
+                        uint32_t max_entries,
+                        uint8_t *fbuf,
+                        size_t buf_size,
+                        uint32_t *count)
+  {
+    FFI_request req = {0};
+    req.op = POOL_SCAN;
+    req.id = id;
+    req.client = client;
+    req.handle = hrange;
+    req.count = max_entries;
+    req.out = fbuf;
+    req.size = buf_size;
+    req.out_count = count;
+    return (int32_t)pool_submit(&req);
+  }
+
+  /**
+   * @brief wait for at least one of the client's requests to complete,
+   * unless none are in flight, then drain up to max completions
+   *
+   * @param[in] client from ffi_pool_client
+   * @param[out] fcompletions (id, rc) pairs of int32_t
+   * @param[in] max
+   * @return int32_t number of completions written into fcompletions
+   */
+  int32_t ffi_pool_poll(uint32_t client, int32_t *fcompletions, uint32_t max)
+  {
+    uint32_t found = 0;
+    if (client >= POOL_MAX_CLIENTS)
+      return 0;
+    pthread_mutex_lock(&pool.mutex);
+    FFI_pool_client *c = pool.client[client];
+    if (!c)
+    {
+      pthread_mutex_unlock(&pool.mutex);
+      return 0;
+    }
+    c->polling++;
+    while (!c->released && __atomic_load_n(&c->in_flight, __ATOMIC_ACQUIRE) &&
+           c->tail == c->head)
+      pthread_cond_wait(&c->completed, &pool.mutex);
+    while (found < max && c->tail != c->head)
+    {
+      FFI_completion *done = &c->completions[c->tail++ % POOL_RING_SIZE];
+      fcompletions[found * 2] = (int32_t)done->id;
+      fcompletions[found * 2 + 1] = done->rc;
+      __atomic_sub_fetch(&c->in_flight, 1, __ATOMIC_ACQ_REL);
+      found++;
+    }
+    c->polling--;
+    pool_client_reap(client);
+    pthread_mutex_unlock(&pool.mutex);
+    return (int32_t)found;
+  }
+
+  ///////////////////////////////////////////////
+  // native writer
+  ///////////////////////////////////////////////
+
+  /*
+   * A single thread per env which applies serialized write batches (see
+   * apply_batch), so that JS threads never block on LMDB's write mutex.
+   * Any thread submits into a bounded lock-free multi-producer ring, and
+   * wakes the writer with a semaphore. The writer applies every batch it
+   * finds in one write txn, each in a child txn of its own so that a
+   * failed batch does not affect the others, commits, and then completes
+   * each request through its pool client (see ffi_pool_client), so that
+   * a JS thread collects pool and writer results with one ffi_pool_poll.
+   * LMDB has no nested txns under MDB_WRITEMAP, so there each batch is
+   * committed in a write txn of its own instead.
+   */
+#define WRITER_RING_SIZE 1024
+/** most batches committed together in one write txn */
+#define WRITER_MAX_GROUP 64
+
+  typedef struct FFI_write
+  {
+    uint32_t client;
+    uint32_t id;
+    uint8_t *batch;
+    uint32_t count;
+    int32_t *results;
+  } FFI_write;
+
+  typedef struct FFI_write_cell
+  {
+    size_t sequence;
+    FFI_write write;
+  } FFI_write_cell;
+
+  struct FFI_writer
+  {
+    MDB_env *env;
+    /** the env has MDB_WRITEMAP: one top-level txn per batch */
+    int writemap;
+    pthread_t thread;
+    sem_t wake;
+    int stop;
+    size_t enqueue_pos;
+    /** only touched by the writer thread */
+    size_t dequeue_pos;
+    FFI_write_cell cells[WRITER_RING_SIZE];
+  };
+
+  /** @returns 0, or EAGAIN if the ring is full */
+  int writer_push(FFI_writer *writer, FFI_write *write)
+  {
+    size_t pos = __atomic_load_n(&writer->enqueue_pos, __ATOMIC_RELAXED);
+    FFI_write_cell *cell;
+    for (;;)
+    {
+      cell = &writer->cells[pos % WRITER_RING_SIZE];
+      size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+      intptr_t dif = (intptr_t)sequence - (intptr_t)pos;
+      if (dif == 0)
+      {
+        if (__atomic_compare_exchange_n(&writer->enqueue_pos, &pos, pos + 1,
+                                        1, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED))
+          break;
+      }
+      else if (dif < 0)
+        return EAGAIN;
+      else
+        pos = __atomic_load_n(&writer->enqueue_pos, __ATOMIC_RELAXED);
+    }
+    cell->write = *write;
+    __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+    return MDB_SUCCESS;
+  }
+
+  /** @returns 1 if a write was taken off the ring, 0 if it is empty */
+  int writer_pop(FFI_writer *writer, FFI_write *write)
+  {
+    size_t pos = writer->dequeue_pos;
+    FFI_write_cell *cell = &writer->cells[pos % WRITER_RING_SIZE];
+    size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+    if (sequence != pos + 1)
+      return 0;
+    *write = cell->write;
+    writer->dequeue_pos = pos + 1;
+    __atomic_store_n(&cell->sequence, pos + WRITER_RING_SIZE,
+                     __ATOMIC_RELEASE);
+    return 1;
+  }
+
+  /**
+   * @brief apply a group of writes popped off the ring, and set rcs[i] to
+   * the rc of each
+   * @returns the rc of the write txn shared by the group, if any
+   */
+  int writer_apply(FFI_writer *writer, FFI_write *group, uint32_t count,
+                   int *rcs)
+  {
+    MDB_txn *txn;
+    if (writer->writemap)
+    {
+      for (uint32_t i = 0; i < count; i++)
+      {
+        rcs[i] = write_txn_begin(writer->env, &txn);
+        if (rcs[i])
+          continue;
+        rcs[i] = apply_batch(txn, group[i].batch, group[i].count,
+                             group[i].results);
+        if (rcs[i])
+          mdb_txn_abort(txn);
+        else
+          rcs[i] = mdb_txn_commit(txn);
+        write_txn_end(writer->env);
+      }
+      return MDB_SUCCESS;
+    }
+    int rc = write_txn_begin(writer->env, &txn);
+    for (uint32_t i = 0; i < count; i++)
+    {
+      MDB_txn *child;
+      rcs[i] = rc ? rc : mdb_txn_begin(writer->env, txn, 0, &child);
+      if (rcs[i])
+        continue;
+      rcs[i] = apply_batch(child, group[i].batch, group[i].count,
+                           group[i].results);
+      if (rcs[i])
+        mdb_txn_abort(child);
+      else
+        rcs[i] = mdb_txn_commit(child);
+    }
+    if (!rc)
+    {
+      rc = mdb_txn_commit(txn);
+      write_txn_end(writer->env);
+    }
+    return rc;
+  }
+
+  void *writer_thread(void *arg)
+  {
+    FFI_writer *writer = (FFI_writer *)arg;
+    FFI_write group[WRITER_MAX_GROUP];
+    int rcs[WRITER_MAX_GROUP];
+    for (;;)
+    {
+      sem_wait(&writer->wake);
+      uint32_t count = 0;
+      while (count < WRITER_MAX_GROUP && writer_pop(writer, &group[count]))
+        count++;
+      if (!count)
+      {
+        if (__atomic_load_n(&writer->stop, __ATOMIC_ACQUIRE))
+          break;
+        continue;
+      }
+      /* take back the wakeups of the extra writes just popped */
+      for (uint32_t i = 1; i < count; i++)
+        sem_trywait(&writer->wake);
+      int rc = writer_apply(writer, group, count, rcs);
+      DEBUG_PRINT(("writer_thread(%p): %d batches, %d\n", writer->env,
+                   count, rc));
+      pthread_mutex_lock(&pool.mutex);
+      for (uint32_t i = 0; i < count; i++)
+        pool_complete(group[i].client, group[i].id, rc ? rc : rcs[i]);
+      pthread_mutex_unlock(&pool.mutex);
+    }
+    return NULL;
+  }
+
+  /**
+   * @brief start the native writer of env, if it is not running yet
+   * @param[in] fenv MDB_env wrapper
+   * @return int32_t 0 on success, non-zero otherwise
+   */
+  int32_t ffi_writer_start(uint8_t *fenv)
+  {
+    FFI_env_state *state = env_state(unwrap_env(fenv));
+    if (!state)
+      return ENOMEM;
+    int rc = MDB_SUCCESS;
+    pthread_mutex_lock(&state->mutex);
+    if (!state->writer)
+    {
+      FFI_writer *writer = calloc(1, sizeof(FFI_writer));
+      if (!writer)
+        rc = ENOMEM;
+      else
+      {
+        unsigned int flags = 0;
+        mdb_env_get_flags(state->env, &flags);
+        writer->env = state->env;
+        writer->writemap = (flags & MDB_WRITEMAP) != 0;
+        for (size_t i = 0; i < WRITER_RING_SIZE; i++)
+          writer->cells[i].sequence = i;
+        sem_init(&writer->wake, 0, 0);
+        rc = pthread_create(&writer->thread, NULL, writer_thread, writer);
+        if (rc)
+        {
+          sem_destroy(&writer->wake);
+          free(writer);
+        }
+        else
+          __atomic_store_n(&state->writer, writer, __ATOMIC_RELEASE);
+      }
+    }
+    pthread_mutex_unlock(&state->mutex);
+    DEBUG_PRINT(("ffi_writer_start(%p): %d\n", state->env, rc));
+    return (int32_t)rc;
+  }
+
+  /**
+   * @brief queue a serialized write batch (see apply_batch) on the native
+   * writer of env. Its rc is returned by ffi_pool_poll once it has been
+   * committed, without a sync.
+   *
+   * @param[in] client from ffi_pool_client
+   * @param[in] id returned by ffi_pool_poll once the batch completes
+   * @param[in] fenv MDB_env wrapper, whose writer has been started
+   * @param[in] fbatch serialized ops, valid until the batch completes
+   * @param[in] count number of ops in fbatch
+   * @param[out] results one rc per op
+   * @return int32_t 0 if queued, EAGAIN if the ring is full, EINVAL if
+   *                 the writer is not running, non-zero otherwise
+   */
+  int32_t ffi_writer_submit(uint32_t client,
+                            uint32_t id,
+                            uint8_t *fenv,
+                            uint8_t *fbatch,
+                            uint32_t count,
+                            int32_t *results)
+  {
+    FFI_env_state *state = env_state(unwrap_env(fenv));
+    if (!state)
+      return EINVAL;
+    int rc = pool_reserve(client);
+    if (rc)
+      return rc;
+    FFI_write write = {client, id, fbatch, count, results};
+    /* counted before the writer is loaded, so that ffi_writer_stop either
+     * sees this submit, or this submit sees the writer gone */
+    __atomic_add_fetch(&state->writer_users, 1, __ATOMIC_SEQ_CST);
+    FFI_writer *writer = __atomic_load_n(&state->writer, __ATOMIC_SEQ_CST);
+    rc = writer ? writer_push(writer, &write) : EINVAL;
+    if (!rc)
+      sem_post(&writer->wake);
+    __atomic_sub_fetch(&state->writer_users, 1, __ATOMIC_SEQ_CST);
+    if (rc)
+      pool_unreserve(client);
+    return (int32_t)rc;
+  }
+
+  void ffi_writer_stop(uint8_t *fenv)
+  {
+    FFI_env_state *state = env_state(unwrap_env(fenv));
+    if (!state)
+      return;
+    pthread_mutex_lock(&state->mutex);
+    FFI_writer *writer = state->writer;
+    __atomic_store_n(&state->writer, NULL, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&state->mutex);
+    if (!writer)
+      return;
+    /* a submit which loaded the writer only pushes and posts, so this
+     * wait is short */
+    while (__atomic_load_n(&state->writer_users, __ATOMIC_SEQ_CST))
+      sched_yield();
+    /* batches already queued are still written; no more can be queued */
+    __atomic_store_n(&writer->stop, 1, __ATOMIC_RELEASE);
+    sem_post(&writer->wake);
+    pthread_join(writer->thread, NULL);
+    /* should any batch still be on the ring, complete it, or its client
+     * would wait on it forever */
+    FFI_write write;
+    pthread_mutex_lock(&pool.mutex);
+    while (writer_pop(writer, &write))
+      pool_complete(write.client, write.id, ECANCELED);
+    pthread_mutex_unlock(&pool.mutex);
+    sem_destroy(&writer->wake);
+    free(writer);
+  }
+
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
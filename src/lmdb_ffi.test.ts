@@ -1,6 +1,10 @@
 import * as log from "https://deno.land/std@0.129.0/log/mod.ts";
 import { ensureDir } from "https://deno.land/std@0.130.0/fs/mod.ts";
 import {
+  ALLOC_ALLOCATED,
+  ALLOC_FILE_SIZE,
+  ALLOC_LEN,
+  ALLOC_USED,
   SYNC_DONT_FORCE,
   FLAGS_OFF,
   FLAGS_ON,
@@ -11,6 +15,10 @@ import {
   MDB_NOOVERWRITE,
   MDB_RDONLY,
   CursorOp,
+  RANGE_EXCLUDE_END,
+  SWEEP_ALL,
+  fast,
+  fastError,
 } from "./lmdb_ffi.ts";
 
 // deno-lint-ignore no-explicit-any
@@ -82,6 +90,14 @@ logDebug({
   err: iferror(rc),
 });
 
+// ffi_env_set_flush_threads()
+rc = lmdb.ffi_env_set_flush_threads(fenv, 4);
+logDebug({
+  m: "after ffi_env_set_flush_threads()",
+  rc,
+  err: iferror(rc),
+});
+
 // ffi_env_set_maxdbs()
 rc = lmdb.ffi_env_set_maxdbs(fenv, 8);
 logDebug({
@@ -166,6 +182,22 @@ logDebug({
   err: iferror(rc),
 });
 
+// ffi_env_sync_committed(), twice at once, sharing one sync
+const synced = await Promise.all([
+  lmdb.ffi_env_sync_committed(fenv),
+  lmdb.ffi_env_sync_committed(fenv),
+]);
+logDebug({ m: "after ffi_env_sync_committed() x2", synced });
+
+// ffi_env_durable_txnid(), ffi_env_wait_durable()
+rc = await lmdb.ffi_env_wait_durable(fenv, finfo[INFO_LAST_TXNID]);
+logDebug({
+  m: "after ffi_env_wait_durable()",
+  rc,
+  err: iferror(rc),
+  durable: lmdb.ffi_env_durable_txnid(fenv),
+});
+
 // ffi_env_set_flags()
 rc = lmdb.ffi_env_set_flags(fenv, MDB_NOMETASYNC, FLAGS_ON);
 logDebug({
@@ -233,6 +265,47 @@ logDebug({
   numReaders: finfo[INFO_NUMREADERS],
 });
 
+// ffi_env_grow(): no txn is active, so it need not wait
+const fmapsize = new Float64Array(1);
+rc = lmdb.ffi_env_grow(fenv, DEFAULT_MAPSIZE * 4, 0, fmapsize);
+logDebug({
+  m: "after ffi_env_grow()",
+  rc,
+  err: iferror(rc),
+  mapsize: fmapsize[0],
+});
+
+// ffi_env_grow() resets a parked read txn rather than wait for it, and
+// ffi_txn_unpark() renews it
+const parkedTxn = new Uint32Array(1);
+rc = lmdb.ffi_txn_begin(fenv, 0, MDB_RDONLY, parkedTxn);
+rc = lmdb.ffi_txn_park(parkedTxn[0]);
+rc = lmdb.ffi_env_grow(fenv, DEFAULT_MAPSIZE * 5, 0, fmapsize);
+logDebug({ m: "after ffi_env_grow(parked txn)", rc, err: iferror(rc) });
+const unparked = new Uint32Array(1);
+rc = lmdb.ffi_txn_unpark(parkedTxn[0], 0, unparked);
+logDebug({
+  m: "after ffi_txn_unpark()",
+  rc,
+  err: iferror(rc),
+  renewed: unparked[0],
+});
+lmdb.ffi_txn_abort(parkedTxn[0]);
+
+// ffi_env_preallocate(), ffi_env_alloc_info()
+rc = await lmdb.ffi_env_preallocate(fenv, DEFAULT_MAPSIZE);
+logDebug({ m: "after ffi_env_preallocate()", rc, err: iferror(rc) });
+const falloc = new Float64Array(ALLOC_LEN);
+rc = lmdb.ffi_env_alloc_info(fenv, falloc);
+logDebug({
+  m: "after ffi_env_alloc_info()",
+  rc,
+  err: iferror(rc),
+  used: falloc[ALLOC_USED],
+  allocated: falloc[ALLOC_ALLOCATED],
+  fileSize: falloc[ALLOC_FILE_SIZE],
+});
+
 // ffi_env_get_maxreaders()
 const readers = new Uint32Array(1);
 rc = lmdb.ffi_env_get_maxreaders(fenv, readers);
@@ -271,8 +344,8 @@ logDebug({
 });
 
 // ffi_txn_begin()
-const ftxn = new BigUint64Array(1);
-rc = lmdb.ffi_txn_begin(fenv, null, 0, ftxn);
+const ftxn = new Uint32Array(1);
+rc = lmdb.ffi_txn_begin(fenv, 0, 0, ftxn);
 logDebug({
   m: "after ffi_txn_begin()",
   rc,
@@ -282,8 +355,8 @@ logDebug({
 });
 
 // child transaction
-const fchild = new BigUint64Array(1);
-rc = lmdb.ffi_txn_begin(fenv, ftxn, 0, fchild);
+const fchild = new Uint32Array(1);
+rc = lmdb.ffi_txn_begin(fenv, ftxn[0], 0, fchild);
 logDebug({
   m: "after ffi_txn_begin(): child",
   rc,
@@ -294,7 +367,7 @@ logDebug({
 });
 
 // ffi_txn_env()
-const fenv2 = new BigUint64Array([BigInt(lmdb.ffi_txn_env(ftxn))]);
+const fenv2 = new BigUint64Array([BigInt(lmdb.ffi_txn_env(ftxn[0]))]);
 logDebug({
   m: "after ffi_txn_env(ftxn)",
   env2: `0x${fenv2[0].toString(16)}`,
@@ -310,19 +383,19 @@ logDebug({
 });
 
 // ffi_txn_id()
-const txnid = lmdb.ffi_txn_id(fchild);
+const txnid = lmdb.ffi_txn_id(fchild[0]);
 logDebug({
   m: "after ffi_txn_id(fchild)",
   txnid,
 });
 
 // ffi_txn_abort()
-lmdb.ffi_txn_abort(fchild);
+lmdb.ffi_txn_abort(fchild[0]);
 logDebug({ m: "after ffi_txn_abort(fchild)" });
 
 // ffi_dbi_open()
 const fdbi = new Uint32Array(1);
-rc = lmdb.ffi_dbi_open(ftxn, null, 0, fdbi);
+rc = lmdb.ffi_dbi_open(ftxn[0], null, 0, fdbi);
 const dbi = fdbi[0];
 logDebug({
   m: "after ffi_dbi_open(null)",
@@ -335,7 +408,7 @@ const fdbi2 = new Uint32Array(1);
 const name = "test";
 const dbname = encoder.encode(name);
 const fname = wrapValue(dbname);
-rc = lmdb.ffi_dbi_open(ftxn, fname, MDB_CREATE, fdbi2);
+rc = lmdb.ffi_dbi_open(ftxn[0], fname, MDB_CREATE, fdbi2);
 const dbi2 = fdbi2[0];
 logDebug({
   m: `after ffi_dbi_open()`,
@@ -348,7 +421,7 @@ logDebug({
 // ffi_dbi_drop()
 export const DROP_EMPTY = 0;
 export const DROP_DELETE = 1;
-rc = lmdb.ffi_drop(ftxn, dbi2, DROP_DELETE);
+rc = lmdb.ffi_drop(ftxn[0], dbi2, DROP_DELETE);
 logDebug({
   m: "after ffi_dbi_drop()",
   rc,
@@ -366,7 +439,7 @@ logDebug({
 
 // ffi_dbi_stat()
 fstat = new Float64Array(STAT_LEN);
-rc = lmdb.ffi_stat(ftxn, dbi, fstat);
+rc = lmdb.ffi_stat(ftxn[0], dbi, fstat);
 logDebug({
   m: "after ffi_stat()",
   rc,
@@ -381,7 +454,7 @@ logDebug({
 });
 
 // ffi_dbi_flags()
-rc = lmdb.ffi_dbi_flags(ftxn, dbi, flags);
+rc = lmdb.ffi_dbi_flags(ftxn[0], dbi, flags);
 logDebug({
   m: "after ffi_dbi_flags()",
   rc,
@@ -395,7 +468,7 @@ let key = "hello";
 const keyEncoded = encoder.encode(key);
 let fkey = wrapValue(keyEncoded);
 let fdata = new BigUint64Array(2);
-rc = lmdb.ffi_get(ftxn, dbi, fkey, fdata);
+rc = lmdb.ffi_get(ftxn[0], dbi, fkey, fdata);
 let dataBuf = unwrapValue(fdata);
 logDebug({
   m: "after ffi_get()",
@@ -409,7 +482,7 @@ logDebug({
 let data = "earth";
 fkey = wrapValue(keyEncoded);
 fdata = wrapValue(encoder.encode(data));
-rc = lmdb.ffi_put(ftxn, dbi, fkey, fdata, 0);
+rc = lmdb.ffi_put(ftxn[0], dbi, fkey, fdata, 0);
 dataBuf = unwrapValue(fdata);
 logDebug({
   m: "after ffi_put()",
@@ -423,7 +496,7 @@ logDebug({
 data = "alpha proxima";
 fkey = wrapValue(keyEncoded);
 fdata = wrapValue(encoder.encode(data));
-rc = lmdb.ffi_put(ftxn, dbi, fkey, fdata, MDB_NOOVERWRITE);
+rc = lmdb.ffi_put(ftxn[0], dbi, fkey, fdata, MDB_NOOVERWRITE);
 dataBuf = unwrapValue(fdata);
 logDebug({
   m: "after ffi_put(MDB_NOOVERWRITE)",
@@ -434,7 +507,7 @@ logDebug({
 });
 
 // ffi_del()
-rc = lmdb.ffi_del(ftxn, dbi, fkey, null, 0);
+rc = lmdb.ffi_del(ftxn[0], dbi, fkey, null, 0);
 logDebug({
   m: "after ffi_del()",
   rc,
@@ -443,23 +516,27 @@ logDebug({
 });
 
 // ffi_cursor_open
-const readTxn = new BigUint64Array(1);
-rc = lmdb.ffi_txn_begin(fenv, null, MDB_RDONLY, readTxn);
+const readTxn = new Uint32Array(1);
+rc = lmdb.ffi_txn_begin(fenv, 0, MDB_RDONLY, readTxn);
 logDebug({ m: "ffi_txn_begin", rc, err: iferror(rc) });
-const readCursor = new BigUint64Array(1);
-rc = lmdb.ffi_cursor_open(readTxn, dbi, readCursor);
+const readCursor = new Uint32Array(1);
+rc = lmdb.ffi_cursor_open(readTxn[0], dbi, readCursor);
 logDebug({
   m: "after ffi_cursor_open",
   dbi,
   readCursor: `0x${readCursor[0].toString(16)}`,
 });
 
-// ffi_cursor_close
-lmdb.ffi_cursor_close(readCursor);
-logDebug({ m: "after ffi_cursor_close" });
-
 // ffi_cursor_renew
-rc = lmdb.ffi_cursor_renew(readTxn, readCursor);
+lmdb.ffi_txn_reset(readTxn[0]);
+rc = lmdb.ffi_txn_renew(readTxn[0]);
+logDebug({ m: "ffi_txn_renew", rc, err: iferror(rc) });
+
+// ffi_txn_refresh
+const renewed = new Uint32Array(1);
+rc = lmdb.ffi_txn_refresh(readTxn[0], 0, renewed);
+logDebug({ m: "ffi_txn_refresh", rc, err: iferror(rc), renewed: renewed[0] });
+rc = lmdb.ffi_cursor_renew(readTxn[0], readCursor[0]);
 logDebug({
   m: "after ffi_cursor_renew",
   rc,
@@ -467,50 +544,62 @@ logDebug({
 });
 
 // ffi_cursor_txn
-const txnAddr = lmdb.ffi_cursor_txn(readCursor);
+const cursorTxn = lmdb.ffi_cursor_txn(readCursor[0]);
 logDebug({
   m: "after ffi_cursor_txn(readCursor)",
-  txnAddr: `0x${txnAddr.toString(16)}`,
+  cursorTxn: `0x${cursorTxn.toString(16)}`,
+  isReadTxn: cursorTxn === readTxn[0],
 });
-lmdb.ffi_cursor_close(readCursor);
-lmdb.ffi_txn_abort(readTxn);
 
 // ffi_cursor_dbi
 logDebug({
   m: "ffi_cursor_dbi()",
-  dbi: lmdb.ffi_cursor_dbi(readCursor),
+  dbi: lmdb.ffi_cursor_dbi(readCursor[0]),
 });
 
+// ffi_cursor_close
+lmdb.ffi_cursor_close(readCursor[0]);
+logDebug({ m: "after ffi_cursor_close" });
+
+// a closed cursor's handle is stale, and fails with EINVAL
+rc = lmdb.ffi_cursor_renew(readTxn[0], readCursor[0]);
+logDebug({
+  m: "after ffi_cursor_renew(closed cursor)",
+  rc,
+  err: iferror(rc),
+});
+lmdb.ffi_txn_abort(readTxn[0]);
+
 // populate
 key = "a";
 fkey = wrapValue(encoder.encode(key));
 data = "apple";
 fdata = wrapValue(encoder.encode(data));
-rc = lmdb.ffi_put(ftxn, dbi, fkey, fdata, 0);
+rc = lmdb.ffi_put(ftxn[0], dbi, fkey, fdata, 0);
 logDebug({ m: "ffi_put()", rc, err: iferror(rc), key, data });
 
 key = "c";
 fkey = wrapValue(encoder.encode(key));
 data = "cherry";
 fdata = wrapValue(encoder.encode(data));
-rc = lmdb.ffi_put(ftxn, dbi, fkey, fdata, 0);
+rc = lmdb.ffi_put(ftxn[0], dbi, fkey, fdata, 0);
 logDebug({ m: "ffi_put()", rc, err: iferror(rc), key, data });
 
 key = "b";
 fkey = wrapValue(encoder.encode(key));
 data = "banana";
 fdata = wrapValue(encoder.encode(data));
-rc = lmdb.ffi_put(ftxn, dbi, fkey, fdata, 0);
+rc = lmdb.ffi_put(ftxn[0], dbi, fkey, fdata, 0);
 logDebug({ m: "ffi_put()", rc, err: iferror(rc), key, data });
 
 // Loop cursor
-const cursor = new BigUint64Array(1);
-rc = lmdb.ffi_cursor_open(ftxn, dbi, cursor);
+const cursor = new Uint32Array(1);
+rc = lmdb.ffi_cursor_open(ftxn[0], dbi, cursor);
 logDebug({ m: "ffi_cursor_open()", rc, err: iferror(rc), dbi });
 
 while (!rc) {
   // ffi_cursor_get
-  rc = lmdb.ffi_cursor_get(cursor, fkey, fdata, CursorOp.NEXT);
+  rc = lmdb.ffi_cursor_get(cursor[0], fkey, fdata, CursorOp.NEXT);
   key = decoder.decode(unwrapValue(fkey));
   data = decoder.decode(unwrapValue(fdata));
   logDebug({ m: "ffi_cursor_get()", rc, err: iferror(rc), key, data });
@@ -521,7 +610,7 @@ while (!rc) {
   data += " foo";
   fkey = wrapValue(encoder.encode(key));
   fdata = wrapValue(encoder.encode(data));
-  rc = lmdb.ffi_cursor_put(cursor, fkey, fdata, 0);
+  rc = lmdb.ffi_cursor_put(cursor[0], fkey, fdata, 0);
   key = decoder.decode(unwrapValue(fkey));
   data = decoder.decode(unwrapValue(fdata));
   logDebug({ m: "ffi_cursor_put()", rc, err: iferror(rc), key, data });
@@ -529,12 +618,12 @@ while (!rc) {
 log.info({
   m: "after cursor NEXT loop",
 });
-rc = lmdb.ffi_cursor_get(cursor, fkey, fdata, CursorOp.LAST);
+rc = lmdb.ffi_cursor_get(cursor[0], fkey, fdata, CursorOp.LAST);
 while (!rc) {
   key = decoder.decode(unwrapValue(fkey));
   data = decoder.decode(unwrapValue(fdata));
   logDebug({ m: "ffi_cursor_get()", rc, err: iferror(rc), key, data });
-  rc = lmdb.ffi_cursor_get(cursor, fkey, fdata, CursorOp.PREV);
+  rc = lmdb.ffi_cursor_get(cursor[0], fkey, fdata, CursorOp.PREV);
 }
 log.info({
   m: "after cursor PREV loop",
@@ -543,7 +632,7 @@ log.info({
 // ffi_cursor_get(): SET (exists)
 fkey = wrapValue(encoder.encode("b"));
 fdata = new BigUint64Array(2);
-rc = lmdb.ffi_cursor_get(cursor, fkey, fdata, CursorOp.SET);
+rc = lmdb.ffi_cursor_get(cursor[0], fkey, fdata, CursorOp.SET);
 log.info({
   m: "after ffi_cursor_get('b', SET)",
   rc,
@@ -555,7 +644,7 @@ log.info({
 // ffi_cursor_get(): SET (no exist)
 fkey = wrapValue(encoder.encode("b1"));
 fdata = new BigUint64Array(2);
-rc = lmdb.ffi_cursor_get(cursor, fkey, fdata, CursorOp.SET);
+rc = lmdb.ffi_cursor_get(cursor[0], fkey, fdata, CursorOp.SET);
 log.info({
   m: "after ffi_cursor_get('b1', SET)",
   rc,
@@ -567,7 +656,7 @@ log.info({
 // ffi_cursor_get(): SET_KEY (exists)
 fkey = wrapValue(encoder.encode("b"));
 fdata = new BigUint64Array(2);
-rc = lmdb.ffi_cursor_get(cursor, fkey, fdata, CursorOp.SET_KEY);
+rc = lmdb.ffi_cursor_get(cursor[0], fkey, fdata, CursorOp.SET_KEY);
 log.info({
   m: "after ffi_cursor_get('b', SET_KEY)",
   rc,
@@ -579,7 +668,7 @@ log.info({
 // ffi_cursor_get(): SET_KEY (no exist)
 fkey = wrapValue(encoder.encode("b1"));
 fdata = new BigUint64Array(2);
-rc = lmdb.ffi_cursor_get(cursor, fkey, fdata, CursorOp.SET_KEY);
+rc = lmdb.ffi_cursor_get(cursor[0], fkey, fdata, CursorOp.SET_KEY);
 log.info({
   m: "after ffi_cursor_get('b1', SET_KEY)",
   rc,
@@ -591,7 +680,7 @@ log.info({
 // ffi_cursor_get(): SET_RANGE
 fkey = wrapValue(encoder.encode("b1"));
 fdata = new BigUint64Array(2);
-rc = lmdb.ffi_cursor_get(cursor, fkey, fdata, CursorOp.SET_RANGE);
+rc = lmdb.ffi_cursor_get(cursor[0], fkey, fdata, CursorOp.SET_RANGE);
 log.info({
   m: "after ffi_cursor_get('b1', SET_RANGE)",
   rc,
@@ -600,24 +689,394 @@ log.info({
   data: decoder.decode(unwrapValue(fdata)),
 });
 
-lmdb.ffi_cursor_close(cursor);
+// ffi_cursor_scan()
+const scanBuf = new Uint8Array(256);
+const scanCount = new Uint32Array(1);
+rc = lmdb.ffi_cursor_scan(
+  cursor[0],
+  CursorOp.FIRST,
+  CursorOp.NEXT,
+  10,
+  scanBuf,
+  scanBuf.length,
+  scanCount
+);
+const scanned: string[][] = [];
+const scanView = new DataView(scanBuf.buffer);
+for (let i = 0, pos = 0; i < scanCount[0]; i++) {
+  const keyLen = scanView.getUint32(pos, true);
+  const valLen = scanView.getUint32(pos + 4, true);
+  pos += 8;
+  const k = decoder.decode(scanBuf.subarray(pos, pos + keyLen));
+  pos += keyLen;
+  const v = decoder.decode(scanBuf.subarray(pos, pos + valLen));
+  pos += valLen;
+  scanned.push([k, v]);
+}
+logDebug({
+  m: "after ffi_cursor_scan(FIRST, NEXT)",
+  rc,
+  err: iferror(rc),
+  count: scanCount[0],
+  scanned,
+});
+
+// ffi_range_open(): from "a1" up to, but excluding, "c"
+const frange = new Uint32Array(1);
+rc = lmdb.ffi_range_open(
+  cursor[0],
+  wrapValue(encoder.encode("a1")),
+  wrapValue(encoder.encode("c")),
+  RANGE_EXCLUDE_END,
+  0,
+  0,
+  frange
+);
+logDebug({ m: "after ffi_range_open('a1', 'c')", rc, err: iferror(rc) });
+
+// ffi_range_next()
+fkey = new BigUint64Array(2);
+fdata = new BigUint64Array(2);
+rc = lmdb.ffi_range_next(frange[0], fkey, fdata);
+while (!rc) {
+  key = decoder.decode(unwrapValue(fkey));
+  data = decoder.decode(unwrapValue(fdata));
+  logDebug({ m: "ffi_range_next()", rc, err: iferror(rc), key, data });
+  rc = lmdb.ffi_range_next(frange[0], fkey, fdata);
+}
+logDebug({ m: "after ffi_range_next() loop", rc, err: iferror(rc) });
+
+// ffi_range_close()
+lmdb.ffi_range_close(frange[0]);
+logDebug({ m: "after ffi_range_close()" });
+
+lmdb.ffi_cursor_close(cursor[0]);
+
+// ffi_get_many()
+const GET_MANY_STRIDE = 3;
+const manyKeys = ["a", "b1", "c"].map((k) => encoder.encode(k));
+const fkeys = new Uint8Array(
+  manyKeys.reduce((size, k) => size + 4 + k.length, 0)
+);
+let keyPos = 0;
+for (const k of manyKeys) {
+  new DataView(fkeys.buffer).setUint32(keyPos, k.length, true);
+  fkeys.set(k, keyPos + 4);
+  keyPos += 4 + k.length;
+}
+const manyResults = new Float64Array(manyKeys.length * GET_MANY_STRIDE);
+const manyValues = new Uint8Array(256);
+rc = lmdb.ffi_get_many(
+  ftxn[0],
+  dbi,
+  fkeys,
+  manyKeys.length,
+  manyResults,
+  manyValues,
+  manyValues.length
+);
+logDebug({
+  m: "after ffi_get_many(['a', 'b1', 'c'])",
+  rc,
+  err: iferror(rc),
+  values: manyKeys.map((_k, i) => {
+    const [offset, length, itemRc] = manyResults.subarray(
+      i * GET_MANY_STRIDE,
+      (i + 1) * GET_MANY_STRIDE
+    );
+    if (itemRc) return iferror(itemRc);
+    return decoder.decode(manyValues.subarray(offset, offset + length));
+  }),
+});
 
 // ffi_txn_commit()
-rc = lmdb.ffi_txn_commit(ftxn);
+const openCursor = new Uint32Array(1);
+rc = lmdb.ffi_cursor_open(ftxn[0], dbi, openCursor);
+rc = lmdb.ffi_txn_commit(ftxn[0]);
 logDebug({
   m: "after ffi_txn_commit()",
   rc,
   err: iferror(rc),
 });
 
-const droptxn = new BigUint64Array(1);
-rc = lmdb.ffi_txn_begin(fenv, null, 0, droptxn);
+// a write txn's cursors end with it, so their handles are stale: EINVAL
+rc = lmdb.ffi_cursor_get(openCursor[0], fkey, fdata, CursorOp.FIRST);
+logDebug({
+  m: "after ffi_cursor_get(cursor of committed txn)",
+  rc,
+  err: iferror(rc),
+});
+
+// ffi_write_batch()
+const BATCH_PUT = 0;
+const BATCH_DEL = 1;
+const BATCH_CHECK = 2;
+const CHECK_EQUAL = 0;
+const CHECK_MISSING = 1;
+const batchOps: [number, number, string, string][] = [
+  [BATCH_PUT, 0, "d", "durian"],
+  [BATCH_PUT, MDB_NOOVERWRITE, "a", "apricot"],
+  [BATCH_DEL, 0, "zz", ""],
+  // passes: "d" was just put
+  [BATCH_CHECK, CHECK_EQUAL, "d", "durian"],
+  [BATCH_PUT, 0, "d", "durian"],
+  // fails, so the delete is skipped with ECANCELED
+  [BATCH_CHECK, CHECK_MISSING, "a", ""],
+  [BATCH_DEL, 0, "a", ""],
+];
+const batchParts: Uint8Array[] = [];
+for (const [op, putFlags, k, v] of batchOps) {
+  const kU8 = encoder.encode(k);
+  const vU8 = encoder.encode(v);
+  batchParts.push(
+    new Uint8Array(
+      new Uint32Array([op, dbi, putFlags, kU8.length, vU8.length]).buffer
+    ),
+    kU8,
+    vU8
+  );
+}
+const fbatch = new Uint8Array(
+  batchParts.reduce((size, part) => size + part.length, 0)
+);
+let batchPos = 0;
+for (const part of batchParts) {
+  fbatch.set(part, batchPos);
+  batchPos += part.length;
+}
+const batchResults = new Int32Array(batchOps.length);
+rc = lmdb.ffi_write_batch(fenv, fbatch, batchOps.length, batchResults);
+logDebug({
+  m: "after ffi_write_batch()",
+  rc,
+  err: iferror(rc),
+  results: Array.from(batchResults).map((itemRc) => iferror(itemRc)),
+});
+
+// ffi_bulk_load(): "bulk0".."bulk2" are appended, "a0" is out of order
+const bulkParts: Uint8Array[] = [];
+for (const [k, v] of [
+  ["bulk0", "x"],
+  ["bulk1", "y"],
+  ["bulk2", "z"],
+  ["a0", "w"],
+]) {
+  const kU8 = encoder.encode(k);
+  const vU8 = encoder.encode(v);
+  bulkParts.push(
+    new Uint8Array(new Uint32Array([kU8.length, vU8.length]).buffer),
+    kU8,
+    vU8
+  );
+}
+const fbulk = new Uint8Array(
+  bulkParts.reduce((size, part) => size + part.length, 0)
+);
+let bulkPos = 0;
+for (const part of bulkParts) {
+  fbulk.set(part, bulkPos);
+  bulkPos += part.length;
+}
+const fappended = new Uint32Array(1);
+rc = await lmdb.ffi_bulk_load(fenv, dbi, fbulk, 4, fappended);
+logDebug({
+  m: "after ffi_bulk_load()",
+  rc,
+  err: iferror(rc),
+  appended: fappended[0],
+});
+
+// ffi_env_map()
+const fmap = new BigUint64Array(2);
+rc = lmdb.ffi_env_map(fenv, fmap);
+const mapView = new Uint8Array(unwrapValue(fmap));
+logDebug({
+  m: "after ffi_env_map()",
+  rc,
+  err: iferror(rc),
+  mapSize: mapView.length,
+});
+
+// ffi_get_ref()
+const refTxn = new Uint32Array(1);
+rc = lmdb.ffi_txn_begin(fenv, 0, MDB_RDONLY, refTxn);
 logDebug({ m: "ffi_txn_begin", rc, err: iferror(rc) });
-rc = lmdb.ffi_drop(droptxn, dbi, DROP_EMPTY);
+const fref = new Float64Array(2);
+fkey = wrapValue(encoder.encode("d"));
+fdata = new BigUint64Array(2);
+rc = lmdb.ffi_get_ref(refTxn[0], dbi, fkey, fdata, fmap, fref);
+logDebug({
+  m: "after ffi_get_ref('d')",
+  rc,
+  err: iferror(rc),
+  offset: fref[0],
+  length: fref[1],
+  data: decoder.decode(mapView.subarray(fref[0], fref[0] + fref[1])),
+});
+lmdb.ffi_txn_abort(refTxn[0]);
+
+// ffi_pool_start(), ffi_pool_client()
+rc = lmdb.ffi_pool_start(2);
+logDebug({ m: "after ffi_pool_start(2)", rc, err: iferror(rc) });
+const poolClient = new Uint32Array(1);
+rc = lmdb.ffi_pool_client(poolClient);
+logDebug({ m: "after ffi_pool_client()", rc, err: iferror(rc) });
+
+// ffi_pool_get_many(), with a one-shot read txn
+rc = lmdb.ffi_pool_get_many(
+  poolClient[0],
+  1,
+  fenv,
+  0,
+  dbi,
+  fkeys,
+  manyKeys.length,
+  manyResults,
+  manyValues,
+  manyValues.length
+);
+logDebug({ m: "after ffi_pool_get_many()", rc, err: iferror(rc) });
+
+// ffi_pool_poll()
+const completions = new Int32Array(2);
+const completed = await lmdb.ffi_pool_poll(poolClient[0], completions, 1);
+logDebug({
+  m: "after ffi_pool_poll()",
+  completed,
+  id: completions[0],
+  rc: completions[1],
+  err: iferror(completions[1]),
+});
+
+// ffi_writer_start(), ffi_writer_submit(), reusing fbatch from above
+rc = lmdb.ffi_writer_start(fenv);
+logDebug({ m: "after ffi_writer_start()", rc, err: iferror(rc) });
+rc = lmdb.ffi_writer_submit(
+  poolClient[0],
+  2,
+  fenv,
+  fbatch,
+  batchOps.length,
+  batchResults
+);
+logDebug({ m: "after ffi_writer_submit()", rc, err: iferror(rc) });
+await lmdb.ffi_pool_poll(poolClient[0], completions, 1);
+logDebug({
+  m: "after ffi_pool_poll() for the writer",
+  id: completions[0],
+  rc: completions[1],
+  err: iferror(completions[1]),
+  results: Array.from(batchResults).map((itemRc) => iferror(itemRc)),
+});
+
+// ffi_pool_client_release(): its slot is reused by the next client
+rc = lmdb.ffi_pool_client_release(poolClient[0]);
+const nextClient = new Uint32Array(1);
+lmdb.ffi_pool_client(nextClient);
+logDebug({
+  m: "after ffi_pool_client_release()",
+  rc,
+  err: iferror(rc),
+  reused: nextClient[0] === poolClient[0],
+});
+lmdb.ffi_pool_client_release(nextClient[0]);
+
+// fast-call symbols, when supported by this version of Deno
+if (fast) {
+  const fenvBytes = new Uint8Array(fenv.buffer);
+  const fastErr = (result: number) =>
+    result < 0 ? iferror(fastError(result)) : undefined;
+
+  // ffi_txn_begin_fast()
+  const fastTxn = fast.ffi_txn_begin_fast(fenvBytes, 0, 0);
+  rc = fastTxn ? 0 : fast.ffi_last_error();
+  logDebug({ m: "after ffi_txn_begin_fast()", rc, err: iferror(rc), fastTxn });
+
+  // ffi_put_fast()
+  const fastKey = encoder.encode("fast");
+  const fastData = encoder.encode("call");
+  rc = fast.ffi_put_fast(
+    fastTxn,
+    dbi,
+    fastKey,
+    fastKey.length,
+    fastData,
+    fastData.length,
+    0
+  );
+  logDebug({ m: "after ffi_put_fast('fast')", rc, err: iferror(rc) });
+
+  // ffi_get_fast()
+  const fastBuf = new Uint8Array(256);
+  const size = fast.ffi_get_fast(
+    fastTxn,
+    dbi,
+    fastKey,
+    fastKey.length,
+    fastBuf,
+    fastBuf.length
+  );
+  logDebug({
+    m: "after ffi_get_fast('fast')",
+    size,
+    err: fastErr(size),
+    data: decoder.decode(fastBuf.subarray(0, size)),
+  });
+
+  // ffi_cursor_get_fast()
+  const fastCursor = new Uint32Array(1);
+  rc = lmdb.ffi_cursor_open(fastTxn, dbi, fastCursor);
+  const itemSize = fast.ffi_cursor_get_fast(
+    fastCursor[0],
+    CursorOp.SET_KEY,
+    fastKey,
+    fastKey.length,
+    fastBuf,
+    fastBuf.length
+  );
+  logDebug({
+    m: "after ffi_cursor_get_fast(SET_KEY, 'fast')",
+    itemSize,
+    err: fastErr(itemSize),
+  });
+  lmdb.ffi_cursor_close(fastCursor[0]);
+
+  // ffi_del_fast()
+  rc = fast.ffi_del_fast(fastTxn, dbi, fastKey, fastKey.length);
+  logDebug({ m: "after ffi_del_fast('fast')", rc, err: iferror(rc) });
+  rc = lmdb.ffi_txn_commit(fastTxn);
+  logDebug({ m: "ffi_txn_commit", rc, err: iferror(rc) });
+}
+
+// ffi_txn_try_begin(): the write gate is taken until the first txn ends
+const gateTxn = new Uint32Array(1);
+rc = lmdb.ffi_txn_try_begin(fenv, 0, gateTxn);
+logDebug({ m: "ffi_txn_try_begin", rc, err: iferror(rc) });
+const busyTxn = new Uint32Array(1);
+rc = lmdb.ffi_txn_try_begin(fenv, 0, busyTxn);
+logDebug({ m: "ffi_txn_try_begin (expect EBUSY)", rc, err: iferror(rc) });
+lmdb.ffi_txn_abort(gateTxn[0]);
+
+// ffi_write_gate_wait(), ffi_txn_begin_entered()
+rc = await lmdb.ffi_write_gate_wait(fenv);
+logDebug({ m: "ffi_write_gate_wait", rc, err: iferror(rc) });
+rc = lmdb.ffi_txn_begin_entered(fenv, 0, gateTxn);
+logDebug({ m: "ffi_txn_begin_entered", rc, err: iferror(rc) });
+rc = lmdb.ffi_txn_commit(gateTxn[0]);
+logDebug({ m: "ffi_txn_commit", rc, err: iferror(rc) });
+
+const droptxn = new Uint32Array(1);
+rc = lmdb.ffi_txn_begin(fenv, 0, 0, droptxn);
+logDebug({ m: "ffi_txn_begin", rc, err: iferror(rc) });
+rc = lmdb.ffi_drop(droptxn[0], dbi, DROP_EMPTY);
 logDebug({ m: "ffi_drop", rc, err: iferror(rc) });
-rc = lmdb.ffi_txn_commit(droptxn);
+rc = lmdb.ffi_txn_commit(droptxn[0]);
 logDebug({ m: "ffi_txn_commit", rc, err: iferror(rc) });
 
+// ffi_env_sweep(), releasing anything the tests above left open
+const swept = lmdb.ffi_env_sweep(fenv, SWEEP_ALL);
+logDebug({ m: "after ffi_env_sweep()", swept });
+
 // ffi_env_close()
 lmdb.ffi_env_close(fenv);
 logDebug("after ffi_env_close()");
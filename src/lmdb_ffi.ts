@@ -133,12 +133,45 @@ export const ENOENT = 2;
 export const EACCES = 13;
 /** the environment was locked by another process. */
 export const EAGAIN = 11;
+/** another thread of this process holds the write txn; retry later. */
+export const EBUSY = 16;
+/** a caller-supplied output buffer was too small. */
+export const ENOMEM = 12;
+/** a txn, cursor or range handle was stale (already closed). */
+export const EINVAL = 22;
+/** a write batch op was skipped because its BATCH_CHECK failed. */
+export const ECANCELED = 125;
+
+/** ffi_env_alloc_info() fields */
+
+/** bytes of the data file in use, up to the last page */
+export const ALLOC_USED = 0;
+/** bytes of the data file allocated on disk */
+export const ALLOC_ALLOCATED = 1;
+/** size of the data file, which is sparse with MDB_WRITEMAP */
+export const ALLOC_FILE_SIZE = 2;
+export const ALLOC_LEN = 3;
+
+/** range cursor Flags */
+
+/** walk the range from its start bound downwards */
+export const RANGE_REVERSE = 0x01;
+/** do not return the start bound itself */
+export const RANGE_EXCLUDE_START = 0x02;
+/** do not return the end bound itself */
+export const RANGE_EXCLUDE_END = 0x04;
 
 export const FLAGS_OFF = 0;
 export const FLAGS_ON = 1;
 export const SYNC_FORCE = 1;
 export const SYNC_DONT_FORCE = 0;
 
+// ffi_env_sweep() flags
+/** release every txn, cursor and range cursor of the calling thread */
+export const SWEEP_ALL = 0;
+/** release only read-only txns and their cursors */
+export const SWEEP_READ_ONLY = 1;
+
 export enum CursorOp {
   FIRST = 0 /** Position at first key/data item */,
   FIRST_DUP /** Position at first data item of current key. Only for #MDB_DUPSORT */,
@@ -188,6 +221,10 @@ const dylib = Deno.dlopen(libName, {
     parameters: ["i32"],
     result: "pointer",
   },
+  ffi_scratch: {
+    parameters: [],
+    result: "pointer",
+  },
   ffi_env_create: {
     parameters: ["pointer"],
     result: "i32",
@@ -233,10 +270,40 @@ const dylib = Deno.dlopen(libName, {
     result: "i32",
     nonblocking: true,
   },
+  ffi_env_sync_committed: {
+    parameters: ["pointer"],
+    result: "i32",
+    nonblocking: true,
+  },
+  ffi_env_wait_durable: {
+    parameters: ["pointer", "f64"],
+    result: "i32",
+    nonblocking: true,
+  },
+  ffi_env_durable_txnid: {
+    parameters: ["pointer"],
+    result: "f64",
+  },
+  ffi_env_syncer_start: {
+    parameters: ["pointer", "u32", "usize"],
+    result: "i32",
+  },
+  ffi_env_sync_request: {
+    parameters: ["pointer"],
+    result: "void",
+  },
+  ffi_env_syncer_stop: {
+    parameters: ["pointer"],
+    result: "void",
+  },
   ffi_env_close: {
     parameters: ["pointer"],
     result: "void",
   },
+  ffi_env_sweep: {
+    parameters: ["pointer", "u32"],
+    result: "i32",
+  },
   ffi_env_set_flags: {
     parameters: ["pointer", "u32", "i32"],
     result: "i32",
@@ -253,10 +320,40 @@ const dylib = Deno.dlopen(libName, {
     parameters: ["pointer", "pointer"],
     result: "i32",
   },
+  ffi_env_map: {
+    parameters: ["pointer", "pointer"],
+    result: "i32",
+  },
+  ffi_env_map_generation: {
+    parameters: ["pointer"],
+    result: "u32",
+  },
   ffi_env_set_mapsize: {
     parameters: ["pointer", "usize"],
     result: "i32",
   },
+  ffi_env_grow: {
+    parameters: ["pointer", "f64", "u32", "pointer"],
+    result: "i32",
+  },
+  ffi_env_grow_async: {
+    parameters: ["pointer", "f64", "u32", "pointer"],
+    result: "i32",
+    nonblocking: true,
+  },
+  ffi_env_preallocate: {
+    parameters: ["pointer", "f64"],
+    result: "i32",
+    nonblocking: true,
+  },
+  ffi_env_alloc_info: {
+    parameters: ["pointer", "pointer"],
+    result: "i32",
+  },
+  ffi_env_set_flush_threads: {
+    parameters: ["pointer", "u32"],
+    result: "i32",
+  },
   ffi_env_set_maxreaders: {
     parameters: ["pointer", "u32"],
     result: "i32",
@@ -282,43 +379,68 @@ const dylib = Deno.dlopen(libName, {
     result: "pointer",
   },
   ffi_txn_begin: {
-    parameters: ["pointer", "pointer", "u32", "pointer"],
+    parameters: ["pointer", "u32", "u32", "pointer"],
     result: "i32",
   },
-  ffi_txn_env: {
+  ffi_txn_try_begin: {
+    parameters: ["pointer", "u32", "pointer"],
+    result: "i32",
+  },
+  ffi_write_gate_wait: {
     parameters: ["pointer"],
+    result: "i32",
+    nonblocking: true,
+  },
+  ffi_txn_begin_entered: {
+    parameters: ["pointer", "u32", "pointer"],
+    result: "i32",
+  },
+  ffi_txn_env: {
+    parameters: ["u32"],
     result: "u64",
   },
   ffi_txn_id: {
-    parameters: ["pointer"],
+    parameters: ["u32"],
     result: "usize",
   },
   ffi_txn_commit: {
-    parameters: ["pointer"],
+    parameters: ["u32"],
     result: "i32",
   },
   ffi_txn_abort: {
-    parameters: ["pointer"],
+    parameters: ["u32"],
     result: "void",
   },
   ffi_txn_reset: {
-    parameters: ["pointer"],
+    parameters: ["u32"],
     result: "void",
   },
   ffi_txn_renew: {
-    parameters: ["pointer"],
+    parameters: ["u32"],
+    result: "i32",
+  },
+  ffi_txn_refresh: {
+    parameters: ["u32", "u32", "pointer"],
+    result: "i32",
+  },
+  ffi_txn_park: {
+    parameters: ["u32"],
+    result: "i32",
+  },
+  ffi_txn_unpark: {
+    parameters: ["u32", "u32", "pointer"],
     result: "i32",
   },
   ffi_dbi_open: {
-    parameters: ["pointer", "pointer", "u32", "pointer"],
+    parameters: ["u32", "pointer", "u32", "pointer"],
     result: "i32",
   },
   ffi_stat: {
-    parameters: ["pointer", "u32", "pointer"],
+    parameters: ["u32", "u32", "pointer"],
     result: "i32",
   },
   ffi_dbi_flags: {
-    parameters: ["pointer", "u32", "pointer"],
+    parameters: ["u32", "u32", "pointer"],
     result: "i32",
   },
   ffi_dbi_close: {
@@ -326,69 +448,221 @@ const dylib = Deno.dlopen(libName, {
     result: "void",
   },
   ffi_drop: {
-    parameters: ["pointer", "u32", "u32"],
+    parameters: ["u32", "u32", "u32"],
     result: "i32",
   },
   ffi_get: {
-    parameters: ["pointer", "u32", "pointer", "pointer"],
+    parameters: ["u32", "u32", "pointer", "pointer"],
+    result: "i32",
+  },
+  ffi_get_ref: {
+    parameters: ["u32", "u32", "pointer", "pointer", "pointer", "pointer"],
     result: "i32",
   },
   ffi_put: {
-    parameters: ["pointer", "u32", "pointer", "pointer", "u32"],
+    parameters: ["u32", "u32", "pointer", "pointer", "u32"],
     result: "i32",
   },
   ffi_del: {
-    parameters: ["pointer", "u32", "pointer", "pointer"],
+    parameters: ["u32", "u32", "pointer", "pointer"],
     result: "i32",
   },
+  ffi_get_many: {
+    parameters: ["u32", "u32", "pointer", "u32", "pointer", "pointer", "usize"],
+    result: "i32",
+  },
+  ffi_write_batch: {
+    parameters: ["pointer", "pointer", "u32", "pointer"],
+    result: "i32",
+  },
+  ffi_bulk_load: {
+    parameters: ["pointer", "u32", "pointer", "u32", "pointer"],
+    result: "i32",
+    nonblocking: true,
+  },
   ffi_cursor_open: {
-    parameters: ["pointer", "u32", "pointer"],
+    parameters: ["u32", "u32", "pointer"],
     result: "i32",
   },
   ffi_cursor_close: {
-    parameters: ["pointer"],
+    parameters: ["u32"],
     result: "void",
   },
   ffi_cursor_renew: {
-    parameters: ["pointer", "pointer"],
+    parameters: ["u32", "u32"],
     result: "i32",
   },
   ffi_cursor_txn: {
-    parameters: ["pointer"],
-    result: "u64",
+    parameters: ["u32"],
+    result: "u32",
   },
   ffi_cursor_dbi: {
-    parameters: ["pointer"],
+    parameters: ["u32"],
     result: "i32",
   },
   ffi_cursor_get: {
-    parameters: ["pointer", "pointer", "pointer", "u32"],
+    parameters: ["u32", "pointer", "pointer", "u32"],
+    result: "i32",
+  },
+  ffi_cursor_get_ref: {
+    parameters: ["u32", "pointer", "pointer", "u32", "pointer", "pointer"],
     result: "i32",
   },
   ffi_cursor_put: {
-    parameters: ["pointer", "pointer", "pointer", "u32"],
+    parameters: ["u32", "pointer", "pointer", "u32"],
     result: "i32",
   },
   ffi_cursor_del: {
-    parameters: ["pointer", "u32"],
+    parameters: ["u32", "u32"],
     result: "i32",
   },
   ffi_cursor_count: {
-    parameters: ["pointer", "pointer"],
+    parameters: ["u32", "pointer"],
+    result: "i32",
+  },
+  ffi_cursor_scan: {
+    parameters: ["u32", "u32", "u32", "u32", "pointer", "usize", "pointer"],
+    result: "i32",
+  },
+  ffi_range_open: {
+    parameters: [
+      "u32",
+      "pointer",
+      "pointer",
+      "u32",
+      "usize",
+      "usize",
+      "pointer",
+    ],
+    result: "i32",
+  },
+  ffi_range_next: {
+    parameters: ["u32", "pointer", "pointer"],
     result: "i32",
   },
+  ffi_range_scan: {
+    parameters: ["u32", "u32", "pointer", "usize", "pointer"],
+    result: "i32",
+  },
+  ffi_range_close: {
+    parameters: ["u32"],
+    result: "void",
+  },
   ffi_cmp: {
-    parameters: ["pointer", "u32", "pointer", "pointer"],
+    parameters: ["u32", "u32", "pointer", "pointer"],
     result: "i32",
   },
   ffi_dcmp: {
-    parameters: ["pointer", "u32", "pointer", "pointer"],
+    parameters: ["u32", "u32", "pointer", "pointer"],
     result: "i32",
   },
   ffi_reader_check: {
     parameters: ["pointer", "pointer"],
     result: "i32",
   },
+  ffi_pool_start: {
+    parameters: ["u32"],
+    result: "i32",
+  },
+  ffi_pool_client: {
+    parameters: ["pointer"],
+    result: "i32",
+  },
+  ffi_pool_client_release: {
+    parameters: ["u32"],
+    result: "i32",
+  },
+  ffi_pool_get_many: {
+    parameters: [
+      "u32",
+      "u32",
+      "pointer",
+      "u32",
+      "u32",
+      "pointer",
+      "u32",
+      "pointer",
+      "pointer",
+      "usize",
+    ],
+    result: "i32",
+  },
+  ffi_pool_scan: {
+    parameters: ["u32", "u32", "u32", "u32", "pointer", "usize", "pointer"],
+    result: "i32",
+  },
+  ffi_pool_poll: {
+    parameters: ["u32", "pointer", "u32"],
+    result: "i32",
+    nonblocking: true,
+  },
+  ffi_writer_start: {
+    parameters: ["pointer"],
+    result: "i32",
+  },
+  ffi_writer_submit: {
+    parameters: ["u32", "u32", "pointer", "pointer", "u32", "pointer"],
+    result: "i32",
+  },
 });
 
 export const lmdb = dylib.symbols;
+
+/**
+ * The "buffer" parameter type, which older Deno versions do not know about.
+ * Typed this way so that this module also type-checks against them.
+ */
+const BUFFER = "buffer" as string as Deno.NativeType;
+
+/**
+ * Open the hot-path symbols which take only numeric and buffer parameters,
+ * and return a number, so that V8 may call them through its fast API.
+ * They skip the MDB_val wrappers; whether that makes them faster on a
+ * given Deno version is for lmdb_ffi.bench.ts to show.
+ * @returns null if this version of Deno does not support "buffer".
+ */
+function openFast() {
+  try {
+    return Deno.dlopen(libName, {
+      ffi_last_error: {
+        parameters: [],
+        result: "i32",
+      },
+      ffi_txn_begin_fast: {
+        parameters: [BUFFER, "u32", "u32"],
+        result: "u32",
+      },
+      ffi_get_fast: {
+        parameters: ["u32", "u32", BUFFER, "u32", BUFFER, "u32"],
+        result: "i32",
+      },
+      ffi_put_fast: {
+        parameters: ["u32", "u32", BUFFER, "u32", BUFFER, "u32", "u32"],
+        result: "i32",
+      },
+      ffi_del_fast: {
+        parameters: ["u32", "u32", BUFFER, "u32"],
+        result: "i32",
+      },
+      ffi_cursor_get_fast: {
+        parameters: ["u32", "u32", BUFFER, "u32", BUFFER, "u32"],
+        result: "i32",
+      },
+    }).symbols;
+  } catch {
+    return null;
+  }
+}
+
+/** Fast-call symbols (see openFast()), or null if unavailable. */
+export const fast = openFast();
+
+/**
+ * Decode the negative result of ffi_get_fast() or ffi_cursor_get_fast()
+ * into an error code: MDB_* codes are returned as-is, errno values negated.
+ */
+export function fastError(result: number): number {
+  return result >= MDB_KEYEXIST && result <= MDB_LAST_ERRCODE
+    ? result
+    : -result;
+}
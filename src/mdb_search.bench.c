@@ -0,0 +1,226 @@
+/**
+ * Measures point lookups/sec through mdb_get() on INTEGERKEY, memcmp and
+ * REVERSEKEY databases, each searched once with its built-in comparator
+ * (inlined in mdb_node_search) and once with an equivalent, plain user
+ * comparator, which takes the call-through-md_cmp path. The built-in runs
+ * are repeated with batches of MULTI_BATCH keys through mdb_get_multi():
+ *   make bench && build/bin/mdb_search_bench [entries] [lookups]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "lmdb.h"
+
+#define CHECK(expr) check((expr), #expr)
+
+static void check(int rc, const char *expr)
+{
+  if (rc)
+  {
+    fprintf(stderr, "%s: %s\n", expr, mdb_strerror(rc));
+    exit(1);
+  }
+}
+
+static int cmp_size(const MDB_val *a, const MDB_val *b)
+{
+  size_t x, y;
+  memcpy(&x, a->mv_data, sizeof(x));
+  memcpy(&y, b->mv_data, sizeof(y));
+  return (x < y) ? -1 : x > y;
+}
+
+static int cmp_mem(const MDB_val *a, const MDB_val *b)
+{
+  size_t len = a->mv_size < b->mv_size ? a->mv_size : b->mv_size;
+  int diff = memcmp(a->mv_data, b->mv_data, len);
+  if (diff)
+    return diff;
+  return (a->mv_size > b->mv_size) - (a->mv_size < b->mv_size);
+}
+
+static int cmp_rev(const MDB_val *a, const MDB_val *b)
+{
+  const unsigned char *p1 = (const unsigned char *)a->mv_data + a->mv_size;
+  const unsigned char *p2 = (const unsigned char *)b->mv_data + b->mv_size;
+  size_t len = a->mv_size < b->mv_size ? a->mv_size : b->mv_size;
+  while (len--)
+  {
+    int diff = *--p1 - *--p2;
+    if (diff)
+      return diff;
+  }
+  return (a->mv_size > b->mv_size) - (a->mv_size < b->mv_size);
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#define KEY_BUF 48
+
+/**
+ * Key i of the memcmp databases: a hashed, fixed-width string; of the
+ * REVERSEKEY ones: a host name under one of a few domains.
+ */
+static void string_key(size_t i, unsigned int flags, char *buf)
+{
+  static const char *domains[] = {"example.com", "example.org",
+                                  "mail.example.net", "cdn.example.io"};
+  size_t h = (size_t)(i * 0x9E3779B97F4A7C15ULL);
+  if (flags & MDB_REVERSEKEY)
+    snprintf(buf, KEY_BUF, "host-%zx.%s", h >> 40, domains[i % 4]);
+  else
+    snprintf(buf, KEY_BUF, "key:%016zx", h);
+}
+
+static void fill(MDB_env *env, const char *name, unsigned int flags,
+                 MDB_cmp_func *cmp, size_t entries)
+{
+  MDB_txn *txn;
+  MDB_dbi dbi;
+  MDB_val key, data;
+  char buf[KEY_BUF];
+  size_t i, n;
+
+  CHECK(mdb_txn_begin(env, NULL, 0, &txn));
+  CHECK(mdb_dbi_open(txn, name, flags | MDB_CREATE, &dbi));
+  if (cmp)
+    CHECK(mdb_set_compare(txn, dbi, cmp));
+  data.mv_size = 16;
+  data.mv_data = "0123456789abcdef";
+  for (i = 0; i < entries; i++)
+  {
+    if (flags & MDB_INTEGERKEY)
+    {
+      n = i * 2;
+      key.mv_size = sizeof(n);
+      key.mv_data = &n;
+    }
+    else
+    {
+      string_key(i, flags, buf);
+      key.mv_size = strlen(buf);
+      key.mv_data = buf;
+    }
+    CHECK(mdb_put(txn, dbi, &key, &data, 0));
+  }
+  CHECK(mdb_txn_commit(txn));
+}
+
+/** Lookups cycle through this many keys, generated before timing. */
+#define KEY_POOL 4096
+/** Keys per mdb_get_multi() call; divides KEY_POOL */
+#define MULTI_BATCH 64
+
+static void lookup(MDB_env *env, const char *name, unsigned int flags,
+                   MDB_cmp_func *cmp, int multi, size_t entries,
+                   size_t lookups)
+{
+  static MDB_val values[MULTI_BATCH];
+  static int rcs[MULTI_BATCH];
+  static char bufs[KEY_POOL][KEY_BUF];
+  static size_t nums[KEY_POOL];
+  static MDB_val keys[KEY_POOL];
+  MDB_txn *txn;
+  MDB_dbi dbi;
+  MDB_val data;
+  size_t i, j, found = 0;
+  uint64_t x = 88172645463325252ULL;
+  double start, secs;
+
+  for (i = 0; i < KEY_POOL; i++)
+  {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    if (flags & MDB_INTEGERKEY)
+    {
+      nums[i] = (x % entries) * 2;
+      keys[i].mv_size = sizeof(nums[i]);
+      keys[i].mv_data = &nums[i];
+    }
+    else
+    {
+      string_key(x % entries, flags, bufs[i]);
+      keys[i].mv_size = strlen(bufs[i]);
+      keys[i].mv_data = bufs[i];
+    }
+  }
+  CHECK(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+  CHECK(mdb_dbi_open(txn, name, flags, &dbi));
+  if (cmp)
+    CHECK(mdb_set_compare(txn, dbi, cmp));
+  start = now();
+  if (multi)
+  {
+    lookups -= lookups % MULTI_BATCH;
+    for (i = 0; i < lookups; i += MULTI_BATCH)
+    {
+      CHECK(mdb_get_multi(txn, dbi, MULTI_BATCH, &keys[i % KEY_POOL],
+                          values, rcs));
+      for (j = 0; j < MULTI_BATCH; j++)
+        if (!rcs[j])
+          found++;
+    }
+  }
+  else
+  {
+    for (i = 0; i < lookups; i++)
+    {
+      if (!mdb_get(txn, dbi, &keys[i % KEY_POOL], &data))
+        found++;
+    }
+  }
+  secs = now() - start;
+  mdb_txn_abort(txn);
+  if (found != lookups)
+  {
+    fprintf(stderr, "%s: found %zu of %zu\n", name, found, lookups);
+    exit(1);
+  }
+  printf("%-16s %-9s %12.0f lookups/sec\n", name,
+         multi ? "multi" : cmp ? "user" : "built-in", lookups / secs);
+}
+
+int main(int argc, char *argv[])
+{
+  size_t entries = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+  size_t lookups = argc > 2 ? strtoul(argv[2], NULL, 10) : 2000000;
+  const char *path = ".benchdb-search";
+  MDB_env *env;
+
+  mkdir(path, 0775);
+  CHECK(mdb_env_create(&env));
+  CHECK(mdb_env_set_maxdbs(env, 6));
+  CHECK(mdb_env_set_mapsize(env, (size_t)1 << 32));
+  CHECK(mdb_env_open(env, path, MDB_NOSYNC, 0664));
+
+  fill(env, "integerkey", MDB_INTEGERKEY, NULL, entries);
+  fill(env, "integerkey-user", MDB_INTEGERKEY, cmp_size, entries);
+  fill(env, "memcmp", 0, NULL, entries);
+  fill(env, "memcmp-user", 0, cmp_mem, entries);
+  fill(env, "reversekey", MDB_REVERSEKEY, NULL, entries);
+  fill(env, "reversekey-user", MDB_REVERSEKEY, cmp_rev, entries);
+
+  lookup(env, "integerkey", MDB_INTEGERKEY, NULL, 0, entries, lookups);
+  lookup(env, "integerkey", MDB_INTEGERKEY, NULL, 1, entries, lookups);
+  lookup(env, "integerkey-user", MDB_INTEGERKEY, cmp_size, 0, entries,
+         lookups);
+  lookup(env, "memcmp", 0, NULL, 0, entries, lookups);
+  lookup(env, "memcmp", 0, NULL, 1, entries, lookups);
+  lookup(env, "memcmp-user", 0, cmp_mem, 0, entries, lookups);
+  lookup(env, "reversekey", MDB_REVERSEKEY, NULL, 0, entries, lookups);
+  lookup(env, "reversekey", MDB_REVERSEKEY, NULL, 1, entries, lookups);
+  lookup(env, "reversekey-user", MDB_REVERSEKEY, cmp_rev, 0, entries,
+         lookups);
+
+  mdb_env_close(env);
+  return 0;
+}
@@ -1,5 +1,8 @@
 import {
+  fast,
   lmdb,
+  MDB_MAP_FULL,
+  MDB_MAP_RESIZED,
   MDB_NOMETASYNC,
   MDB_NOSYNC,
   MDB_RDONLY,
@@ -10,37 +13,89 @@ import { Environment } from "./environment.ts";
 
 const notOpen = () => new Error("Transaction is already closed.");
 
+/** commits are made durable by ffi_env_sync_committed(), not by LMDB */
+const TXN_FLAGS = MDB_NOMETASYNC | MDB_NOSYNC;
+
+/** receives new txn handles from ffi_txn_begin() */
+const fhandle = new Uint32Array(1);
+/** receives the renewed flag from ffi_txn_refresh() */
+const frenewed = new Uint32Array(1);
+
 /**
  * Represents a single consistent view of the database, based on the
  * moment the transaction was created.
  */
 export class Transaction {
-  ftxn = new BigUint64Array(1);
+  htxn = 0;
   isOpen = false;
   env: Environment;
   readOnly: boolean;
   parent: Transaction | undefined;
+  /** incremented whenever this transaction's snapshot ends */
+  generation = 0;
+  /** a write in this txn, or in one of its children, failed with
+   *  MDB_MAP_FULL (see writeFailed) */
+  protected mapFull = false;
 
-  private id = ++curId;
-
-  constructor(env: Environment, readOnly = false, parent?: Transaction) {
+  /**
+   * @param htxn an already begun top-level txn to take over, instead of
+   *        beginning a new one
+   */
+  constructor(
+    env: Environment,
+    readOnly = false,
+    parent?: Transaction,
+    htxn?: number
+  ) {
     this.env = env;
     this.readOnly = readOnly;
     this.parent = parent;
-    const flags = (readOnly ? MDB_RDONLY : 0) | MDB_NOMETASYNC | MDB_NOSYNC;
-    const rc = lmdb.ffi_txn_begin(
-      env.fenv,
-      parent?.ftxn || null,
-      flags,
-      this.ftxn
-    );
-    if (rc) throw DbError.from(rc);
+    const flags = (readOnly ? MDB_RDONLY : 0) | TXN_FLAGS;
+    const hparent = parent?.htxn || 0;
+    if (htxn) {
+      this.htxn = htxn;
+    } else {
+      let rc: number;
+      do {
+        rc = this.begin(hparent, flags);
+        // another process grew the map: adopt its size, and try again
+      } while (rc === MDB_MAP_RESIZED && env.growMapSync(rc));
+      if (rc) throw DbError.from(rc);
+    }
     this.isOpen = true;
-    records[this.id] = {
-      addr: this.ftxn[0],
-      isOpen: true,
-    };
-    registry.register(this, this.id);
+  }
+
+  protected begin(hparent: number, flags: number): number {
+    if (fast) {
+      this.htxn = fast.ffi_txn_begin_fast(this.env.fenvBytes, hparent, flags);
+      return this.htxn ? 0 : fast.ffi_last_error();
+    }
+    const rc = lmdb.ffi_txn_begin(this.env.fenv, hparent, flags, fhandle);
+    this.htxn = fhandle[0];
+    return rc;
+  }
+
+  /**
+   * Begin a write transaction, but wait for any other write transaction
+   * in this process to end on a native thread, instead of blocking the
+   * JS thread.
+   */
+  static async beginAsync(env: Environment): Promise<Transaction> {
+    let rc = await lmdb.ffi_write_gate_wait(env.fenv);
+    if (rc) throw DbError.from(rc);
+    rc = lmdb.ffi_txn_begin_entered(env.fenv, TXN_FLAGS, fhandle);
+    if (rc) throw DbError.from(rc);
+    return new Transaction(env, false, undefined, fhandle[0]);
+  }
+
+  /**
+   * Begin a write transaction if no other one in this process is open.
+   * @throws DbError with code EBUSY, which may be retried, if one is
+   */
+  static tryBegin(env: Environment): Transaction {
+    const rc = lmdb.ffi_txn_try_begin(env.fenv, TXN_FLAGS, fhandle);
+    if (rc) throw DbError.from(rc);
+    return new Transaction(env, false, undefined, fhandle[0]);
   }
 
   beginChildTxn(readOnly?: boolean): Transaction {
@@ -51,69 +106,128 @@ export class Transaction {
     );
   }
 
+  /**
+   * Note the result code of a failed write (put or del) in this
+   * transaction. LMDB fails the whole txn after MDB_MAP_FULL, so that its
+   * commit only returns MDB_BAD_TXN. The map is grown once the top-level
+   * transaction ends instead, so that the caller's retry fits.
+   */
+  writeFailed(rc: number): void {
+    if (rc !== MDB_MAP_FULL) return;
+    for (let txn: Transaction | undefined = this; txn; txn = txn.parent)
+      txn.mapFull = true;
+  }
+
   get txnid() {
-    return lmdb.ffi_txn_id(this.ftxn);
+    return lmdb.ffi_txn_id(this.htxn);
   }
 
-  async commit(): Promise<void> {
+  /**
+   * Commit the transaction. If it, or a write in it, fails because the
+   * map is full, the map is grown, so that the transaction can be tried
+   * again; abort() grows it in that case too.
+   * @param durable if true (the default), wait until it is on disk.
+   *        Otherwise return at once, and leave it to the background
+   *        syncer, or to a later Environment.durable(txnid).
+   * @returns the id of the committed transaction
+   */
+  async commit(durable = true): Promise<number> {
     if (!this.isOpen) throw notOpen();
-    let rc = lmdb.ffi_txn_commit(this.ftxn);
-    if (rc) throw DbError.from(rc);
+    const txnid = Number(lmdb.ffi_txn_id(this.htxn));
+    let rc = lmdb.ffi_txn_commit(this.htxn);
+    // The txn is gone, and its handle stale, whether or not it committed.
     this.isOpen = false;
-    records[this.id].isOpen = true;
-    rc = await lmdb.ffi_env_sync_force(this.env.fenv);
+    this.generation++;
+    if (rc && this.mapFull) rc = MDB_MAP_FULL;
+    this.writeFailed(rc);
+    if (this.mapFull) {
+      this.mapFull = false;
+      // not while the parent is active: it is grown once that ends
+      if (!this.parent) await this.env.growMap(MDB_MAP_FULL);
+    }
     if (rc) throw DbError.from(rc);
+    if (durable) {
+      // Shares one fsync with every other commit waiting at the same time.
+      rc = await lmdb.ffi_env_sync_committed(this.env.fenv);
+      if (rc) throw DbError.from(rc);
+    }
+    return txnid;
   }
 
   commitSync(): void {
     if (!this.isOpen) throw notOpen();
-    let rc = lmdb.ffi_txn_commit(this.ftxn);
-    if (rc) throw DbError.from(rc);
+    let rc = lmdb.ffi_txn_commit(this.htxn);
     this.isOpen = false;
-    records[this.id].isOpen = false;
+    this.generation++;
+    if (rc && this.mapFull) rc = MDB_MAP_FULL;
+    this.writeFailed(rc);
+    if (this.mapFull) {
+      this.mapFull = false;
+      if (!this.parent) this.env.growMapSync(MDB_MAP_FULL);
+    }
+    if (rc) throw DbError.from(rc);
     rc = lmdb.ffi_env_sync(this.env.fenv, SYNC_FORCE);
     if (rc) throw DbError.from(rc);
   }
 
   abort(): void {
     if (!this.isOpen) return;
-    lmdb.ffi_txn_abort(this.ftxn);
+    lmdb.ffi_txn_abort(this.htxn);
     this.isOpen = false;
-    records[this.id].isOpen = false;
+    this.generation++;
+    if (this.mapFull) {
+      this.mapFull = false;
+      if (!this.parent) this.env.growMapSync(MDB_MAP_FULL);
+    }
   }
 
   reset(): void {
     if (!this.isOpen) throw notOpen();
-    lmdb.ffi_txn_reset(this.ftxn);
+    lmdb.ffi_txn_reset(this.htxn);
     this.isOpen = false;
-    records[this.id].isOpen = false;
+    this.generation++;
   }
 
   renew(): void {
     if (this.isOpen) throw new DbError("Transaction is already open");
-    const rc = lmdb.ffi_txn_renew(this.ftxn);
+    const rc = lmdb.ffi_txn_renew(this.htxn);
     if (rc) throw DbError.from(rc);
     this.isOpen = true;
-    records[this.id].isOpen = true;
   }
-}
 
-/////////////////////////////////
-// Finalization management begin
-let curId = 0;
-interface Finalizer {
-  addr: bigint;
-  isOpen: boolean;
-}
-const records: Record<number, Finalizer> = {};
-const registry = new FinalizationRegistry((id: number) => {
-  const record = records[id];
-  if (!record) return;
-  if (record.isOpen) {
-    const ftxn = new BigUint64Array([BigInt(record.addr)]);
-    lmdb.ffi_txn_abort(ftxn);
+  /**
+   * Move a read-only transaction to the latest snapshot, but only if more
+   * than maxLag write transactions have been committed since it began.
+   * If it fails, the transaction should be aborted.
+   */
+  refresh(maxLag = 0): void {
+    if (!this.isOpen) throw notOpen();
+    const rc = lmdb.ffi_txn_refresh(this.htxn, maxLag, frenewed);
+    if (frenewed[0]) this.generation++;
+    if (rc) throw DbError.from(rc);
+  }
+
+  /**
+   * Set aside an idle read-only transaction for reuse. It stays open, but
+   * growing the map may reset it meanwhile, instead of waiting for it.
+   * Refs read through it are no longer valid. Take it back with unpark().
+   */
+  park(): void {
+    if (!this.isOpen) throw notOpen();
+    const rc = lmdb.ffi_txn_park(this.htxn);
+    if (rc) throw DbError.from(rc);
+    this.generation++;
+  }
+
+  /**
+   * Take back a transaction from park(): renewed if it was reset
+   * meanwhile, otherwise refreshed as by refresh(maxLag). If it fails,
+   * the transaction should be aborted.
+   */
+  unpark(maxLag = 0): void {
+    if (!this.isOpen) throw notOpen();
+    const rc = lmdb.ffi_txn_unpark(this.htxn, maxLag, frenewed);
+    if (frenewed[0]) this.generation++;
+    if (rc) throw DbError.from(rc);
   }
-  delete records[id];
-});
-// Finalization management end
-/////////////////////////////////
+}
@@ -37,3 +37,7 @@ export function encodeValue(value: Value): ArrayBuffer {
   }
   throw new TypeError(`Invalid value: ${value}`);
 }
+
+/** True if this platform (and therefore the C side) is little-endian */
+export const littleEndian =
+  new Uint8Array(new Uint16Array([1]).buffer)[0] === 1;
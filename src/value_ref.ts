@@ -0,0 +1,61 @@
+import { DbError } from "./dberror.ts";
+import { Transaction } from "./transaction.ts";
+import { decoder } from "./util.ts";
+
+/**
+ * A zero-copy handle to a key or value, as an (offset, length) pair into
+ * a view of the environment's memory map (see Environment.mapView()).
+ *
+ * The underlying data is owned by the database, may not be modified in
+ * any way, and is only valid until the next update or end of transaction.
+ * Unless the environment was opened with safeRefs: false, reading a ref
+ * after its transaction has ended throws instead of returning stale data.
+ */
+export class ValueRef {
+  protected source: Uint8Array;
+  offset: number;
+  length: number;
+  txn: Transaction;
+  protected generation: number;
+  protected mapGeneration: number;
+
+  constructor(
+    source: Uint8Array,
+    offset: number,
+    length: number,
+    txn: Transaction
+  ) {
+    this.source = source;
+    this.offset = offset;
+    this.length = length;
+    this.txn = txn;
+    this.generation = txn.generation;
+    this.mapGeneration = txn.env.mapGeneration;
+  }
+
+  /** false once the transaction has ended or the map has been replaced */
+  get isValid(): boolean {
+    return (
+      this.txn.isOpen &&
+      this.txn.generation === this.generation &&
+      this.txn.env.mapGeneration === this.mapGeneration
+    );
+  }
+
+  /** a view of the data, without copying */
+  bytes(): Uint8Array {
+    if (this.txn.env.options.safeRefs !== false && !this.isValid) {
+      throw new DbError("ValueRef is no longer valid: its txn has ended");
+    }
+    return this.source.subarray(this.offset, this.offset + this.length);
+  }
+
+  /** a copy of the data, which remains valid after the transaction ends */
+  copy(): Uint8Array {
+    return this.bytes().slice();
+  }
+
+  string(): string {
+    return decoder.decode(this.bytes());
+  }
+}
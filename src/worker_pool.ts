@@ -0,0 +1,145 @@
+import { EAGAIN, ECANCELED, lmdb } from "./lmdb_ffi.ts";
+import { DbError } from "./dberror.ts";
+
+/** Number of native threads started when no other count is given */
+export const DEFAULT_POOL_THREADS = 4;
+
+/** Completions drained per call to ffi_pool_poll */
+const POLL_BATCH = 64;
+
+/** Ids wrap before they would overflow an int32 completion record */
+const MAX_ID = 0x7fffffff;
+
+/**
+ * Submits one native request with the given id, and returns its result
+ * code: 0 if queued, EAGAIN if the pool is full, non-zero otherwise.
+ */
+export type PoolRequest = (client: number, id: number) => number;
+
+interface PendingRequest {
+  request: PoolRequest;
+  resolve: (rc: number) => void;
+}
+
+/**
+ * Runs reads on a fixed pool of native threads, instead of on the JS thread,
+ * and resolves a promise with the result code of each one. Completions for
+ * every request in flight are collected by a single nonblocking poll.
+ *
+ * The native threads are shared by the whole process; each JS thread which
+ * uses them registers as a separate client, with its own completions.
+ */
+export class WorkerPool {
+  protected client = -1;
+  protected nextId = 1;
+  /** submitted, by id, and not yet completed */
+  protected pending = new Map<number, PendingRequest>();
+  /** not yet submitted, because the pool was full */
+  protected backlog: PendingRequest[] = [];
+  protected polling = false;
+  /** release() is waiting for the requests in flight */
+  protected releasing = false;
+  protected completions = new Int32Array(POLL_BATCH * 2);
+
+  /** Start the native threads, or grow the pool to the given count. */
+  start(threads = DEFAULT_POOL_THREADS): void {
+    if (this.client < 0) {
+      const fclient = new Uint32Array(1);
+      const rc = lmdb.ffi_pool_client(fclient);
+      if (rc) throw DbError.from(rc);
+      this.client = fclient[0];
+    }
+    const rc = lmdb.ffi_pool_start(threads);
+    if (rc) throw DbError.from(rc);
+  }
+
+  /**
+   * Unregister this thread from the pool, so that its native client can be
+   * reused, e.g. when a worker shuts down. Requests not yet submitted
+   * resolve with ECANCELED; those in flight still complete first, since
+   * the native threads use their buffers until then. The threads keep
+   * running for other clients, and submit() registers again.
+   */
+  release(): void {
+    if (this.client < 0) return;
+    for (const pending of this.backlog.splice(0)) pending.resolve(ECANCELED);
+    this.releasing = this.pending.size > 0;
+    if (this.releasing) return;
+    lmdb.ffi_pool_client_release(this.client);
+    this.client = -1;
+  }
+
+  /**
+   * Queue a request on the pool. Any buffers it refers to are kept alive
+   * by the request itself until it completes.
+   * @returns the result code of the request, or of its submission
+   */
+  submit(request: PoolRequest): Promise<number> {
+    if (this.client < 0) this.start();
+    this.releasing = false;
+    return new Promise((resolve) => {
+      const pending = { request, resolve };
+      if (this.backlog.length) {
+        this.backlog.push(pending);
+        return;
+      }
+      const rc = this.send(pending);
+      if (rc === EAGAIN) this.backlog.push(pending);
+      else if (rc) resolve(rc);
+      this.poll();
+    });
+  }
+
+  protected send(pending: PendingRequest): number {
+    const id = this.nextId;
+    this.nextId = id === MAX_ID ? 1 : id + 1;
+    const rc = pending.request(this.client, id);
+    if (!rc) this.pending.set(id, pending);
+    return rc;
+  }
+
+  protected flushBacklog(): void {
+    while (this.backlog.length) {
+      const rc = this.send(this.backlog[0]);
+      if (rc === EAGAIN) return;
+      const pending = this.backlog.shift()!;
+      if (rc) pending.resolve(rc);
+    }
+  }
+
+  protected async poll(): Promise<void> {
+    if (this.polling) return;
+    this.polling = true;
+    try {
+      while (this.pending.size || this.backlog.length) {
+        if (!this.pending.size) {
+          // Full with other clients' requests: nothing of ours to wait for.
+          await new Promise((resolve) => setTimeout(resolve, 1));
+        } else {
+          const count = await lmdb.ffi_pool_poll(
+            this.client,
+            this.completions,
+            POLL_BATCH
+          );
+          for (let i = 0; i < count; i++) {
+            const id = this.completions[i * 2];
+            const pending = this.pending.get(id);
+            this.pending.delete(id);
+            pending?.resolve(this.completions[i * 2 + 1]);
+          }
+        }
+        this.flushBacklog();
+      }
+    } finally {
+      this.polling = false;
+    }
+    if (this.releasing) this.release();
+  }
+}
+
+/** The pool used by Database.getAsync() and friends */
+export const workerPool = new WorkerPool();
+
+// Free this thread's client when it shuts down: clients are limited, and
+// every worker which uses the pool registers one of its own.
+globalThis.addEventListener("unload", () => workerPool.release());
@@ -0,0 +1,207 @@
+import { lmdb, MDB_APPEND, MDB_NOOVERWRITE } from "./lmdb_ffi.ts";
+import { Database, PutFlags } from "./database.ts";
+import { DbError } from "./dberror.ts";
+import { Environment } from "./environment.ts";
+import { encodeValue, Key, littleEndian, Value } from "./util.ts";
+import { workerPool } from "./worker_pool.ts";
+
+const BATCH_PUT = 0;
+const BATCH_DEL = 1;
+const BATCH_CHECK = 2;
+const CHECK_EQUAL = 0;
+const CHECK_MISSING = 1;
+const BATCH_HEADER_LEN = 5;
+const BATCH_HEADER_SIZE = BATCH_HEADER_LEN * Uint32Array.BYTES_PER_ELEMENT;
+
+const notOpen = () => new DbError("DB environment is already closed");
+
+/**
+ * Collects puts and deletes, for any number of databases in the same
+ * environment, into a single buffer which is applied with one FFI call,
+ * inside one write transaction.
+ *
+ * Ops which fail with MDB_KEYEXIST or MDB_NOTFOUND do not stop the
+ * batch; their result codes are returned from write(). Any other error
+ * aborts the whole batch. Ops skipped because of a failed ifValue() or
+ * ifMissing() check have the result ECANCELED.
+ */
+export class WriteBatch {
+  env: Environment;
+  count = 0;
+
+  protected buffer: Uint8Array;
+  protected view: DataView;
+  protected size = 0;
+
+  constructor(env: Environment, initialSize = 4096) {
+    this.env = env;
+    this.buffer = new Uint8Array(initialSize);
+    this.view = new DataView(this.buffer.buffer);
+  }
+
+  protected reserve(bytes: number): void {
+    if (this.size + bytes <= this.buffer.length) return;
+    let length = Math.max(this.buffer.length, 64) * 2;
+    while (length < this.size + bytes) length *= 2;
+    const buffer = new Uint8Array(length);
+    buffer.set(this.buffer.subarray(0, this.size));
+    this.buffer = buffer;
+    this.view = new DataView(buffer.buffer);
+  }
+
+  protected add(
+    op: number,
+    dbi: number,
+    flags: number,
+    key: ArrayBuffer,
+    data?: ArrayBuffer
+  ): this {
+    if (!dbi) throw new DbError("Database is already closed");
+    const keyU8 = new Uint8Array(key);
+    const dataU8 = data ? new Uint8Array(data) : new Uint8Array(0);
+    this.reserve(BATCH_HEADER_SIZE + keyU8.length + dataU8.length);
+    const header = [op, dbi, flags, keyU8.length, dataU8.length];
+    for (const value of header) {
+      this.view.setUint32(this.size, value, littleEndian);
+      this.size += Uint32Array.BYTES_PER_ELEMENT;
+    }
+    this.buffer.set(keyU8, this.size);
+    this.size += keyU8.length;
+    this.buffer.set(dataU8, this.size);
+    this.size += dataU8.length;
+    this.count++;
+    return this;
+  }
+
+  put<K extends Key>(
+    db: Database<K>,
+    key: K,
+    value: Value,
+    flags?: PutFlags
+  ): this {
+    return this.add(
+      BATCH_PUT,
+      db.dbi,
+      flags
+        ? (flags.append ? MDB_APPEND : 0) |
+            (flags.noOverwrite ? MDB_NOOVERWRITE : 0)
+        : 0,
+      db.keyBuffer(key),
+      encodeValue(value)
+    );
+  }
+
+  /** Queue a put which results in MDB_KEYEXIST if the key already exists. */
+  putNoOverwrite<K extends Key>(db: Database<K>, key: K, value: Value): this {
+    return this.put(db, key, value, { noOverwrite: true });
+  }
+
+  /** Queue a delete which results in MDB_NOTFOUND if the key is missing. */
+  del<K extends Key>(db: Database<K>, key: K): this {
+    return this.add(BATCH_DEL, db.dbi, 0, db.keyBuffer(key));
+  }
+
+  /**
+   * Queue a check that the key's current value equals value. If it does
+   * not, the next op queued is skipped, and both results are ECANCELED.
+   */
+  ifValue<K extends Key>(db: Database<K>, key: K, value: Value): this {
+    return this.add(
+      BATCH_CHECK,
+      db.dbi,
+      CHECK_EQUAL,
+      db.keyBuffer(key),
+      encodeValue(value)
+    );
+  }
+
+  /**
+   * Queue a check that the key does not exist. If it does, the next op
+   * queued is skipped, and both results are ECANCELED.
+   */
+  ifMissing<K extends Key>(db: Database<K>, key: K): this {
+    return this.add(BATCH_CHECK, db.dbi, CHECK_MISSING, db.keyBuffer(key));
+  }
+
+  /** The current end of the batch, for rollback() */
+  mark(): [number, number] {
+    return [this.size, this.count];
+  }
+
+  /** Drop every op queued since mark() */
+  rollback([size, count]: [number, number]): void {
+    this.size = size;
+    this.count = count;
+  }
+
+  clear(): void {
+    this.size = 0;
+    this.count = 0;
+  }
+
+  /**
+   * Apply every queued op in a single transaction, without flushing to disk.
+   * If the map is full, it is grown and the batch is applied again.
+   * @returns one result code per op, in the order they were queued.
+   */
+  writeSync(): Int32Array {
+    if (!this.env.isOpen) throw notOpen();
+    const results = new Int32Array(this.count);
+    let rc: number;
+    do {
+      rc = lmdb.ffi_write_batch(
+        this.env.fenv,
+        this.buffer,
+        this.count,
+        results
+      );
+    } while (rc && this.env.growMapSync(rc));
+    if (rc) throw DbError.from(rc);
+    this.clear();
+    return results;
+  }
+
+  /**
+   * Apply every queued op in a single transaction, on the environment's
+   * native writer thread (see EnvOptions.writerThread), so that the
+   * calling thread never waits for the write lock. The batch is cleared
+   * at once, and can be reused while this is pending.
+   * @returns one result code per op, in the order they were queued, once
+   *          committed, but without flushing to disk.
+   */
+  async submit(): Promise<Int32Array> {
+    const buffer = this.buffer.slice(0, this.size);
+    const count = this.count;
+    this.clear();
+    if (!this.env.isOpen) throw notOpen();
+    const results = new Int32Array(count);
+    let rc: number;
+    do {
+      rc = await workerPool.submit((client, id) =>
+        lmdb.ffi_writer_submit(
+          client,
+          id,
+          this.env.fenv,
+          buffer,
+          count,
+          results
+        )
+      );
+    } while (rc && (await this.env.growMap(rc)));
+    if (rc) throw DbError.from(rc);
+    return results;
+  }
+
+  /**
+   * Apply every queued op in a single transaction, then flush to disk.
+   * Uses the native writer thread if the environment has one.
+   * @returns one result code per op, in the order they were queued.
+   */
+  async write(): Promise<Int32Array> {
+    const results = this.env.options.writerThread
+      ? await this.submit()
+      : this.writeSync();
+    await this.env.flush();
+    return results;
+  }
+}
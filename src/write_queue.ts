@@ -0,0 +1,166 @@
+import { ECANCELED, MDB_KEYEXIST, MDB_NOTFOUND } from "./lmdb_ffi.ts";
+import { Database, PutFlags } from "./database.ts";
+import {
+  ConditionFailedError,
+  DbError,
+  KeyExistsError,
+  NotFoundError,
+} from "./dberror.ts";
+import { Environment } from "./environment.ts";
+import { WriteBatch } from "./write_batch.ts";
+import { encodeKey, Key, Value } from "./util.ts";
+
+/** Default number of queued ops which triggers an immediate write */
+export const DEFAULT_WRITE_BATCH_SIZE = 1000;
+
+/**
+ * Guards a queued write: it is skipped, and its promise rejects with
+ * ConditionFailedError, unless the condition holds when the batch is
+ * applied.
+ */
+export interface WriteCondition {
+  /** the key's current value must equal this */
+  ifValue?: Value;
+  /** the key must not exist */
+  ifMissing?: boolean;
+}
+
+interface QueuedOp {
+  /** index of the op's result, after any check */
+  index: number;
+  // deno-lint-ignore no-explicit-any
+  db: Database<any>;
+  key: Key;
+  resolve: () => void;
+  reject: (err: Error) => void;
+}
+
+/**
+ * Combines single-record writes, issued by any number of callers, into
+ * one write transaction per batch, instead of one per record. Ops queued
+ * in the same tick (or within EnvOptions.writeWindowMs) are applied
+ * together, in order, with a single FFI call, and share one fsync. Each
+ * op's promise settles with its own result once the batch is on disk.
+ */
+export class WriteQueue {
+  env: Environment;
+  windowMs: number;
+  batchSize: number;
+
+  protected batch: WriteBatch;
+  protected ops: QueuedOp[] = [];
+  protected scheduled = false;
+
+  constructor(env: Environment) {
+    this.env = env;
+    this.windowMs = env.options.writeWindowMs || 0;
+    this.batchSize = env.options.writeBatchSize || DEFAULT_WRITE_BATCH_SIZE;
+    this.batch = new WriteBatch(env);
+  }
+
+  put<K extends Key>(
+    db: Database<K>,
+    key: K,
+    value: Value,
+    flags?: PutFlags,
+    condition?: WriteCondition
+  ): Promise<void> {
+    return this.enqueue(db, key, condition, () =>
+      this.batch.put(db, key, value, flags)
+    );
+  }
+
+  del<K extends Key>(
+    db: Database<K>,
+    key: K,
+    condition?: WriteCondition
+  ): Promise<void> {
+    return this.enqueue(db, key, condition, () => this.batch.del(db, key));
+  }
+
+  protected enqueue<K extends Key>(
+    db: Database<K>,
+    key: K,
+    condition: WriteCondition | undefined,
+    add: () => void
+  ): Promise<void> {
+    return new Promise((resolve, reject) => {
+      const mark = this.batch.mark();
+      try {
+        if (condition?.ifMissing) this.batch.ifMissing(db, key);
+        else if (condition?.ifValue !== undefined) {
+          this.batch.ifValue(db, key, condition.ifValue);
+        }
+        add();
+      } catch (err) {
+        // don't leave a check behind to guard some other op
+        this.batch.rollback(mark);
+        throw err;
+      }
+      this.ops.push({ index: this.batch.count - 1, db, key, resolve, reject });
+      if (this.ops.length >= this.batchSize) this.flush();
+      else this.schedule();
+    });
+  }
+
+  protected schedule(): void {
+    if (this.scheduled) return;
+    this.scheduled = true;
+    const run = () => {
+      if (this.scheduled) this.flush();
+    };
+    if (this.windowMs) setTimeout(run, this.windowMs);
+    else queueMicrotask(run);
+  }
+
+  /** Write every queued op now, and wait until they are on disk. */
+  async flush(): Promise<void> {
+    this.scheduled = false;
+    if (!this.ops.length) return;
+    const ops = this.ops;
+    this.ops = [];
+    let results: Int32Array;
+    try {
+      if (this.env.options.writerThread) results = await this.batch.submit();
+      else results = this.batch.writeSync();
+    } catch (err) {
+      // submit() has already cleared the batch, which may since have
+      // taken new ops
+      if (!this.env.options.writerThread) this.batch.clear();
+      for (const op of ops) op.reject(err);
+      return;
+    }
+    try {
+      await this.env.flush();
+    } catch (err) {
+      for (const op of ops) op.reject(err);
+      return;
+    }
+    for (const op of ops) {
+      const rc = results[op.index];
+      if (!rc) op.resolve();
+      else op.reject(this.error(op, rc));
+    }
+  }
+
+  protected error(op: QueuedOp, rc: number): Error {
+    switch (rc) {
+      case MDB_KEYEXIST: {
+        let value: ArrayBuffer;
+        try {
+          value = op.db.get(op.key);
+        } catch {
+          // deleted again since the batch was applied
+          value = new ArrayBuffer(0);
+        }
+        return new KeyExistsError(encodeKey(op.key), value);
+      }
+      case MDB_NOTFOUND:
+        return new NotFoundError(op.key);
+      case ECANCELED:
+        return new ConditionFailedError(op.key);
+      default:
+        return DbError.from(rc);
+    }
+  }
+}